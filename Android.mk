@@ -46,13 +46,17 @@ buffetSharedLibraries := \
 	libbrillo-stream \
 	libchrome \
 	libchrome-dbus \
+	libcrypto \
+	libcurl \
 	libcutils \
 	libdbus \
 	libnativepower \
 	libshill-client \
+	libssl \
 	libutils \
 	libweave \
 	libwebserv \
+	libz \
 
 ifdef BRILLO
 
@@ -106,23 +110,36 @@ LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)
 
 LOCAL_SRC_FILES := \
 	brillo/weaved_system_properties.cc \
+	buffet/aead.cc \
 	buffet/ap_manager_client.cc \
 	buffet/avahi_mdns_client.cc \
 	buffet/binder_command_proxy.cc \
 	buffet/binder_weave_service.cc \
 	buffet/buffet_config.cc \
+	buffet/compression.cc \
+	buffet/connectivity_index.cc \
+	buffet/container_file_io.cc \
 	buffet/dbus_constants.cc \
+	buffet/dns_cache.cc \
 	buffet/flouride_socket_bluetooth_client.cc \
 	buffet/http_transport_client.cc \
+	buffet/io_worker_pool.cc \
 	buffet/manager.cc \
+	buffet/prioritized_task_runner.cc \
+	buffet/settings_journal.cc \
 	buffet/shill_client.cc \
 	buffet/socket_stream.cc \
+	buffet/software_encryptor.cc \
+	buffet/stream_meter.cc \
+	buffet/tcp_connector.cc \
+	buffet/tls_session_cache.cc \
+	buffet/tls_stream.cc \
 	buffet/webserv_client.cc \
 
 ifdef BRILLO
 LOCAL_SRC_FILES += buffet/keystore_encryptor.cc
 else
-LOCAL_SRC_FILES += buffet/fake_encryptor.cc
+LOCAL_SRC_FILES += buffet/default_encryptor.cc
 endif
 
 include $(BUILD_STATIC_LIBRARY)
@@ -208,8 +225,112 @@ LOCAL_STATIC_LIBRARIES := \
 LOCAL_CLANG := true
 
 LOCAL_SRC_FILES := \
+	buffet/aead_unittest.cc \
 	buffet/binder_command_proxy_unittest.cc \
 	buffet/buffet_config_unittest.cc \
 	buffet/buffet_testrunner.cc \
+	buffet/compression_unittest.cc \
+	buffet/connectivity_index_unittest.cc \
+	buffet/container_file_io_unittest.cc \
+	buffet/dns_cache_unittest.cc \
+	buffet/http_transport_client_unittest.cc \
+	buffet/io_worker_pool_unittest.cc \
+	buffet/prioritized_task_runner_unittest.cc \
+	buffet/settings_journal_unittest.cc \
+	buffet/software_encryptor_unittest.cc \
+	buffet/stream_meter_unittest.cc \
+	buffet/tcp_connector_unittest.cc \
+	buffet/tls_session_cache_unittest.cc \
+	buffet/tls_stream_unittest.cc \
+	buffet/tls_test_server.cc \
 
 include $(BUILD_NATIVE_TEST)
+
+# weaved_allocation_test
+# ========================================================
+# Replaces the global operator new to count allocations, so it does not share
+# a binary with other tests.
+include $(CLEAR_VARS)
+LOCAL_MODULE := weaved_allocation_test
+LOCAL_MODULE_TAGS := eng
+LOCAL_CPP_EXTENSION := $(buffetCommonCppExtension)
+LOCAL_CFLAGS := $(buffetCommonCFlags)
+LOCAL_CPPFLAGS := $(buffetCommonCppFlags)
+LOCAL_C_INCLUDES := \
+	$(buffetCommonCIncludes) \
+	external/gmock/include \
+
+LOCAL_SHARED_LIBRARIES := \
+	$(buffetSharedLibraries) \
+
+LOCAL_STATIC_LIBRARIES := \
+	libbrillo-test-helpers \
+	libchrome_test_helpers \
+	libgtest \
+	libgmock \
+	weave-daemon-common \
+	weave-common \
+
+LOCAL_CLANG := true
+
+LOCAL_SRC_FILES := \
+	buffet/allocation_counter.cc \
+	buffet/buffet_testrunner.cc \
+	buffet/http_transport_client_allocation_unittest.cc \
+
+include $(BUILD_NATIVE_TEST)
+
+# weaved_benchmark
+# ========================================================
+include $(CLEAR_VARS)
+LOCAL_MODULE := weaved_benchmark
+LOCAL_MODULE_TAGS := eng
+LOCAL_CPP_EXTENSION := $(buffetCommonCppExtension)
+LOCAL_CFLAGS := $(buffetCommonCFlags)
+LOCAL_CPPFLAGS := $(buffetCommonCppFlags)
+LOCAL_C_INCLUDES := $(buffetCommonCIncludes)
+LOCAL_SHARED_LIBRARIES := $(buffetSharedLibraries)
+LOCAL_STATIC_LIBRARIES := \
+	weave-daemon-common \
+	weave-common \
+
+LOCAL_CLANG := true
+
+LOCAL_SRC_FILES := \
+	buffet/buffet_benchmarkrunner.cc \
+	buffet/connectivity_index_benchmark.cc \
+	buffet/encryptor_benchmark.cc \
+	buffet/tls_stream_benchmark.cc \
+	buffet/tls_test_server.cc \
+
+ifdef BRILLO
+# Compares with KeystoreEncryptor.
+LOCAL_CFLAGS += -DBRILLO
+endif
+
+include $(BUILD_NATIVE_BENCHMARK)
+
+# weaved_allocation_benchmark
+# ========================================================
+# Replaces the global operator new to count allocations, so it does not share
+# a binary with other benchmarks.
+include $(CLEAR_VARS)
+LOCAL_MODULE := weaved_allocation_benchmark
+LOCAL_MODULE_TAGS := eng
+LOCAL_CPP_EXTENSION := $(buffetCommonCppExtension)
+LOCAL_CFLAGS := $(buffetCommonCFlags)
+LOCAL_CPPFLAGS := $(buffetCommonCppFlags)
+LOCAL_C_INCLUDES := $(buffetCommonCIncludes)
+LOCAL_SHARED_LIBRARIES := $(buffetSharedLibraries)
+LOCAL_STATIC_LIBRARIES := \
+	weave-daemon-common \
+	weave-common \
+
+LOCAL_CLANG := true
+
+LOCAL_SRC_FILES := \
+	buffet/allocation_counter.cc \
+	buffet/buffet_benchmarkrunner.cc \
+	buffet/http_transport_client_benchmark.cc \
+
+include $(BUILD_NATIVE_BENCHMARK)
@@ -0,0 +1,130 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/aead.h"
+
+#include <base/logging.h>
+#include <openssl/aead.h>
+#include <openssl/rand.h>
+
+namespace buffet {
+namespace aead {
+
+const size_t kKeySize = 32;
+
+namespace {
+
+// BoringSSL picks the AES-NI/ARMv8 Crypto Extensions code paths at runtime
+// when the CPU supports them.
+const EVP_AEAD* GetAlgorithm() {
+  return EVP_aead_aes_256_gcm();
+}
+
+// Owns an initialized EVP_AEAD_CTX.
+class ScopedAeadContext {
+ public:
+  bool Init(const brillo::SecureBlob& key) {
+    if (key.size() != kKeySize)
+      return false;
+    initialized_ = EVP_AEAD_CTX_init(&ctx_, GetAlgorithm(), key.data(),
+                                     key.size(), EVP_AEAD_DEFAULT_TAG_LENGTH,
+                                     nullptr) == 1;
+    return initialized_;
+  }
+
+  ~ScopedAeadContext() {
+    if (initialized_)
+      EVP_AEAD_CTX_cleanup(&ctx_);
+  }
+
+  EVP_AEAD_CTX* get() { return &ctx_; }
+
+ private:
+  EVP_AEAD_CTX ctx_;
+  bool initialized_{false};
+};
+
+const uint8_t* AsBytes(const std::string& str) {
+  return reinterpret_cast<const uint8_t*>(str.data());
+}
+
+}  // namespace
+
+bool GenerateKey(brillo::SecureBlob* key) {
+  key->resize(kKeySize);
+  return RAND_bytes(key->data(), key->size()) == 1;
+}
+
+bool Seal(const brillo::SecureBlob& key,
+          const std::string& plaintext,
+          const std::string& additional_data,
+          std::string* ciphertext) {
+  ScopedAeadContext ctx;
+  if (!ctx.Init(key)) {
+    LOG(ERROR) << "Failed to initialize AEAD context.";
+    return false;
+  }
+
+  const size_t nonce_length = EVP_AEAD_nonce_length(GetAlgorithm());
+  const size_t max_out_length =
+      plaintext.size() + EVP_AEAD_max_overhead(GetAlgorithm());
+  ciphertext->resize(nonce_length + max_out_length);
+  uint8_t* nonce = reinterpret_cast<uint8_t*>(&(*ciphertext)[0]);
+  if (RAND_bytes(nonce, nonce_length) != 1)
+    return false;
+
+  size_t out_length = 0;
+  if (EVP_AEAD_CTX_seal(ctx.get(), nonce + nonce_length, &out_length,
+                        max_out_length, nonce, nonce_length, AsBytes(plaintext),
+                        plaintext.size(), AsBytes(additional_data),
+                        additional_data.size()) != 1) {
+    LOG(ERROR) << "Failed to seal data.";
+    return false;
+  }
+  ciphertext->resize(nonce_length + out_length);
+  return true;
+}
+
+bool Open(const brillo::SecureBlob& key,
+          const std::string& ciphertext,
+          const std::string& additional_data,
+          std::string* plaintext) {
+  const size_t nonce_length = EVP_AEAD_nonce_length(GetAlgorithm());
+  if (ciphertext.size() < nonce_length)
+    return false;
+
+  ScopedAeadContext ctx;
+  if (!ctx.Init(key)) {
+    LOG(ERROR) << "Failed to initialize AEAD context.";
+    return false;
+  }
+
+  const size_t in_length = ciphertext.size() - nonce_length;
+  plaintext->resize(in_length);
+  size_t out_length = 0;
+  if (EVP_AEAD_CTX_open(ctx.get(),
+                        reinterpret_cast<uint8_t*>(&(*plaintext)[0]),
+                        &out_length, in_length, AsBytes(ciphertext),
+                        nonce_length, AsBytes(ciphertext) + nonce_length,
+                        in_length, AsBytes(additional_data),
+                        additional_data.size()) != 1) {
+    plaintext->clear();
+    return false;
+  }
+  plaintext->resize(out_length);
+  return true;
+}
+
+}  // namespace aead
+}  // namespace buffet
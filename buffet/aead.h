@@ -0,0 +1,48 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BUFFET_AEAD_H_
+#define BUFFET_AEAD_H_
+
+#include <string>
+
+#include <brillo/secure_blob.h>
+
+namespace buffet {
+namespace aead {
+
+// Size of the keys used by Seal() and Open(), in bytes.
+extern const size_t kKeySize;
+
+// Fills |key| with a new random key.
+bool GenerateKey(brillo::SecureBlob* key);
+
+// Encrypts and authenticates |plaintext| and |additional_data| with
+// AES-256-GCM under |key|. A random nonce is prepended to |ciphertext|.
+bool Seal(const brillo::SecureBlob& key,
+          const std::string& plaintext,
+          const std::string& additional_data,
+          std::string* ciphertext);
+
+// Reverses Seal(). Fails if |ciphertext| or |additional_data| do not match
+// what was sealed under |key|.
+bool Open(const brillo::SecureBlob& key,
+          const std::string& ciphertext,
+          const std::string& additional_data,
+          std::string* plaintext);
+
+}  // namespace aead
+}  // namespace buffet
+
+#endif  // BUFFET_AEAD_H_
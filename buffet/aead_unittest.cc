@@ -0,0 +1,58 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/aead.h"
+
+#include <gtest/gtest.h>
+
+namespace buffet {
+
+TEST(AeadTest, SealAndOpen) {
+  brillo::SecureBlob key;
+  ASSERT_TRUE(aead::GenerateKey(&key));
+  EXPECT_EQ(aead::kKeySize, key.size());
+
+  std::string ciphertext;
+  ASSERT_TRUE(aead::Seal(key, "{\"secret\":42}", "header", &ciphertext));
+  EXPECT_EQ(std::string::npos, ciphertext.find("secret"));
+
+  std::string plaintext;
+  ASSERT_TRUE(aead::Open(key, ciphertext, "header", &plaintext));
+  EXPECT_EQ("{\"secret\":42}", plaintext);
+
+  // Nonces are random, so sealing twice gives different ciphertexts.
+  std::string ciphertext2;
+  ASSERT_TRUE(aead::Seal(key, "{\"secret\":42}", "header", &ciphertext2));
+  EXPECT_NE(ciphertext, ciphertext2);
+}
+
+TEST(AeadTest, RejectsTampering) {
+  brillo::SecureBlob key;
+  ASSERT_TRUE(aead::GenerateKey(&key));
+  std::string ciphertext;
+  ASSERT_TRUE(aead::Seal(key, "data", "header", &ciphertext));
+
+  std::string plaintext;
+  EXPECT_FALSE(aead::Open(key, ciphertext, "other header", &plaintext));
+  std::string modified = ciphertext;
+  modified.back() ^= 1;
+  EXPECT_FALSE(aead::Open(key, modified, "header", &plaintext));
+  EXPECT_FALSE(aead::Open(key, ciphertext.substr(0, 4), "header", &plaintext));
+
+  brillo::SecureBlob other_key;
+  ASSERT_TRUE(aead::GenerateKey(&other_key));
+  EXPECT_FALSE(aead::Open(other_key, ciphertext, "header", &plaintext));
+}
+
+}  // namespace buffet
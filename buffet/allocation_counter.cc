@@ -0,0 +1,62 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "buffet/allocation_counter.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <new>
+
+#include <base/logging.h>
+
+namespace buffet {
+
+namespace {
+
+std::atomic<AllocationCounter*> g_counter{nullptr};
+
+}  // namespace
+
+AllocationCounter::AllocationCounter(size_t min_size) : min_size_{min_size} {
+  AllocationCounter* expected = nullptr;
+  CHECK(g_counter.compare_exchange_strong(expected, this));
+}
+
+AllocationCounter::~AllocationCounter() {
+  g_counter = nullptr;
+}
+
+void AllocationCounter::OnAllocation(size_t size) {
+  AllocationCounter* counter = g_counter;
+  if (!counter || size < counter->min_size_)
+    return;
+  counter->allocations_++;
+  counter->allocated_bytes_ += size;
+}
+
+}  // namespace buffet
+
+// The array forms call these.
+void* operator new(size_t size) {
+  buffet::AllocationCounter::OnAllocation(size);
+  void* pointer = malloc(std::max<size_t>(size, 1));
+  CHECK(pointer);
+  return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+  free(pointer);
+}
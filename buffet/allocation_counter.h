@@ -0,0 +1,55 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef BUFFET_ALLOCATION_COUNTER_H_
+#define BUFFET_ALLOCATION_COUNTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include <base/macros.h>
+
+namespace buffet {
+
+// Counts the heap allocations made through operator new while it exists.
+// allocation_counter.cc replaces the global operator new and delete, so it
+// is only linked into the test and benchmark binaries of its own
+// (weaved_allocation_test and weaved_allocation_benchmark).
+class AllocationCounter final {
+ public:
+  // Counts allocations of at least |min_size| bytes, on any thread. Only one
+  // counter may exist at a time.
+  explicit AllocationCounter(size_t min_size = 0);
+  ~AllocationCounter();
+
+  uint64_t allocations() const { return allocations_; }
+  uint64_t allocated_bytes() const { return allocated_bytes_; }
+
+  // Called by operator new.
+  static void OnAllocation(size_t size);
+
+ private:
+  const size_t min_size_;
+  std::atomic<uint64_t> allocations_{0};
+  std::atomic<uint64_t> allocated_bytes_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(AllocationCounter);
+};
+
+}  // namespace buffet
+
+#endif  // BUFFET_ALLOCATION_COUNTER_H_
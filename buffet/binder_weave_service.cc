@@ -21,6 +21,7 @@
 #include <weave/device.h>
 
 #include "buffet/binder_command_proxy.h"
+#include "buffet/prioritized_task_runner.h"
 #include "common/binder_utils.h"
 
 using weaved::binder_utils::ToStatus;
@@ -70,6 +71,8 @@ android::binder::Status BinderWeaveService::registerCommandHandler(
 android::binder::Status BinderWeaveService::updateState(
     const android::String16& component,
     const android::String16& state) {
+  // State changes are only uploaded to the cloud, which nobody waits on.
+  ScopedTaskPriority scoped_priority{TaskPriority::kBackground};
   weave::ErrorPtr error;
   return ToStatus(device_->SetStatePropertiesFromJson(ToString(component),
                                                       ToString(state),
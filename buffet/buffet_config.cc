@@ -14,20 +14,33 @@
 
 #include "buffet/buffet_config.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <map>
 #include <set>
 
+#include <base/bind.h>
 #include <base/files/file_util.h>
 #include <base/files/important_file_writer.h>
+#include <base/files/scoped_file.h>
 #include <base/logging.h>
 #include <base/message_loop/message_loop.h>
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_number_conversions.h>
 #include <brillo/errors/error.h>
 #include <brillo/errors/error_codes.h>
+#include <brillo/message_loops/message_loop.h>
 #include <brillo/osrelease_reader.h>
 #include <brillo/strings/string_utils.h>
 #include <weave/enum_to_string.h>
 
+#include "buffet/compression.h"
+#include "buffet/container_file_io.h"
+#include "buffet/io_worker_pool.h"
+#include "buffet/settings_journal.h"
+
 namespace buffet {
 
 namespace {
@@ -35,6 +48,17 @@ namespace {
 const char kErrorDomain[] = "buffet";
 const char kFileReadError[] = "file_read_error";
 const char kProductVersionKey[] = "product_version";
+// All settings files are written in order on this IoWorkerPool sequence.
+const char kSettingsSequence[] = "settings";
+const char kJournalExtension[] = "journal";
+const char kContainerExtension[] = "container";
+// Compressed settings start with this prefix before they are encrypted. JSON
+// never starts with it, so uncompressed settings need no prefix.
+const char kCompressedPrefix[] = "WVZ\x01";
+const size_t kCompressedPrefixSize = sizeof(kCompressedPrefix) - 1;
+// Limit on the size of settings and journal deltas. Bounds memory use when
+// inflating a corrupted blob, so larger ones are not saved either.
+const size_t kMaxSettingsSize = 1024 * 1024;
 
 class DefaultFileIO : public BuffetConfig::FileIO {
  public:
@@ -45,6 +69,19 @@ class DefaultFileIO : public BuffetConfig::FileIO {
                  const std::string& content) override {
     return base::ImportantFileWriter::WriteFileAtomically(path, content);
   }
+  bool AppendFile(const base::FilePath& path,
+                  const std::string& content) override {
+    base::ScopedFD fd{HANDLE_EINTR(
+        open(path.value().c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+             S_IRUSR | S_IWUSR))};
+    return fd.is_valid() &&
+           base::WriteFileDescriptor(fd.get(), content.data(),
+                                     content.size()) &&
+           HANDLE_EINTR(fdatasync(fd.get())) == 0;
+  }
+  bool PathExists(const base::FilePath& path) override {
+    return base::PathExists(path);
+  }
 };
 
 }  // namespace
@@ -73,10 +110,35 @@ const char kPairingModes[] = "pairing_modes";
 
 BuffetConfig::BuffetConfig(const Options& options)
     : options_(options),
-      default_encryptor_(Encryptor::CreateDefaultEncryptor()),
+      default_encryptor_(Encryptor::CreateDefaultEncryptor(options.settings)),
       encryptor_(default_encryptor_.get()),
       default_file_io_(new DefaultFileIO),
-      file_io_(default_file_io_.get()) {}
+      file_io_(default_file_io_.get()) {
+  if (options_.use_settings_container) {
+    container_file_io_.reset(new ContainerFileIO{
+        options_.settings.AddExtension(kContainerExtension),
+        default_file_io_.get()});
+    file_io_ = container_file_io_.get();
+  }
+}
+
+BuffetConfig::~BuffetConfig() {
+  // Pending writes use |encryptor_| and |file_io_|, and settings must not get
+  // lost on shutdown.
+  if (io_worker_pool_)
+    io_worker_pool_->WaitForSequence(kSettingsSequence);
+  // Store all remaining settings in one container write.
+  if (container_file_io_)
+    container_file_io_->BeginBatch();
+  for (const auto& pair : pending_saves_) {
+    if (pair.second.dirty) {
+      WriteResult result;
+      WriteSettings(pair.first, pair.second.settings, &result);
+    }
+  }
+  if (container_file_io_)
+    container_file_io_->CommitBatch();
+}
 
 bool BuffetConfig::LoadDefaults(weave::Settings* settings) {
   // Keep this hardcoded default for sometime. This previously was set by
@@ -167,20 +229,54 @@ bool BuffetConfig::LoadDefaults(const brillo::KeyValueStore& store,
 }
 
 std::string BuffetConfig::LoadSettings(const std::string& name) {
+  // Settings that are not written yet are newer than the file.
+  auto pending = pending_saves_.find(name);
+  if (pending != pending_saves_.end())
+    return pending->second.settings;
+
   std::string settings_blob;
   base::FilePath path = CreatePath(name);
   if (!file_io_->ReadFile(path, &settings_blob)) {
     LOG(WARNING) << "Failed to read \'" + path.value() +
                         "\', proceeding with empty settings.";
+    cache_.erase(name);
     return std::string();
   }
+  std::string journal_blob;
+  std::vector<std::string> records;
+  if (settings_blob.empty() ||
+      !file_io_->ReadFile(CreateJournalPath(name), &journal_blob) ||
+      !settings_journal::ParseJournal(journal_blob, settings_blob, &records)) {
+    // No journal, or a stale one left behind by a snapshot write.
+    journal_blob.clear();
+  }
+  // Reading the files is cheap compared to decryption, which may take a
+  // keystore round trip. Only decrypt if the files changed since they were
+  // last decrypted or written by us.
+  auto cached = cache_.find(name);
+  if (cached != cache_.end() && cached->second.snapshot == settings_blob &&
+      cached->second.journal == journal_blob) {
+    return cached->second.plaintext.to_string();
+  }
+
   std::string json_string;
-  if (!encryptor_->DecryptWithAuthentication(settings_blob, &json_string)) {
+  if (!DecryptSettings(settings_blob, &json_string)) {
     LOG(WARNING)
         << "Failed to decrypt settings, proceeding with empty settings.";
+    cache_.erase(name);
     SaveSettings(std::string(), name, {});
     return std::string();
   }
+  for (const std::string& record : records) {
+    std::string delta;
+    if (!DecryptSettings(record, &delta) ||
+        !settings_journal::ApplyDelta(delta, &json_string)) {
+      LOG(WARNING) << "Failed to apply settings journal record, ignoring the "
+                      "rest of the journal.";
+      break;
+    }
+  }
+  UpdateCache(name, json_string, settings_blob, journal_blob);
   return json_string;
 }
 
@@ -191,23 +287,230 @@ std::string BuffetConfig::LoadSettings() {
 void BuffetConfig::SaveSettings(const std::string& name,
                                 const std::string& settings,
                                 const weave::DoneCallback& callback) {
-  std::string encrypted_settings;
-  weave::ErrorPtr error;
+  stats_.saves_requested++;
+  if (!io_worker_pool_ && options_.settings_write_delay.is_zero()) {
+    WriteResult result;
+    stats_.saves_written++;
+    WriteSettings(name, settings, &result);
+    UpdateStats(result);
+    if (result.error)
+      cache_.erase(name);
+    else
+      UpdateCache(name, settings, result.snapshot, result.journal);
+    if (!callback.is_null()) {
+      base::MessageLoop::current()->PostTask(
+          FROM_HERE, base::Bind(callback, base::Passed(&result.error)));
+    }
+    return;
+  }
+
+  PendingSave& pending = pending_saves_[name];
+  pending.settings = settings;
+  pending.dirty = true;
+  if (!callback.is_null())
+    pending.callbacks.push_back(callback);
+  if (!pending.write_in_flight)
+    ScheduleWrite(name);
+}
+
+void BuffetConfig::ScheduleWrite(const std::string& name) {
+  PendingSave& pending = pending_saves_[name];
+  if (pending.write_scheduled)
+    return;
+  if (options_.settings_write_delay.is_zero()) {
+    StartWrite(name);
+    return;
+  }
+  pending.write_scheduled = true;
+  brillo::MessageLoop::current()->PostDelayedTask(
+      FROM_HERE, base::Bind(&BuffetConfig::StartWrite,
+                            weak_ptr_factory_.GetWeakPtr(), name),
+      options_.settings_write_delay);
+}
+
+void BuffetConfig::StartWrite(const std::string& name) {
+  PendingSave& pending = pending_saves_[name];
+  pending.write_scheduled = false;
+  CHECK(!pending.write_in_flight);
+  pending.dirty = false;
+  pending.write_in_flight = true;
+  std::vector<weave::DoneCallback> callbacks;
+  std::swap(callbacks, pending.callbacks);
+  stats_.saves_written++;
+
+  WriteResult* result = new WriteResult;
+  if (!io_worker_pool_) {
+    WriteSettings(name, pending.settings, result);
+    OnSettingsWritten(name, callbacks, result);
+    delete result;
+    return;
+  }
+  io_worker_pool_->PostTaskAndReply(
+      FROM_HERE, kSettingsSequence,
+      base::Bind(&BuffetConfig::WriteSettings, base::Unretained(this), name,
+                 pending.settings, base::Unretained(result)),
+      base::Bind(&BuffetConfig::OnSettingsWritten,
+                 weak_ptr_factory_.GetWeakPtr(), name, callbacks,
+                 base::Owned(result)));
+}
+
+void BuffetConfig::WriteSettings(const std::string& name,
+                                 const std::string& settings,
+                                 WriteResult* result) {
+  // The settings on disk are kept, since they could not be read back.
+  if (settings.size() > kMaxSettingsSize) {
+    weave::Error::AddTo(&result->error, FROM_HERE, "file_write_error",
+                        "Settings are larger than " +
+                            base::SizeTToString(kMaxSettingsSize) +
+                            " bytes.");
+    return;
+  }
+  if (AppendToJournal(name, settings, result))
+    return;
+
+  // Write a new snapshot. This also makes the journal stale.
+  JournalState& journal = journals_[name];
   base::FilePath path = CreatePath(name);
-  if (!encryptor_->EncryptWithAuthentication(settings, &encrypted_settings)) {
-    weave::Error::AddTo(&error, FROM_HERE, "file_write_error",
+  if (!EncryptSettings(settings, &result->snapshot)) {
+    weave::Error::AddTo(&result->error, FROM_HERE, "file_write_error",
                         "Failed to encrypt settings.");
-    encrypted_settings.clear();
+    result->snapshot.clear();
   }
-  if (!file_io_->WriteFile(path, encrypted_settings)) {
-    weave::Error::AddTo(&error, FROM_HERE, "file_write_error",
+  if (!file_io_->WriteFile(path, result->snapshot)) {
+    weave::Error::AddTo(&result->error, FROM_HERE, "file_write_error",
                         "Failed to write \'" + path.value() +
                             "\', proceeding with empty settings.");
+  } else {
+    result->bytes_written += result->snapshot.size();
   }
-  if (!callback.is_null()) {
-    base::MessageLoop::current()->PostTask(
-        FROM_HERE, base::Bind(callback, base::Passed(&error)));
+
+  journal.settings.clear();
+  journal.journal.clear();
+  if (result->error) {
+    journal.snapshot.clear();
+    return;
   }
+  journal.settings.assign(settings.begin(), settings.end());
+  journal.snapshot = result->snapshot;
+}
+
+bool BuffetConfig::AppendToJournal(const std::string& name,
+                                   const std::string& settings,
+                                   WriteResult* result) {
+  // Without a snapshot written by us there is nothing to apply changes to.
+  JournalState& journal = journals_[name];
+  std::string delta;
+  if (journal.snapshot.empty() ||
+      !settings_journal::CreateDelta(journal.settings.to_string(), settings,
+                                     &delta)) {
+    return false;
+  }
+
+  if (!delta.empty()) {
+    std::string ciphertext;
+    if (!EncryptSettings(delta, &ciphertext))
+      return false;
+    std::string record = settings_journal::EncodeRecord(ciphertext);
+    // Compact once the journal outgrows the snapshot, which bounds both the
+    // space used and the number of records to decrypt on load.
+    if (journal.journal.size() + record.size() > journal.snapshot.size())
+      return false;
+
+    base::FilePath path = CreateJournalPath(name);
+    if (journal.journal.empty()) {
+      // Replaces any stale journal of an older snapshot.
+      std::string contents =
+          settings_journal::CreateHeader(journal.snapshot) + record;
+      if (!file_io_->WriteFile(path, contents))
+        return false;
+      journal.journal = contents;
+      result->bytes_written += contents.size();
+    } else {
+      if (!file_io_->AppendFile(path, record))
+        return false;
+      journal.journal += record;
+      result->bytes_written += record.size();
+    }
+    result->journal_record_written = true;
+    journal.settings.clear();
+    journal.settings.assign(settings.begin(), settings.end());
+  }
+
+  result->snapshot = journal.snapshot;
+  result->journal = journal.journal;
+  return true;
+}
+
+bool BuffetConfig::EncryptSettings(const std::string& settings,
+                                   std::string* ciphertext) {
+  // A larger journal delta falls back to a snapshot.
+  if (settings.size() > kMaxSettingsSize)
+    return false;
+  std::string compressed;
+  if (options_.compress_settings &&
+      compression::Compress(settings, compression::Format::kZlib,
+                            &compressed) &&
+      kCompressedPrefixSize + compressed.size() < settings.size()) {
+    compressed.insert(0, kCompressedPrefix, kCompressedPrefixSize);
+    return encryptor_->EncryptWithAuthentication(compressed, ciphertext);
+  }
+  return encryptor_->EncryptWithAuthentication(settings, ciphertext);
+}
+
+bool BuffetConfig::DecryptSettings(const std::string& ciphertext,
+                                   std::string* settings) {
+  std::string plaintext;
+  if (!encryptor_->DecryptWithAuthentication(ciphertext, &plaintext))
+    return false;
+  // Compressed settings are read even if compression is disabled now.
+  if (plaintext.compare(0, kCompressedPrefixSize, kCompressedPrefix) != 0) {
+    *settings = plaintext;
+    return true;
+  }
+  return compression::Decompress(plaintext.substr(kCompressedPrefixSize),
+                                 compression::Format::kZlib, kMaxSettingsSize,
+                                 settings);
+}
+
+void BuffetConfig::OnSettingsWritten(
+    const std::string& name,
+    const std::vector<weave::DoneCallback>& callbacks,
+    WriteResult* result) {
+  PendingSave& pending = pending_saves_[name];
+  pending.write_in_flight = false;
+  UpdateStats(*result);
+  if (result->error) {
+    cache_.erase(name);
+  } else if (!pending.dirty) {
+    // Nothing was saved since the write started, so |pending.settings| is
+    // what is on disk now.
+    UpdateCache(name, pending.settings, result->snapshot, result->journal);
+  }
+  if (pending.dirty)
+    ScheduleWrite(name);
+  else
+    pending_saves_.erase(name);
+
+  for (const auto& callback : callbacks)
+    callback.Run(result->error ? result->error->Clone() : nullptr);
+}
+
+void BuffetConfig::UpdateCache(const std::string& name,
+                               const std::string& plaintext,
+                               const std::string& snapshot,
+                               const std::string& journal) {
+  CachedSettings& cached = cache_[name];
+  // clear() wipes the old contents before the buffer may be reallocated.
+  cached.plaintext.clear();
+  cached.plaintext.assign(plaintext.begin(), plaintext.end());
+  cached.snapshot = snapshot;
+  cached.journal = journal;
+}
+
+void BuffetConfig::UpdateStats(const WriteResult& result) {
+  if (result.journal_record_written)
+    stats_.journal_records_written++;
+  stats_.bytes_written += result.bytes_written;
 }
 
 base::FilePath BuffetConfig::CreatePath(const std::string& name) const {
@@ -216,6 +519,10 @@ base::FilePath BuffetConfig::CreatePath(const std::string& name) const {
                             base::FilePath::kExtensionSeparator + name);
 }
 
+base::FilePath BuffetConfig::CreateJournalPath(const std::string& name) const {
+  return CreatePath(name).AddExtension(kJournalExtension);
+}
+
 bool BuffetConfig::LoadFile(const base::FilePath& file_path,
                             std::string* data,
                             brillo::ErrorPtr* error) {
@@ -22,14 +22,19 @@
 
 #include <base/callback.h>
 #include <base/files/file_path.h>
+#include <base/memory/weak_ptr.h>
+#include <base/time/time.h>
 #include <brillo/errors/error.h>
 #include <brillo/key_value_store.h>
+#include <brillo/secure_blob.h>
 #include <weave/provider/config_store.h>
 
 #include "buffet/encryptor.h"
 
 namespace buffet {
 
+class ContainerFileIO;
+class IoWorkerPool;
 class StorageInterface;
 
 // Handles reading buffet config and state files.
@@ -49,6 +54,31 @@ class BuffetConfig final : public weave::provider::ConfigStore {
     base::FilePath test_definitions;
 
     std::string test_privet_ssid;
+
+    // Saves of the same settings name within this window are coalesced into
+    // a single write. Zero writes every save as soon as possible.
+    base::TimeDelta settings_write_delay;
+
+    // Keeps all settings files in a single container file next to
+    // |settings|.
+    bool use_settings_container{false};
+
+    // Compresses settings before they are encrypted. Compressed settings are
+    // loaded regardless of this option.
+    bool compress_settings{false};
+  };
+
+  // Counters of settings persistence activity.
+  struct Stats {
+    // Number of SaveSettings() calls.
+    uint64_t saves_requested{0};
+    // Number of settings blobs actually encrypted and written.
+    uint64_t saves_written{0};
+    // Of |saves_written|, the number written as a journal record instead of
+    // a full snapshot.
+    uint64_t journal_records_written{0};
+    // Number of bytes written to settings files.
+    uint64_t bytes_written{0};
   };
 
   // An IO abstraction to enable testing without using real files.
@@ -57,9 +87,15 @@ class BuffetConfig final : public weave::provider::ConfigStore {
     virtual bool ReadFile(const base::FilePath& path, std::string* content) = 0;
     virtual bool WriteFile(const base::FilePath& path,
                            const std::string& content) = 0;
+    // Appends |content| to |path| and makes it durable. A failed append may
+    // leave part of |content| at the end of the file.
+    virtual bool AppendFile(const base::FilePath& path,
+                            const std::string& content) = 0;
+    // Tells a missing file from one that ReadFile() failed to read.
+    virtual bool PathExists(const base::FilePath& path) = 0;
   };
 
-  ~BuffetConfig() override = default;
+  ~BuffetConfig() override;
 
   explicit BuffetConfig(const Options& options);
 
@@ -86,8 +122,83 @@ class BuffetConfig final : public weave::provider::ConfigStore {
     file_io_ = file_io;
   }
 
+  // Moves encryption and writing of saved settings to |io_worker_pool|. Without
+  // a pool settings are saved synchronously. The caller retains ownership of
+  // the pointer, which must outlive this object.
+  void SetIoWorkerPool(IoWorkerPool* io_worker_pool) {
+    io_worker_pool_ = io_worker_pool;
+  }
+
+  const Stats& GetStats() const { return stats_; }
+
  private:
+  // Settings saved but not durable yet.
+  struct PendingSave {
+    // The most recently saved value.
+    std::string settings;
+    // Callbacks to run once |settings| have been written.
+    std::vector<weave::DoneCallback> callbacks;
+    // True if |settings| changed since the last write was started.
+    bool dirty{false};
+    bool write_scheduled{false};
+    bool write_in_flight{false};
+  };
+
+  // Decrypted contents of a settings file.
+  struct CachedSettings {
+    // Wiped when the entry is replaced or released.
+    brillo::SecureBlob plaintext;
+    // The snapshot and journal file contents |plaintext| was decrypted from
+    // or encrypted to.
+    std::string snapshot;
+    std::string journal;
+  };
+
+  // What is on disk for one settings name, as last written by
+  // WriteSettings(). Only accessed on the settings sequence.
+  struct JournalState {
+    brillo::SecureBlob settings;
+    std::string snapshot;
+    // Empty until the first record is appended on top of |snapshot|.
+    std::string journal;
+  };
+
+  struct WriteResult {
+    std::string snapshot;
+    std::string journal;
+    bool journal_record_written{false};
+    size_t bytes_written{0};
+    weave::ErrorPtr error;
+  };
+
+  void ScheduleWrite(const std::string& name);
+  void StartWrite(const std::string& name);
+  // Encrypts |settings| and writes them to the files for |name|. Called on a
+  // worker thread if |io_worker_pool_| is set.
+  void WriteSettings(const std::string& name,
+                     const std::string& settings,
+                     WriteResult* result);
+  // Appends the changes since the last write to the journal of |name|.
+  // Returns false if the journal should be compacted into a new snapshot
+  // instead.
+  bool AppendToJournal(const std::string& name,
+                       const std::string& settings,
+                       WriteResult* result);
+  // Compresses |settings| if enabled, and encrypts them.
+  bool EncryptSettings(const std::string& settings, std::string* ciphertext);
+  // Reverses EncryptSettings().
+  bool DecryptSettings(const std::string& ciphertext, std::string* settings);
+  void OnSettingsWritten(const std::string& name,
+                         const std::vector<weave::DoneCallback>& callbacks,
+                         WriteResult* result);
+  void UpdateCache(const std::string& name,
+                   const std::string& plaintext,
+                   const std::string& snapshot,
+                   const std::string& journal);
+  void UpdateStats(const WriteResult& result);
+
   base::FilePath CreatePath(const std::string& name) const;
+  base::FilePath CreateJournalPath(const std::string& name) const;
   bool LoadFile(const base::FilePath& file_path,
                 std::string* data,
                 brillo::ErrorPtr* error);
@@ -96,8 +207,15 @@ class BuffetConfig final : public weave::provider::ConfigStore {
   std::unique_ptr<Encryptor> default_encryptor_;
   Encryptor* encryptor_{nullptr};
   std::unique_ptr<FileIO> default_file_io_;
+  std::unique_ptr<ContainerFileIO> container_file_io_;
   FileIO* file_io_{nullptr};
+  IoWorkerPool* io_worker_pool_{nullptr};
+  std::map<std::string, PendingSave> pending_saves_;
+  std::map<std::string, CachedSettings> cache_;
+  std::map<std::string, JournalState> journals_;
+  Stats stats_;
 
+  base::WeakPtrFactory<BuffetConfig> weak_ptr_factory_{this};
   DISALLOW_COPY_AND_ASSIGN(BuffetConfig);
 };
 
@@ -17,9 +17,13 @@
 #include <set>
 
 #include <base/bind.h>
+#include <brillo/bind_lambda.h>
 #include <brillo/data_encoding.h>
+#include <brillo/message_loops/fake_message_loop.h>
 #include <gtest/gtest.h>
 
+#include "buffet/container_file_io.h"
+
 namespace buffet {
 
 TEST(BuffetConfigTest, LoadConfig) {
@@ -82,12 +86,18 @@ class BuffetConfigTestWithFakes : public testing::Test,
                                   public Encryptor {
  public:
   void SetUp() {
+    CreateConfig(base::TimeDelta{});
+  };
+
+  void CreateConfig(base::TimeDelta write_delay) {
     BuffetConfig::Options config_options;
     config_options.settings = base::FilePath{"settings_file"};
+    config_options.settings_write_delay = write_delay;
+    config_options.compress_settings = compress_settings_;
     config_.reset(new BuffetConfig{config_options});
     config_->SetEncryptor(this);
     config_->SetFileIO(this);
-  };
+  }
 
   // buffet::Encryptor methods.
   bool EncryptWithAuthentication(const std::string& plaintext,
@@ -97,6 +107,7 @@ class BuffetConfigTestWithFakes : public testing::Test,
   };
   bool DecryptWithAuthentication(const std::string& ciphertext,
                                  std::string* plaintext) override {
+    decrypt_count_++;
     return encryptor_result_ &&
            brillo::data_encoding::Base64Decode(ciphertext, plaintext);
   };
@@ -111,16 +122,32 @@ class BuffetConfigTestWithFakes : public testing::Test,
   };
   bool WriteFile(const base::FilePath& path,
                  const std::string& content) override {
+    write_count_++;
     if (io_result_) {
       fake_file_content_[path.value()] = content;
     }
     return io_result_;
   };
+  bool AppendFile(const base::FilePath& path,
+                  const std::string& content) override {
+    append_count_++;
+    if (io_result_) {
+      fake_file_content_[path.value()] += content;
+    }
+    return io_result_;
+  };
+  bool PathExists(const base::FilePath& path) override {
+    return fake_file_content_.count(path.value()) > 0;
+  };
 
  protected:
   std::map<std::string, std::string> fake_file_content_;
   bool encryptor_result_ = true;
   bool io_result_ = true;
+  bool compress_settings_ = false;
+  int write_count_ = 0;
+  int append_count_ = 0;
+  int decrypt_count_ = 0;
   std::unique_ptr<BuffetConfig> config_;
 };
 
@@ -142,6 +169,8 @@ TEST_F(BuffetConfigTestWithFakes, EncryptionFailure) {
 TEST_F(BuffetConfigTestWithFakes, DecryptionFailure) {
   config_->SaveSettings("config", "test", {});
   ASSERT_FALSE(fake_file_content_["settings_file.config"].empty());
+  // Start with an empty settings cache, so the file has to be decrypted.
+  CreateConfig(base::TimeDelta{});
   encryptor_result_ = false;
   // Decryption fails -> empty settings loaded.
   ASSERT_TRUE(config_->LoadSettings("config").empty());
@@ -157,4 +186,190 @@ TEST_F(BuffetConfigTestWithFakes, SettingsIOFailure) {
   ASSERT_EQ(original, fake_file_content_["settings_file.config"]);
 }
 
+TEST_F(BuffetConfigTestWithFakes, CachesDecryptedSettings) {
+  config_->SaveSettings("config", "test", {});
+  decrypt_count_ = 0;
+  EXPECT_EQ("test", config_->LoadSettings("config"));
+  EXPECT_EQ("test", config_->LoadSettings("config"));
+  EXPECT_EQ(0, decrypt_count_);
+
+  // The file changed on disk.
+  std::string ciphertext;
+  ASSERT_TRUE(EncryptWithAuthentication("external", &ciphertext));
+  fake_file_content_["settings_file.config"] = ciphertext;
+  EXPECT_EQ("external", config_->LoadSettings("config"));
+  EXPECT_EQ(1, decrypt_count_);
+  EXPECT_EQ("external", config_->LoadSettings("config"));
+  EXPECT_EQ(1, decrypt_count_);
+}
+
+TEST_F(BuffetConfigTestWithFakes, CoalescesSaves) {
+  brillo::FakeMessageLoop loop{nullptr};
+  loop.SetAsCurrent();
+  CreateConfig(base::TimeDelta::FromSeconds(1));
+
+  int done_count = 0;
+  auto done = base::Bind([&done_count](weave::ErrorPtr error) {
+    EXPECT_FALSE(error);
+    done_count++;
+  });
+  config_->SaveSettings("config", "test1", done);
+  config_->SaveSettings("config", "test2", done);
+  config_->SaveSettings("config", "test3", done);
+  EXPECT_EQ(0, write_count_);
+  EXPECT_EQ(0, done_count);
+  // Unwritten settings are still visible.
+  EXPECT_EQ("test3", config_->LoadSettings("config"));
+
+  loop.Run();
+  EXPECT_EQ(1, write_count_);
+  EXPECT_EQ(3, done_count);
+  EXPECT_EQ(3u, config_->GetStats().saves_requested);
+  EXPECT_EQ(1u, config_->GetStats().saves_written);
+  EXPECT_EQ("test3", config_->LoadSettings("config"));
+
+  // Settings saved but not written yet are flushed on destruction.
+  config_->SaveSettings("config", "test4", {});
+  config_.reset();
+  EXPECT_EQ(2, write_count_);
+  std::string content;
+  ASSERT_TRUE(DecryptWithAuthentication(
+      fake_file_content_["settings_file.config"], &content));
+  EXPECT_EQ("test4", content);
+}
+
+TEST_F(BuffetConfigTestWithFakes, JournalsSmallChanges) {
+  auto make_settings = [](const std::string& token) {
+    return R"({"last_configured_ssid":"ssid","refresh_token":")" + token +
+           R"(","robot_account":"robot@example.com","secret":")" +
+           std::string(200, 'x') + R"("})";
+  };
+  config_->SaveSettings("", make_settings("token0"), {});
+  uint64_t snapshot_bytes = config_->GetStats().bytes_written;
+  EXPECT_EQ(fake_file_content_["settings_file"].size(), snapshot_bytes);
+
+  // Changing a single field appends a record that is much smaller than the
+  // snapshot.
+  for (int i = 1; i <= 3; i++) {
+    uint64_t bytes_before = config_->GetStats().bytes_written;
+    config_->SaveSettings("", make_settings("token" + std::to_string(i)), {});
+    uint64_t bytes_per_save = config_->GetStats().bytes_written - bytes_before;
+    EXPECT_GT(snapshot_bytes / 2, bytes_per_save) << "save " << i;
+  }
+  // The snapshot and the first record replace files, the rest are appended.
+  EXPECT_EQ(2, write_count_);
+  EXPECT_EQ(2, append_count_);
+  EXPECT_EQ(3u, config_->GetStats().journal_records_written);
+
+  // Unchanged settings are not written at all.
+  uint64_t bytes_before = config_->GetStats().bytes_written;
+  config_->SaveSettings("", make_settings("token3"), {});
+  EXPECT_EQ(bytes_before, config_->GetStats().bytes_written);
+
+  // A fresh instance replays the journal on top of the snapshot.
+  CreateConfig(base::TimeDelta{});
+  EXPECT_EQ(make_settings("token3"), config_->LoadSettings());
+
+  // Replacing the snapshot makes the old journal stale.
+  config_->SaveSettings("", R"({"refresh_token":"new"})", {});
+  CreateConfig(base::TimeDelta{});
+  EXPECT_EQ(R"({"refresh_token":"new"})", config_->LoadSettings());
+}
+
+TEST_F(BuffetConfigTestWithFakes, IgnoresTornJournalRecord) {
+  const std::string padding(200, 'x');
+  config_->SaveSettings("", R"({"a":"0","b":")" + padding + R"("})", {});
+  config_->SaveSettings("", R"({"a":"1","b":")" + padding + R"("})", {});
+  config_->SaveSettings("", R"({"a":"2","b":")" + padding + R"("})", {});
+  EXPECT_EQ(2u, config_->GetStats().journal_records_written);
+  // Simulate a crash in the middle of the last append.
+  std::string& journal = fake_file_content_["settings_file.journal"];
+  journal.resize(journal.size() - 3);
+
+  CreateConfig(base::TimeDelta{});
+  EXPECT_EQ(R"({"a":"1","b":")" + padding + R"("})", config_->LoadSettings());
+}
+
+TEST_F(BuffetConfigTestWithFakes, SettingsContainer) {
+  ContainerFileIO container{base::FilePath{"settings_file.container"}, this};
+  config_->SetFileIO(&container);
+  config_->SaveSettings("", "test", {});
+  config_->SaveSettings("config", "test2", {});
+  EXPECT_EQ(1u, fake_file_content_.size());
+  EXPECT_EQ(1u, fake_file_content_.count("settings_file.container"));
+
+  ContainerFileIO reloaded{base::FilePath{"settings_file.container"}, this};
+  CreateConfig(base::TimeDelta{});
+  config_->SetFileIO(&reloaded);
+  EXPECT_EQ("test", config_->LoadSettings());
+  EXPECT_EQ("test2", config_->LoadSettings("config"));
+}
+
+TEST_F(BuffetConfigTestWithFakes, JournalsIntoSettingsContainer) {
+  ContainerFileIO container{base::FilePath{"settings_file.container"}, this};
+  config_->SetFileIO(&container);
+  const std::string padding(200, 'x');
+  for (int i = 0; i < 4; i++) {
+    config_->SaveSettings(
+        "", R"({"a":")" + std::to_string(i) + R"(","b":")" + padding + R"("})",
+        {});
+  }
+  EXPECT_EQ(3u, config_->GetStats().journal_records_written);
+  // The snapshot and the first record rewrite the container, the other
+  // records are appended to it.
+  EXPECT_EQ(2, write_count_);
+  EXPECT_EQ(2, append_count_);
+  EXPECT_EQ(1u, fake_file_content_.size());
+
+  ContainerFileIO reloaded{base::FilePath{"settings_file.container"}, this};
+  CreateConfig(base::TimeDelta{});
+  config_->SetFileIO(&reloaded);
+  EXPECT_EQ(R"({"a":"3","b":")" + padding + R"("})", config_->LoadSettings());
+}
+
+TEST_F(BuffetConfigTestWithFakes, CompressesSettings) {
+  std::string settings = R"({"robot_account":")" + std::string(500, 'a') +
+                         R"(@clouddevices.gserviceaccount.com"})";
+  config_->SaveSettings("config", settings, {});
+  size_t uncompressed_size = fake_file_content_["settings_file.config"].size();
+
+  compress_settings_ = true;
+  CreateConfig(base::TimeDelta{});
+  config_->SaveSettings("config", settings, {});
+  EXPECT_GT(uncompressed_size,
+            fake_file_content_["settings_file.config"].size());
+
+  // Compressed settings load with compression turned off again.
+  compress_settings_ = false;
+  CreateConfig(base::TimeDelta{});
+  EXPECT_EQ(settings, config_->LoadSettings("config"));
+
+  // Settings that do not shrink are stored as they are.
+  compress_settings_ = true;
+  CreateConfig(base::TimeDelta{});
+  config_->SaveSettings("config", "test", {});
+  EXPECT_EQ(brillo::data_encoding::Base64Encode("test"),
+            fake_file_content_["settings_file.config"]);
+}
+
+TEST_F(BuffetConfigTestWithFakes, RejectsOversizedSettings) {
+  config_->SaveSettings("config", "test", {});
+  std::string original = fake_file_content_["settings_file.config"];
+
+  // Compressed, these would fit, but they could never be loaded again.
+  brillo::FakeMessageLoop loop{nullptr};
+  loop.SetAsCurrent();
+  compress_settings_ = true;
+  CreateConfig(base::TimeDelta::FromSeconds(1));
+  bool failed = false;
+  config_->SaveSettings("config", std::string(1024 * 1024 + 1, 'a'),
+                        base::Bind([&failed](weave::ErrorPtr error) {
+                          failed = !!error;
+                        }));
+  loop.Run();
+  EXPECT_TRUE(failed);
+  EXPECT_EQ(original, fake_file_content_["settings_file.config"]);
+  EXPECT_EQ("test", config_->LoadSettings("config"));
+}
+
 }  // namespace buffet
@@ -0,0 +1,96 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "buffet/compression.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+
+#include <base/logging.h>
+
+namespace buffet {
+namespace compression {
+
+namespace {
+
+const size_t kChunkSize = 16 * 1024;
+
+int GetWindowBits(Format format) {
+  const int kMaxWindowBits = 15;
+  // zlib selects the gzip wrapper when 16 is added to the window bits.
+  return format == Format::kGzip ? kMaxWindowBits + 16 : kMaxWindowBits;
+}
+
+Bytef* AsBytes(const std::string& str) {
+  return reinterpret_cast<Bytef*>(const_cast<char*>(str.data()));
+}
+
+}  // namespace
+
+bool Compress(const std::string& input, Format format, std::string* output) {
+  z_stream stream = {};
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                   GetWindowBits(format), 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    LOG(ERROR) << "Failed to initialize deflate.";
+    return false;
+  }
+  output->resize(deflateBound(&stream, input.size()));
+  stream.next_in = AsBytes(input);
+  stream.avail_in = input.size();
+  stream.next_out = AsBytes(*output);
+  stream.avail_out = output->size();
+  int result = deflate(&stream, Z_FINISH);
+  deflateEnd(&stream);
+  if (result != Z_STREAM_END) {
+    output->clear();
+    return false;
+  }
+  output->resize(stream.total_out);
+  return true;
+}
+
+bool Decompress(const std::string& input,
+                Format format,
+                size_t max_output_size,
+                std::string* output) {
+  z_stream stream = {};
+  if (inflateInit2(&stream, GetWindowBits(format)) != Z_OK) {
+    LOG(ERROR) << "Failed to initialize inflate.";
+    return false;
+  }
+  stream.next_in = AsBytes(input);
+  stream.avail_in = input.size();
+  output->clear();
+  int result = Z_OK;
+  // Room for one byte more than allowed detects streams that are too large.
+  while (result == Z_OK && output->size() <= max_output_size) {
+    size_t size = output->size();
+    output->resize(std::min(size + kChunkSize, max_output_size + 1));
+    stream.next_out = AsBytes(*output) + size;
+    stream.avail_out = output->size() - size;
+    result = inflate(&stream, Z_NO_FLUSH);
+    output->resize(output->size() - stream.avail_out);
+  }
+  inflateEnd(&stream);
+  // Trailing data after the end of the stream is treated as corruption.
+  if (result != Z_STREAM_END || stream.avail_in != 0 ||
+      output->size() > max_output_size) {
+    output->clear();
+    return false;
+  }
+  return true;
+}
+
+}  // namespace compression
+}  // namespace buffet
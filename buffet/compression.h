@@ -0,0 +1,42 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef BUFFET_COMPRESSION_H_
+#define BUFFET_COMPRESSION_H_
+
+#include <string>
+
+namespace buffet {
+namespace compression {
+
+enum class Format {
+  // zlib stream (RFC 1950), used for data stored by weaved.
+  kZlib,
+  // gzip stream (RFC 1952), used for HTTP content encoding.
+  kGzip,
+};
+
+// Deflates |input| into |output|.
+bool Compress(const std::string& input, Format format, std::string* output);
+
+// Inflates |input| into |output|. Fails if |input| is not a complete stream of
+// |format| or inflates to more than |max_output_size| bytes.
+bool Decompress(const std::string& input,
+                Format format,
+                size_t max_output_size,
+                std::string* output);
+
+}  // namespace compression
+}  // namespace buffet
+
+#endif  // BUFFET_COMPRESSION_H_
@@ -0,0 +1,65 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "buffet/compression.h"
+
+#include <gtest/gtest.h>
+
+namespace buffet {
+
+TEST(CompressionTest, RoundTrip) {
+  const std::string input = "{\"key\":\"" + std::string(1000, 'v') + "\"}";
+  for (auto format : {compression::Format::kZlib, compression::Format::kGzip}) {
+    std::string compressed;
+    ASSERT_TRUE(compression::Compress(input, format, &compressed));
+    EXPECT_GT(input.size(), compressed.size());
+    std::string output;
+    ASSERT_TRUE(
+        compression::Decompress(compressed, format, input.size(), &output));
+    EXPECT_EQ(input, output);
+  }
+}
+
+TEST(CompressionTest, EmptyInput) {
+  std::string compressed;
+  ASSERT_TRUE(
+      compression::Compress("", compression::Format::kZlib, &compressed));
+  std::string output = "old";
+  ASSERT_TRUE(compression::Decompress(compressed, compression::Format::kZlib,
+                                      100, &output));
+  EXPECT_TRUE(output.empty());
+}
+
+TEST(CompressionTest, DecompressFailures) {
+  const std::string input(1000, 'x');
+  std::string compressed;
+  ASSERT_TRUE(
+      compression::Compress(input, compression::Format::kGzip, &compressed));
+  std::string output;
+  // Wrong format.
+  EXPECT_FALSE(compression::Decompress(compressed, compression::Format::kZlib,
+                                       input.size(), &output));
+  // Too large.
+  EXPECT_FALSE(compression::Decompress(compressed, compression::Format::kGzip,
+                                       input.size() - 1, &output));
+  // Truncated.
+  EXPECT_FALSE(compression::Decompress(compressed.substr(0, 10),
+                                       compression::Format::kGzip,
+                                       input.size(), &output));
+  // Trailing garbage.
+  EXPECT_FALSE(compression::Decompress(compressed + "x",
+                                       compression::Format::kGzip,
+                                       input.size(), &output));
+}
+
+}  // namespace buffet
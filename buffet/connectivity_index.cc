@@ -0,0 +1,103 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "buffet/connectivity_index.h"
+
+#include <base/logging.h>
+
+namespace buffet {
+
+void ConnectivityIndex::AddDevice(const dbus::ObjectPath& device_path) {
+  if (!devices_.emplace(device_path, Device{}).second)
+    return;
+  state_counts_[State::kOffline]++;
+}
+
+void ConnectivityIndex::RemoveDevice(const dbus::ObjectPath& device_path) {
+  auto it = devices_.find(device_path);
+  if (it == devices_.end())
+    return;
+  Unselect(device_path, &it->second);
+  // Unselect() left the device offline.
+  if (--state_counts_[State::kOffline] == 0)
+    state_counts_.erase(State::kOffline);
+  devices_.erase(it);
+}
+
+void ConnectivityIndex::Clear() {
+  devices_.clear();
+  service_devices_.clear();
+  state_counts_.clear();
+}
+
+void ConnectivityIndex::SelectService(const dbus::ObjectPath& device_path,
+                                      const dbus::ObjectPath& service_path) {
+  auto it = devices_.find(device_path);
+  CHECK(it != devices_.end()) << "Unknown device " << device_path.value();
+  Unselect(device_path, &it->second);
+  if (!service_path.IsValid() || service_path.value() == "/")
+    return;
+  it->second.service_path = service_path;
+  service_devices_[service_path].insert(device_path);
+}
+
+const dbus::ObjectPath* ConnectivityIndex::FindDevice(
+    const dbus::ObjectPath& service_path) const {
+  auto it = service_devices_.find(service_path);
+  return it == service_devices_.end() ? nullptr : &*it->second.begin();
+}
+
+void ConnectivityIndex::SetDeviceState(const dbus::ObjectPath& device_path,
+                                       State state) {
+  auto it = devices_.find(device_path);
+  if (it != devices_.end())
+    SetState(&it->second, state);
+}
+
+bool ConnectivityIndex::SetServiceState(const dbus::ObjectPath& service_path,
+                                        State state) {
+  auto it = service_devices_.find(service_path);
+  if (it == service_devices_.end())
+    return false;
+  for (const dbus::ObjectPath& device_path : it->second)
+    SetState(&devices_[device_path], state);
+  return true;
+}
+
+ConnectivityIndex::State ConnectivityIndex::GetConnectivityState() const {
+  return state_counts_.empty() ? State::kOffline
+                               : state_counts_.rbegin()->first;
+}
+
+void ConnectivityIndex::SetState(Device* device, State state) {
+  if (device->state == state)
+    return;
+  if (--state_counts_[device->state] == 0)
+    state_counts_.erase(device->state);
+  state_counts_[state]++;
+  device->state = state;
+}
+
+void ConnectivityIndex::Unselect(const dbus::ObjectPath& device_path,
+                                 Device* device) {
+  SetState(device, State::kOffline);
+  if (device->service_path.value().empty())
+    return;
+  auto it = service_devices_.find(device->service_path);
+  it->second.erase(device_path);
+  if (it->second.empty())
+    service_devices_.erase(it);
+  device->service_path = dbus::ObjectPath{};
+}
+
+}  // namespace buffet
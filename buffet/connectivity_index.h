@@ -0,0 +1,78 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef BUFFET_CONNECTIVITY_INDEX_H_
+#define BUFFET_CONNECTIVITY_INDEX_H_
+
+#include <map>
+#include <set>
+
+#include <base/macros.h>
+#include <dbus/object_path.h>
+#include <weave/provider/network.h>
+
+namespace buffet {
+
+// Tracks the service each network device selected and the connection state of
+// that service. Finding the devices of a service and the overall connectivity
+// state do not scan all devices, which matters on gateways with hundreds of
+// virtual interfaces.
+class ConnectivityIndex final {
+ public:
+  using State = weave::provider::Network::State;
+
+  ConnectivityIndex() = default;
+
+  // Adds a device without a selected service.
+  void AddDevice(const dbus::ObjectPath& device_path);
+  void RemoveDevice(const dbus::ObjectPath& device_path);
+  void Clear();
+
+  // Makes |service_path| the selected service of a device. Its state starts
+  // as offline. An invalid or "/" |service_path| means no service.
+  void SelectService(const dbus::ObjectPath& device_path,
+                     const dbus::ObjectPath& service_path);
+
+  // Returns a device that selected |service_path|, or nullptr.
+  const dbus::ObjectPath* FindDevice(
+      const dbus::ObjectPath& service_path) const;
+
+  // Sets the state of the service selected by a device.
+  void SetDeviceState(const dbus::ObjectPath& device_path, State state);
+  // Sets the state of |service_path| for all devices that selected it.
+  // Returns false if no device selected it.
+  bool SetServiceState(const dbus::ObjectPath& service_path, State state);
+
+  // Returns the state of the most connected selected service.
+  State GetConnectivityState() const;
+
+ private:
+  struct Device {
+    dbus::ObjectPath service_path;
+    State state{State::kOffline};
+  };
+
+  void SetState(Device* device, State state);
+  void Unselect(const dbus::ObjectPath& device_path, Device* device);
+
+  std::map<dbus::ObjectPath, Device> devices_;
+  std::map<dbus::ObjectPath, std::set<dbus::ObjectPath>> service_devices_;
+  // Number of devices in each state. States without devices are removed.
+  std::map<State, size_t> state_counts_;
+
+  DISALLOW_COPY_AND_ASSIGN(ConnectivityIndex);
+};
+
+}  // namespace buffet
+
+#endif  // BUFFET_CONNECTIVITY_INDEX_H_
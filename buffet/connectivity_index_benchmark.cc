@@ -0,0 +1,97 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "buffet/connectivity_index.h"
+
+namespace buffet {
+
+namespace {
+
+using State = ConnectivityIndex::State;
+
+// Gateways with containers and VLANs can have hundreds of interfaces.
+const int kDeviceCount = 500;
+
+dbus::ObjectPath DevicePath(int i) {
+  return dbus::ObjectPath{"/device/" + std::to_string(i)};
+}
+
+dbus::ObjectPath ServicePath(int i) {
+  return dbus::ObjectPath{"/service/" + std::to_string(i)};
+}
+
+State NextState(int i) {
+  return i % 2 ? State::kOnline : State::kConnecting;
+}
+
+}  // namespace
+
+// A service state change signal for a random device.
+void BM_ConnectivityIndexStateChange(benchmark::State& state) {
+  ConnectivityIndex index;
+  for (int i = 0; i < kDeviceCount; i++) {
+    index.AddDevice(DevicePath(i));
+    index.SelectService(DevicePath(i), ServicePath(i));
+  }
+  std::vector<dbus::ObjectPath> services;
+  for (int i = 0; i < kDeviceCount; i++)
+    services.push_back(ServicePath((i * 7919) % kDeviceCount));
+
+  int i = 0;
+  while (state.KeepRunning()) {
+    index.SetServiceState(services[i % kDeviceCount], NextState(i));
+    benchmark::DoNotOptimize(index.GetConnectivityState());
+    i++;
+  }
+}
+BENCHMARK(BM_ConnectivityIndexStateChange);
+
+// The same with the scans ShillClient used to do, for comparison.
+void BM_LinearScanStateChange(benchmark::State& state) {
+  struct Device {
+    dbus::ObjectPath path;
+    dbus::ObjectPath service_path;
+    State state;
+  };
+  std::vector<Device> devices;
+  for (int i = 0; i < kDeviceCount; i++)
+    devices.push_back({DevicePath(i), ServicePath(i), State::kOffline});
+  std::vector<dbus::ObjectPath> services;
+  for (int i = 0; i < kDeviceCount; i++)
+    services.push_back(ServicePath((i * 7919) % kDeviceCount));
+
+  int i = 0;
+  while (state.KeepRunning()) {
+    for (Device& device : devices) {
+      if (device.service_path == services[i % kDeviceCount]) {
+        device.state = NextState(i);
+        break;
+      }
+    }
+    State connectivity = State::kOffline;
+    for (const Device& device : devices) {
+      if (device.state > connectivity)
+        connectivity = device.state;
+    }
+    benchmark::DoNotOptimize(connectivity);
+    i++;
+  }
+}
+BENCHMARK(BM_LinearScanStateChange);
+
+}  // namespace buffet
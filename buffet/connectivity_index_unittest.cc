@@ -0,0 +1,76 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "buffet/connectivity_index.h"
+
+#include <gtest/gtest.h>
+
+namespace buffet {
+
+using State = ConnectivityIndex::State;
+
+class ConnectivityIndexTest : public ::testing::Test {
+ protected:
+  const dbus::ObjectPath eth0_{"/device/eth0"};
+  const dbus::ObjectPath wlan0_{"/device/wlan0"};
+  const dbus::ObjectPath ethernet_{"/service/1"};
+  const dbus::ObjectPath wifi_{"/service/2"};
+  ConnectivityIndex index_;
+};
+
+TEST_F(ConnectivityIndexTest, AggregatesMostConnectedState) {
+  EXPECT_EQ(State::kOffline, index_.GetConnectivityState());
+  index_.AddDevice(eth0_);
+  index_.AddDevice(wlan0_);
+  index_.SelectService(eth0_, ethernet_);
+  index_.SelectService(wlan0_, wifi_);
+  EXPECT_EQ(eth0_, *index_.FindDevice(ethernet_));
+  EXPECT_EQ(wlan0_, *index_.FindDevice(wifi_));
+
+  EXPECT_TRUE(index_.SetServiceState(wifi_, State::kConnecting));
+  EXPECT_EQ(State::kConnecting, index_.GetConnectivityState());
+  EXPECT_TRUE(index_.SetServiceState(ethernet_, State::kOnline));
+  EXPECT_EQ(State::kOnline, index_.GetConnectivityState());
+  EXPECT_FALSE(index_.SetServiceState(dbus::ObjectPath{"/service/3"},
+                                      State::kOnline));
+
+  // Selecting another service resets the state of the device.
+  index_.SelectService(eth0_, dbus::ObjectPath{"/"});
+  EXPECT_EQ(nullptr, index_.FindDevice(ethernet_));
+  EXPECT_EQ(State::kConnecting, index_.GetConnectivityState());
+
+  index_.RemoveDevice(wlan0_);
+  EXPECT_EQ(nullptr, index_.FindDevice(wifi_));
+  EXPECT_EQ(State::kOffline, index_.GetConnectivityState());
+}
+
+TEST_F(ConnectivityIndexTest, SharedService) {
+  index_.AddDevice(eth0_);
+  index_.AddDevice(wlan0_);
+  index_.SelectService(eth0_, wifi_);
+  index_.SelectService(wlan0_, wifi_);
+  EXPECT_TRUE(index_.SetServiceState(wifi_, State::kOnline));
+  EXPECT_EQ(State::kOnline, index_.GetConnectivityState());
+
+  index_.RemoveDevice(eth0_);
+  EXPECT_EQ(wlan0_, *index_.FindDevice(wifi_));
+  EXPECT_EQ(State::kOnline, index_.GetConnectivityState());
+  index_.SetDeviceState(wlan0_, State::kError);
+  EXPECT_EQ(State::kError, index_.GetConnectivityState());
+
+  index_.Clear();
+  EXPECT_EQ(nullptr, index_.FindDevice(wifi_));
+  EXPECT_EQ(State::kOffline, index_.GetConnectivityState());
+}
+
+}  // namespace buffet
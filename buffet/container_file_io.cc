@@ -0,0 +1,249 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "buffet/container_file_io.h"
+
+#include <utility>
+#include <vector>
+
+#include <base/logging.h>
+
+namespace buffet {
+
+namespace {
+
+const char kMagic[] = "WVC\x01";
+const size_t kMagicSize = sizeof(kMagic) - 1;
+
+void AppendUint32(uint32_t value, std::string* out) {
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out->push_back(static_cast<char>((value >> shift) & 0xff));
+}
+
+bool ReadUint32(const std::string& in, size_t* pos, uint32_t* value) {
+  if (in.size() - *pos < 4)
+    return false;
+  *value = 0;
+  for (size_t i = 0; i < 4; i++)
+    *value = (*value << 8) | static_cast<uint8_t>(in[(*pos)++]);
+  return true;
+}
+
+void AppendEntry(const std::string& name,
+                 const std::string& content,
+                 std::string* out) {
+  AppendUint32(name.size(), out);
+  out->append(name);
+  AppendUint32(content.size(), out);
+  out->append(content);
+}
+
+std::string Serialize(const std::map<std::string, std::string>& files) {
+  std::string container(kMagic, kMagicSize);
+  AppendUint32(files.size(), &container);
+  size_t data_size = 0;
+  for (const auto& pair : files) {
+    AppendUint32(pair.first.size(), &container);
+    container.append(pair.first);
+    AppendUint32(pair.second.size(), &container);
+    data_size += pair.second.size();
+  }
+  container.reserve(container.size() + data_size);
+  for (const auto& pair : files)
+    container.append(pair.second);
+  return container;
+}
+
+// Parses |container| into |files|. Append records after the file contents are
+// applied in order. |torn| is set if the last one was cut short by an
+// interrupted append, in which case it is dropped.
+bool Parse(const std::string& container,
+           std::map<std::string, std::string>* files,
+           bool* torn) {
+  files->clear();
+  *torn = false;
+  if (container.compare(0, kMagicSize, kMagic) != 0)
+    return false;
+  size_t pos = kMagicSize;
+  uint32_t count = 0;
+  if (!ReadUint32(container, &pos, &count))
+    return false;
+
+  // Read the index first; file contents follow it in the same order.
+  std::vector<std::pair<std::string, uint32_t>> index;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t name_size = 0;
+    uint32_t size = 0;
+    if (!ReadUint32(container, &pos, &name_size) ||
+        container.size() - pos < name_size) {
+      return false;
+    }
+    std::string name = container.substr(pos, name_size);
+    pos += name_size;
+    if (!ReadUint32(container, &pos, &size))
+      return false;
+    index.emplace_back(name, size);
+  }
+  for (const auto& entry : index) {
+    if (container.size() - pos < entry.second)
+      return false;
+    (*files)[entry.first] = container.substr(pos, entry.second);
+    pos += entry.second;
+  }
+
+  while (pos < container.size()) {
+    uint32_t name_size = 0;
+    uint32_t size = 0;
+    if (!ReadUint32(container, &pos, &name_size) ||
+        container.size() - pos < name_size) {
+      *torn = true;
+      return true;
+    }
+    std::string name = container.substr(pos, name_size);
+    pos += name_size;
+    if (!ReadUint32(container, &pos, &size) || container.size() - pos < size) {
+      *torn = true;
+      return true;
+    }
+    (*files)[name].append(container, pos, size);
+    pos += size;
+  }
+  return true;
+}
+
+}  // namespace
+
+ContainerFileIO::ContainerFileIO(const base::FilePath& container_path,
+                                 BuffetConfig::FileIO* file_io)
+    : container_path_{container_path}, file_io_{file_io} {}
+
+bool ContainerFileIO::ReadFile(const base::FilePath& path,
+                               std::string* content) {
+  {
+    base::AutoLock auto_lock(lock_);
+    if (!Load())
+      return false;
+    // The per-name files are older than any container, so falling back to
+    // them would silently roll settings back.
+    if (corrupt_)
+      return false;
+    auto it = files_.find(path.value());
+    if (it != files_.end()) {
+      *content = it->second;
+      return true;
+    }
+  }
+  return file_io_->ReadFile(path, content);
+}
+
+bool ContainerFileIO::WriteFile(const base::FilePath& path,
+                                const std::string& content) {
+  base::AutoLock auto_lock(lock_);
+  if (!Load())
+    return false;
+  files_[path.value()] = content;
+  return Store();
+}
+
+bool ContainerFileIO::AppendFile(const base::FilePath& path,
+                                 const std::string& content) {
+  base::AutoLock auto_lock(lock_);
+  if (!Load())
+    return false;
+  files_[path.value()] += content;
+  if (batch_depth_ > 0 || needs_rewrite_ || corrupt_)
+    return Store();
+  std::string record;
+  AppendEntry(path.value(), content, &record);
+  if (file_io_->AppendFile(container_path_, record))
+    return true;
+  // Part of the record may have made it to disk.
+  Unload();
+  return false;
+}
+
+void ContainerFileIO::BeginBatch() {
+  base::AutoLock auto_lock(lock_);
+  batch_depth_++;
+}
+
+bool ContainerFileIO::CommitBatch() {
+  base::AutoLock auto_lock(lock_);
+  CHECK_GT(batch_depth_, 0);
+  batch_depth_--;
+  if (batch_depth_ > 0 || !batch_dirty_)
+    return true;
+  batch_dirty_ = false;
+  return Store();
+}
+
+bool ContainerFileIO::PathExists(const base::FilePath& path) {
+  {
+    base::AutoLock auto_lock(lock_);
+    if (loaded_ && files_.count(path.value()) > 0)
+      return true;
+  }
+  return file_io_->PathExists(path);
+}
+
+bool ContainerFileIO::Load() {
+  lock_.AssertAcquired();
+  if (loaded_)
+    return true;
+  std::string container;
+  if (!file_io_->ReadFile(container_path_, &container)) {
+    // Writing a container without the files of the one that could not be
+    // read would lose them.
+    if (file_io_->PathExists(container_path_)) {
+      LOG(ERROR) << "Failed to read settings container "
+                 << container_path_.value();
+      return false;
+    }
+    loaded_ = true;  // No container yet.
+    return true;
+  }
+  loaded_ = true;
+  if (!Parse(container, &files_, &needs_rewrite_)) {
+    LOG(ERROR) << "Corrupt settings container " << container_path_.value()
+               << ", no settings can be read until it is replaced";
+    files_.clear();
+    corrupt_ = true;
+  }
+  return true;
+}
+
+bool ContainerFileIO::Store() {
+  lock_.AssertAcquired();
+  if (batch_depth_ > 0) {
+    batch_dirty_ = true;
+    return true;
+  }
+  if (file_io_->WriteFile(container_path_, Serialize(files_))) {
+    corrupt_ = false;
+    needs_rewrite_ = false;
+    return true;
+  }
+  // Forget writes that did not make it to disk.
+  Unload();
+  return false;
+}
+
+void ContainerFileIO::Unload() {
+  lock_.AssertAcquired();
+  loaded_ = false;
+  corrupt_ = false;
+  needs_rewrite_ = false;
+  files_.clear();
+}
+
+}  // namespace buffet
@@ -0,0 +1,86 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef BUFFET_CONTAINER_FILE_IO_H_
+#define BUFFET_CONTAINER_FILE_IO_H_
+
+#include <map>
+#include <string>
+
+#include <base/files/file_path.h>
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+
+#include "buffet/buffet_config.h"
+
+namespace buffet {
+
+// A FileIO that keeps all files in a single container file, which starts with
+// an index of the files it holds. Loading a file costs one read of the
+// container the first time and a lookup after that. Writes rewrite the
+// container atomically. Appends, such as settings journal records, are added
+// as records at the end of the container, and folded into it by the next
+// write. Files missing from a valid container are read from their own paths,
+// which migrates settings written without a container on their next save. If
+// the container is corrupt, all reads fail until a write replaces it. If it
+// exists but cannot be read, reads and writes fail until it can.
+// This class is thread-safe.
+class ContainerFileIO : public BuffetConfig::FileIO {
+ public:
+  // Stores the container at |container_path| using |file_io|. The caller
+  // retains ownership of |file_io|, which must outlive this object.
+  ContainerFileIO(const base::FilePath& container_path,
+                  BuffetConfig::FileIO* file_io);
+
+  bool ReadFile(const base::FilePath& path, std::string* content) override;
+  bool WriteFile(const base::FilePath& path,
+                 const std::string& content) override;
+  bool AppendFile(const base::FilePath& path,
+                  const std::string& content) override;
+  bool PathExists(const base::FilePath& path) override;
+
+  // Writes between BeginBatch() and CommitBatch() are visible to ReadFile()
+  // right away, but only stored by CommitBatch(), in one atomic write. Calls
+  // may be nested.
+  void BeginBatch();
+  bool CommitBatch();
+
+ private:
+  // Reads the container on first use. Returns false if it exists but could
+  // not be read.
+  bool Load();
+  // Writes the container unless a batch is open.
+  bool Store();
+  // Forgets everything, so that the container is read again on next use.
+  void Unload();
+
+  const base::FilePath container_path_;
+  BuffetConfig::FileIO* const file_io_;
+
+  base::Lock lock_;
+  bool loaded_{false};
+  // The container exists but could not be parsed.
+  bool corrupt_{false};
+  // The container ends with a torn append record, so the next append has to
+  // rewrite it instead.
+  bool needs_rewrite_{false};
+  std::map<std::string, std::string> files_;
+  int batch_depth_{0};
+  bool batch_dirty_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(ContainerFileIO);
+};
+
+}  // namespace buffet
+
+#endif  // BUFFET_CONTAINER_FILE_IO_H_
@@ -0,0 +1,220 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "buffet/container_file_io.h"
+
+#include <map>
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace buffet {
+
+class ContainerFileIOTest : public testing::Test,
+                            public BuffetConfig::FileIO {
+ public:
+  // buffet::BuffetConfig::FileIO methods.
+  bool ReadFile(const base::FilePath& path, std::string* content) override {
+    read_count_++;
+    if (!read_result_ || files_.count(path.value()) == 0)
+      return false;
+    *content = files_[path.value()];
+    return true;
+  }
+  bool WriteFile(const base::FilePath& path,
+                 const std::string& content) override {
+    write_count_++;
+    if (!io_result_)
+      return false;
+    files_[path.value()] = content;
+    return true;
+  }
+  bool AppendFile(const base::FilePath& path,
+                  const std::string& content) override {
+    append_count_++;
+    if (!io_result_)
+      return false;
+    files_[path.value()] += content;
+    return true;
+  }
+  bool PathExists(const base::FilePath& path) override {
+    return files_.count(path.value()) > 0;
+  }
+
+ protected:
+  const base::FilePath container_path_{"settings.container"};
+  std::map<std::string, std::string> files_;
+  bool io_result_ = true;
+  bool read_result_ = true;
+  int read_count_ = 0;
+  int write_count_ = 0;
+  int append_count_ = 0;
+};
+
+TEST_F(ContainerFileIOTest, ReadAndWrite) {
+  {
+    ContainerFileIO container{container_path_, this};
+    std::string content;
+    EXPECT_FALSE(container.ReadFile(base::FilePath{"a"}, &content));
+    EXPECT_TRUE(container.WriteFile(base::FilePath{"a"}, "data a"));
+    EXPECT_TRUE(container.WriteFile(base::FilePath{"b"}, ""));
+    EXPECT_TRUE(container.AppendFile(base::FilePath{"b"}, "data "));
+    EXPECT_TRUE(container.AppendFile(base::FilePath{"b"}, "b"));
+  }
+  EXPECT_EQ(1u, files_.size());
+  EXPECT_EQ(1u, files_.count(container_path_.value()));
+
+  // All files are loaded with a single read.
+  read_count_ = 0;
+  ContainerFileIO container{container_path_, this};
+  std::string content;
+  EXPECT_TRUE(container.ReadFile(base::FilePath{"a"}, &content));
+  EXPECT_EQ("data a", content);
+  EXPECT_TRUE(container.ReadFile(base::FilePath{"b"}, &content));
+  EXPECT_EQ("data b", content);
+  EXPECT_EQ(1, read_count_);
+}
+
+TEST_F(ContainerFileIOTest, Batch) {
+  ContainerFileIO container{container_path_, this};
+  container.BeginBatch();
+  EXPECT_TRUE(container.WriteFile(base::FilePath{"a"}, "1"));
+  container.BeginBatch();
+  EXPECT_TRUE(container.WriteFile(base::FilePath{"b"}, "2"));
+  EXPECT_TRUE(container.CommitBatch());
+  EXPECT_TRUE(container.WriteFile(base::FilePath{"c"}, "3"));
+  EXPECT_EQ(0, write_count_);
+  std::string content;
+  EXPECT_TRUE(container.ReadFile(base::FilePath{"b"}, &content));
+  EXPECT_EQ("2", content);
+
+  EXPECT_TRUE(container.CommitBatch());
+  EXPECT_EQ(1, write_count_);
+  ContainerFileIO reloaded{container_path_, this};
+  EXPECT_TRUE(reloaded.ReadFile(base::FilePath{"c"}, &content));
+  EXPECT_EQ("3", content);
+}
+
+TEST_F(ContainerFileIOTest, MigratesSeparateFiles) {
+  files_["a"] = "old a";
+  ContainerFileIO container{container_path_, this};
+  std::string content;
+  EXPECT_TRUE(container.ReadFile(base::FilePath{"a"}, &content));
+  EXPECT_EQ("old a", content);
+  EXPECT_TRUE(container.WriteFile(base::FilePath{"a"}, "new a"));
+  EXPECT_TRUE(container.ReadFile(base::FilePath{"a"}, &content));
+  EXPECT_EQ("new a", content);
+}
+
+TEST_F(ContainerFileIOTest, WriteFailure) {
+  ContainerFileIO container{container_path_, this};
+  EXPECT_TRUE(container.WriteFile(base::FilePath{"a"}, "1"));
+  io_result_ = false;
+  EXPECT_FALSE(container.WriteFile(base::FilePath{"a"}, "2"));
+  // The failed write is not visible.
+  std::string content;
+  EXPECT_TRUE(container.ReadFile(base::FilePath{"a"}, &content));
+  EXPECT_EQ("1", content);
+}
+
+TEST_F(ContainerFileIOTest, ReadFailure) {
+  {
+    ContainerFileIO container{container_path_, this};
+    EXPECT_TRUE(container.WriteFile(base::FilePath{"a"}, "1"));
+    EXPECT_TRUE(container.WriteFile(base::FilePath{"b"}, "2"));
+  }
+  std::string stored = files_[container_path_.value()];
+
+  // A container that exists but cannot be read is not replaced.
+  read_result_ = false;
+  ContainerFileIO container{container_path_, this};
+  std::string content;
+  EXPECT_FALSE(container.ReadFile(base::FilePath{"b"}, &content));
+  EXPECT_FALSE(container.WriteFile(base::FilePath{"a"}, "3"));
+  EXPECT_FALSE(container.AppendFile(base::FilePath{"a"}, "3"));
+  EXPECT_EQ(stored, files_[container_path_.value()]);
+
+  // The container is read again on next use.
+  read_result_ = true;
+  EXPECT_TRUE(container.WriteFile(base::FilePath{"a"}, "3"));
+  EXPECT_TRUE(container.ReadFile(base::FilePath{"b"}, &content));
+  EXPECT_EQ("2", content);
+}
+
+TEST_F(ContainerFileIOTest, AppendsInPlace) {
+  {
+    ContainerFileIO container{container_path_, this};
+    EXPECT_TRUE(container.WriteFile(base::FilePath{"a"}, "data a"));
+    EXPECT_TRUE(container.WriteFile(base::FilePath{"b"}, "data "));
+    EXPECT_TRUE(container.AppendFile(base::FilePath{"b"}, "b"));
+    EXPECT_TRUE(container.AppendFile(base::FilePath{"c"}, "data c"));
+  }
+  // Appends do not rewrite the container.
+  EXPECT_EQ(2, write_count_);
+  EXPECT_EQ(2, append_count_);
+
+  ContainerFileIO container{container_path_, this};
+  std::string content;
+  EXPECT_TRUE(container.ReadFile(base::FilePath{"b"}, &content));
+  EXPECT_EQ("data b", content);
+  EXPECT_TRUE(container.ReadFile(base::FilePath{"c"}, &content));
+  EXPECT_EQ("data c", content);
+
+  // The next write folds the append records into the container.
+  EXPECT_TRUE(container.WriteFile(base::FilePath{"a"}, "new a"));
+  ContainerFileIO reloaded{container_path_, this};
+  EXPECT_TRUE(reloaded.ReadFile(base::FilePath{"b"}, &content));
+  EXPECT_EQ("data b", content);
+}
+
+TEST_F(ContainerFileIOTest, DropsTornAppend) {
+  {
+    ContainerFileIO container{container_path_, this};
+    EXPECT_TRUE(container.WriteFile(base::FilePath{"a"}, "1"));
+    EXPECT_TRUE(container.AppendFile(base::FilePath{"a"}, "2"));
+    EXPECT_TRUE(container.AppendFile(base::FilePath{"a"}, "3"));
+  }
+  // Simulate a crash in the middle of the last append.
+  std::string& stored = files_[container_path_.value()];
+  stored.resize(stored.size() - 1);
+
+  ContainerFileIO container{container_path_, this};
+  std::string content;
+  EXPECT_TRUE(container.ReadFile(base::FilePath{"a"}, &content));
+  EXPECT_EQ("12", content);
+  // Appending after the torn record would make the container unreadable, so
+  // the next append rewrites it.
+  write_count_ = 0;
+  EXPECT_TRUE(container.AppendFile(base::FilePath{"a"}, "4"));
+  EXPECT_EQ(1, write_count_);
+  ContainerFileIO reloaded{container_path_, this};
+  EXPECT_TRUE(reloaded.ReadFile(base::FilePath{"a"}, &content));
+  EXPECT_EQ("124", content);
+}
+
+TEST_F(ContainerFileIOTest, CorruptContainer) {
+  files_[container_path_.value()] = "garbage";
+  // Older than any container, so it must not be read instead.
+  files_["a"] = "stale a";
+  ContainerFileIO container{container_path_, this};
+  std::string content;
+  EXPECT_FALSE(container.ReadFile(base::FilePath{"a"}, &content));
+  EXPECT_FALSE(container.ReadFile(base::FilePath{"b"}, &content));
+
+  // A write replaces the corrupt container.
+  EXPECT_TRUE(container.WriteFile(base::FilePath{"b"}, "new b"));
+  EXPECT_TRUE(container.ReadFile(base::FilePath{"b"}, &content));
+  EXPECT_EQ("new b", content);
+}
+
+}  // namespace buffet
@@ -16,26 +16,22 @@
 
 #include <memory>
 
-#include <brillo/data_encoding.h>
+#include <base/files/file_path.h>
+
+#include "buffet/software_encryptor.h"
 
 namespace buffet {
 
-class FakeEncryptor : public Encryptor {
- public:
-  bool EncryptWithAuthentication(const std::string& plaintext,
-                                 std::string* ciphertext) override {
-    *ciphertext = brillo::data_encoding::Base64Encode(plaintext);
-    return true;
-  }
-
-  bool DecryptWithAuthentication(const std::string& ciphertext,
-                                 std::string* plaintext) override {
-    return brillo::data_encoding::Base64Decode(ciphertext, plaintext);
-  }
-};
-
-std::unique_ptr<Encryptor> Encryptor::CreateDefaultEncryptor() {
-  return std::unique_ptr<Encryptor>{new FakeEncryptor};
+namespace {
+
+const char kKeyFileExtension[] = "key";
+
+}  // namespace
+
+std::unique_ptr<Encryptor> Encryptor::CreateDefaultEncryptor(
+    const base::FilePath& settings) {
+  return std::unique_ptr<Encryptor>{
+      new SoftwareEncryptor{settings.AddExtension(kKeyFileExtension)}};
 }
 
 }  // namespace buffet
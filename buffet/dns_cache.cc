@@ -0,0 +1,149 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/dns_cache.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+
+#include <base/bind.h>
+#include <base/logging.h>
+#include <base/message_loop/message_loop.h>
+#include <base/strings/stringprintf.h>
+
+#include "buffet/io_worker_pool.h"
+
+namespace buffet {
+
+ResolveResult ResolveHost(const std::string& host, uint16_t port) {
+  ResolveResult result;
+  std::string service = std::to_string(port);
+  addrinfo hints = {0, AF_UNSPEC, SOCK_STREAM};
+  addrinfo* addresses = nullptr;
+  int status = getaddrinfo(host.c_str(), service.c_str(), &hints, &addresses);
+  if (status != 0) {
+    LOG(WARNING) << "Failed to resolve host name " << host << ": "
+                 << gai_strerror(status);
+    result.error = status == EAI_SYSTEM ? errno : EHOSTUNREACH;
+    return result;
+  }
+
+  for (const addrinfo* info = addresses; info != nullptr;
+       info = info->ai_next) {
+    if (info->ai_addrlen > sizeof(sockaddr_storage))
+      continue;
+    SocketAddress address;
+    memcpy(&address.address, info->ai_addr, info->ai_addrlen);
+    address.length = info->ai_addrlen;
+    result.addresses.push_back(address);
+  }
+  freeaddrinfo(addresses);
+  if (result.addresses.empty())
+    result.error = EHOSTUNREACH;
+  return result;
+}
+
+std::string GetIPAddress(const SocketAddress& address) {
+  const sockaddr* sa = reinterpret_cast<const sockaddr*>(&address.address);
+  std::string addr;
+  char str[INET6_ADDRSTRLEN] = {};
+  switch (sa->sa_family) {
+    case AF_INET:
+      if (inet_ntop(AF_INET,
+                    &(reinterpret_cast<const sockaddr_in*>(sa)->sin_addr), str,
+                    sizeof(str))) {
+        addr = str;
+      }
+      break;
+
+    case AF_INET6:
+      if (inet_ntop(AF_INET6,
+                    &(reinterpret_cast<const sockaddr_in6*>(sa)->sin6_addr),
+                    str, sizeof(str))) {
+        addr = str;
+      }
+      break;
+  }
+  if (addr.empty())
+    addr = base::StringPrintf("<Unknown address family: %d>", sa->sa_family);
+  return addr;
+}
+
+DnsCache::DnsCache(IoWorkerPool* io_worker_pool, const Options& options)
+    : io_worker_pool_{io_worker_pool},
+      options_(options),
+      resolver_{base::Bind(&ResolveHost)} {}
+
+DnsCache::~DnsCache() = default;
+
+void DnsCache::Resolve(const std::string& host,
+                       uint16_t port,
+                       const ResolveCallback& callback) {
+  auto it = entries_.find(Key{host, port});
+  if (it != entries_.end()) {
+    if (it->second.expiration > base::TimeTicks::Now()) {
+      stats_.hits++;
+      if (it->second.result.addresses.empty())
+        stats_.negative_hits++;
+      base::MessageLoop::current()->PostTask(
+          FROM_HERE, base::Bind(callback, it->second.result));
+      return;
+    }
+    entries_.erase(it);
+  }
+
+  stats_.misses++;
+  PendingKey pending_key{host, port, generation_};
+  std::vector<ResolveCallback>& callbacks = pending_[pending_key];
+  callbacks.push_back(callback);
+  if (callbacks.size() > 1)
+    return;
+
+  io_worker_pool_->PostTaskAndReplyWithResult(
+      FROM_HERE, std::string{}, base::Bind(resolver_, host, port),
+      base::Bind(&DnsCache::OnResolved, weak_ptr_factory_.GetWeakPtr(),
+                 pending_key));
+}
+
+void DnsCache::Flush() {
+  stats_.flushes++;
+  entries_.clear();
+  generation_++;
+}
+
+void DnsCache::OnResolved(const PendingKey& pending_key,
+                          const ResolveResult& result) {
+  if (std::get<2>(pending_key) == generation_) {
+    Entry& entry =
+        entries_[Key{std::get<0>(pending_key), std::get<1>(pending_key)}];
+    entry.result = result;
+    entry.expiration =
+        base::TimeTicks::Now() + (result.addresses.empty()
+                                      ? options_.negative_ttl
+                                      : options_.positive_ttl);
+  }
+
+  auto it = pending_.find(pending_key);
+  if (it == pending_.end())
+    return;
+  std::vector<ResolveCallback> callbacks;
+  callbacks.swap(it->second);
+  pending_.erase(it);
+  for (const auto& callback : callbacks)
+    callback.Run(result);
+}
+
+}  // namespace buffet
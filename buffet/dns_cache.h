@@ -0,0 +1,126 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BUFFET_DNS_CACHE_H_
+#define BUFFET_DNS_CACHE_H_
+
+#include <sys/socket.h>
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <base/callback.h>
+#include <base/macros.h>
+#include <base/memory/weak_ptr.h>
+#include <base/time/time.h>
+
+namespace buffet {
+
+class IoWorkerPool;
+
+struct SocketAddress {
+  sockaddr_storage address;
+  socklen_t length{0};
+};
+
+struct ResolveResult {
+  std::vector<SocketAddress> addresses;
+  // errno value describing why |addresses| is empty.
+  int error{0};
+};
+
+// Resolves |host| with getaddrinfo(). Blocks, so it must run on a worker
+// thread.
+ResolveResult ResolveHost(const std::string& host, uint16_t port);
+
+// Returns the numeric host part of |address|.
+std::string GetIPAddress(const SocketAddress& address);
+
+// Caches successful and failed host name lookups for the connections weaved
+// makes to the cloud and XMPP servers. getaddrinfo() does not report record
+// TTLs, so entries live for fixed positive and negative TTLs, and the cache
+// should be flushed whenever the network changes.
+class DnsCache final {
+ public:
+  struct Options {
+    base::TimeDelta positive_ttl{base::TimeDelta::FromMinutes(5)};
+    base::TimeDelta negative_ttl{base::TimeDelta::FromSeconds(30)};
+  };
+
+  struct Stats {
+    // Lookups answered from the cache, including cached failures.
+    uint64_t hits{0};
+    // Hits on a cached failure.
+    uint64_t negative_hits{0};
+    uint64_t misses{0};
+    uint64_t flushes{0};
+  };
+
+  using ResolveCallback = base::Callback<void(const ResolveResult& result)>;
+  using Resolver =
+      base::Callback<ResolveResult(const std::string& host, uint16_t port)>;
+
+  DnsCache(IoWorkerPool* io_worker_pool, const Options& options);
+  ~DnsCache();
+
+  // Replaces ResolveHost(). The resolver runs on |io_worker_pool|.
+  void SetResolver(const Resolver& resolver) { resolver_ = resolver; }
+
+  // Resolves |host| on |io_worker_pool| unless a live cache entry exists.
+  // |callback| always runs asynchronously on the current thread. Concurrent
+  // misses for the same host share a single lookup.
+  void Resolve(const std::string& host,
+               uint16_t port,
+               const ResolveCallback& callback);
+
+  // Drops all entries. Lookups in flight still answer their callers, but
+  // their results are not cached.
+  void Flush();
+
+  // Changes with every Flush(). Lets users of older results tell that they
+  // are out of date.
+  uint64_t GetGeneration() const { return generation_; }
+
+  const Stats& GetStats() const { return stats_; }
+
+ private:
+  using Key = std::pair<std::string, uint16_t>;
+  // Key of a lookup in flight, tagged with the |generation_| it started in.
+  using PendingKey = std::tuple<std::string, uint16_t, uint64_t>;
+
+  struct Entry {
+    ResolveResult result;
+    base::TimeTicks expiration;
+  };
+
+  void OnResolved(const PendingKey& pending_key, const ResolveResult& result);
+
+  IoWorkerPool* io_worker_pool_{nullptr};
+  Options options_;
+  Resolver resolver_;
+  std::map<Key, Entry> entries_;
+  std::map<PendingKey, std::vector<ResolveCallback>> pending_;
+  // Incremented by Flush() so that older lookups are not cached.
+  uint64_t generation_{0};
+  Stats stats_;
+
+  base::WeakPtrFactory<DnsCache> weak_ptr_factory_{this};
+  DISALLOW_COPY_AND_ASSIGN(DnsCache);
+};
+
+}  // namespace buffet
+
+#endif  // BUFFET_DNS_CACHE_H_
@@ -0,0 +1,154 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/dns_cache.h"
+
+#include <errno.h>
+
+#include <base/bind.h>
+#include <base/message_loop/message_loop.h>
+#include <base/synchronization/lock.h>
+#include <brillo/bind_lambda.h>
+#include <brillo/message_loops/base_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
+#include <gtest/gtest.h>
+
+#include "buffet/io_worker_pool.h"
+
+namespace buffet {
+
+class DnsCacheTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    brillo_loop_.SetAsCurrent();
+    cache_.reset(new DnsCache{&pool_, options_});
+    cache_->SetResolver(base::Bind(&DnsCacheTest::FakeResolve,
+                                   base::Unretained(this)));
+  }
+
+  // Runs on the worker pool.
+  ResolveResult FakeResolve(const std::string& host, uint16_t port) {
+    {
+      base::AutoLock auto_lock(lock_);
+      lookups_++;
+    }
+    if (host == "unknown.example.com") {
+      ResolveResult result;
+      result.error = EHOSTUNREACH;
+      return result;
+    }
+    return ResolveHost("127.0.0.1", port);
+  }
+
+  // Resolves |host| and waits for the answer.
+  ResolveResult Resolve(const std::string& host) {
+    bool done = false;
+    ResolveResult result;
+    cache_->Resolve(host, 443,
+                    base::Bind(
+                        [&done, &result](const ResolveResult& value) {
+                          done = true;
+                          result = value;
+                        }));
+    RunUntil(base::Bind([&done]() { return done; }));
+    EXPECT_TRUE(done);
+    return result;
+  }
+
+  void RunUntil(const base::Callback<bool()>& condition) {
+    brillo::MessageLoopRunUntil(&brillo_loop_, base::TimeDelta::FromSeconds(5),
+                                condition);
+  }
+
+  int lookups() {
+    base::AutoLock auto_lock(lock_);
+    return lookups_;
+  }
+
+ protected:
+  base::MessageLoopForIO base_loop_;
+  brillo::BaseMessageLoop brillo_loop_{&base_loop_};
+  IoWorkerPool pool_{2};
+  DnsCache::Options options_;
+  std::unique_ptr<DnsCache> cache_;
+
+  base::Lock lock_;
+  int lookups_{0};
+};
+
+TEST_F(DnsCacheTest, CachesPositiveAnswers) {
+  ResolveResult result = Resolve("www.example.com");
+  ASSERT_EQ(1u, result.addresses.size());
+  EXPECT_EQ("127.0.0.1", GetIPAddress(result.addresses[0]));
+
+  result = Resolve("www.example.com");
+  ASSERT_EQ(1u, result.addresses.size());
+  EXPECT_EQ(1, lookups());
+  EXPECT_EQ(1u, cache_->GetStats().hits);
+  EXPECT_EQ(1u, cache_->GetStats().misses);
+}
+
+TEST_F(DnsCacheTest, CachesNegativeAnswers) {
+  ResolveResult result = Resolve("unknown.example.com");
+  EXPECT_TRUE(result.addresses.empty());
+  EXPECT_EQ(EHOSTUNREACH, result.error);
+
+  result = Resolve("unknown.example.com");
+  EXPECT_TRUE(result.addresses.empty());
+  EXPECT_EQ(EHOSTUNREACH, result.error);
+  EXPECT_EQ(1, lookups());
+  EXPECT_EQ(1u, cache_->GetStats().negative_hits);
+}
+
+TEST_F(DnsCacheTest, ExpiredEntriesAreResolvedAgain) {
+  options_.positive_ttl = base::TimeDelta{};
+  SetUp();
+  Resolve("www.example.com");
+  Resolve("www.example.com");
+  EXPECT_EQ(2, lookups());
+  EXPECT_EQ(0u, cache_->GetStats().hits);
+  EXPECT_EQ(2u, cache_->GetStats().misses);
+}
+
+TEST_F(DnsCacheTest, FlushDropsEntries) {
+  Resolve("www.example.com");
+  cache_->Flush();
+  Resolve("www.example.com");
+  EXPECT_EQ(2, lookups());
+  EXPECT_EQ(1u, cache_->GetStats().flushes);
+}
+
+TEST_F(DnsCacheTest, ConcurrentMissesShareLookup) {
+  int answers = 0;
+  auto callback =
+      base::Bind([&answers](const ResolveResult& result) { answers++; });
+  cache_->Resolve("www.example.com", 443, callback);
+  cache_->Resolve("www.example.com", 443, callback);
+  RunUntil(base::Bind([&answers]() { return answers == 2; }));
+  EXPECT_EQ(2, answers);
+  EXPECT_EQ(1, lookups());
+}
+
+TEST_F(DnsCacheTest, LookupStartedBeforeFlushIsNotCached) {
+  bool done = false;
+  cache_->Resolve("www.example.com", 443,
+                  base::Bind([&done](const ResolveResult&) { done = true; }));
+  cache_->Flush();
+  RunUntil(base::Bind([&done]() { return done; }));
+  EXPECT_TRUE(done);
+  Resolve("www.example.com");
+  EXPECT_EQ(2, lookups());
+}
+
+}  // namespace buffet
@@ -18,6 +18,7 @@
 #include <memory>
 #include <string>
 
+#include <base/files/file_path.h>
 #include <base/macros.h>
 
 namespace buffet {
@@ -41,8 +42,10 @@ class Encryptor {
   // A factory method to be exported by the default Encryptor implementation
   // for a given platform. Like a constructor, this method should not perform
   // any significant initialization work. The caller assumes ownership of the
-  // pointer.
-  static std::unique_ptr<Encryptor> CreateDefaultEncryptor();
+  // pointer. |settings| is the settings file the encryptor protects;
+  // implementations that need a key file keep it next to it.
+  static std::unique_ptr<Encryptor> CreateDefaultEncryptor(
+      const base::FilePath& settings);
 
  private:
   DISALLOW_COPY_AND_ASSIGN(Encryptor);
@@ -0,0 +1,88 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <memory>
+#include <string>
+
+#include <base/files/file_path.h>
+#include <base/files/scoped_temp_dir.h>
+#include <base/logging.h>
+#include <benchmark/benchmark.h>
+#ifdef BRILLO
+#include <keystore/keystore_client_impl.h>
+#endif
+
+#include "buffet/encryptor.h"
+#include "buffet/software_encryptor.h"
+#ifdef BRILLO
+#include "buffet/keystore_encryptor.h"
+#endif
+
+namespace buffet {
+
+namespace {
+
+#ifdef BRILLO
+// Keeps the benchmark away from the key of the daemon's settings.
+const char kBenchmarkKeyName[] = "weaved_benchmark";
+#endif
+
+// Settings blobs are a few hundred bytes for a fresh device and grow to a
+// few kilobytes once registered with a cloud account.
+void SettingsSizes(benchmark::internal::Benchmark* benchmark) {
+  for (int size : {256, 1024, 4 * 1024, 16 * 1024})
+    benchmark->Arg(size);
+}
+
+std::string MakeSettings(size_t size) {
+  std::string settings;
+  while (settings.size() < size)
+    settings += "{\"refresh_token\":\"0123456789abcdef\"},";
+  settings.resize(size);
+  return settings;
+}
+
+void EncryptAndDecrypt(benchmark::State& state, Encryptor* encryptor) {
+  std::string plaintext = MakeSettings(state.range_x());
+  std::string ciphertext;
+  std::string decrypted;
+  while (state.KeepRunning()) {
+    CHECK(encryptor->EncryptWithAuthentication(plaintext, &ciphertext));
+    CHECK(encryptor->DecryptWithAuthentication(ciphertext, &decrypted));
+  }
+  state.SetBytesProcessed(state.iterations() * plaintext.size());
+}
+
+}  // namespace
+
+void BM_SoftwareEncryptor(benchmark::State& state) {
+  base::ScopedTempDir temp_dir;
+  CHECK(temp_dir.CreateUniqueTempDir());
+  SoftwareEncryptor encryptor{temp_dir.path().Append("settings.key")};
+  EncryptAndDecrypt(state, &encryptor);
+}
+BENCHMARK(BM_SoftwareEncryptor)->Apply(SettingsSizes);
+
+#ifdef BRILLO
+void BM_KeystoreEncryptor(benchmark::State& state) {
+  KeystoreEncryptor encryptor{std::unique_ptr<keystore::KeystoreClient>(
+                                  new keystore::KeystoreClientImpl),
+                              kBenchmarkKeyName};
+  EncryptAndDecrypt(state, &encryptor);
+  keystore::KeystoreClientImpl{}.deleteKey(kBenchmarkKeyName);
+}
+BENCHMARK(BM_KeystoreEncryptor)->Apply(SettingsSizes);
+#endif
+
+}  // namespace buffet
@@ -14,13 +14,24 @@
 
 #include "buffet/http_transport_client.h"
 
+#include <algorithm>
+
 #include <base/bind.h>
+#include <base/logging.h>
+#include <base/rand_util.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_util.h>
 #include <brillo/errors/error.h>
+#include <brillo/errors/error_codes.h>
 #include <brillo/http/http_request.h>
 #include <brillo/http/http_utils.h>
 #include <brillo/streams/memory_stream.h>
+#include <brillo/streams/stream.h>
+#include <curl/curlver.h>
 #include <weave/enum_to_string.h>
 
+#include "buffet/compression.h"
+#include "buffet/dns_cache.h"
 #include "buffet/weave_error_conversion.h"
 
 namespace buffet {
@@ -29,37 +40,72 @@ namespace {
 
 using weave::provider::HttpClient;
 
-// The number of seconds each HTTP request will be allowed before timing out.
-const int kRequestTimeoutSeconds = 30;
+// Timeout for a whole request. Slow hosts get up to the maximum.
+const int kDefaultRequestTimeoutSeconds = 30;
+const int kMaxRequestTimeoutSeconds = 60;
 
-class ResponseImpl : public HttpClient::Response {
- public:
-  ~ResponseImpl() override = default;
-  explicit ResponseImpl(std::unique_ptr<brillo::http::Response> response)
-      : response_{std::move(response)},
-        data_{response_->ExtractDataAsString()} {}
+// Requests with bodies up to this size are cancelled once they take much
+// longer than the round trips to their host, but not before the minimum.
+const size_t kMaxWatchedRequestSize = 16 * 1024;
+const int kMinResponseTimeoutSeconds = 5;
 
-  // HttpClient::Response implementation
-  int GetStatusCode() const override { return response_->GetStatusCode(); }
+// Transport failures in a row that open the circuit breaker of a host, and
+// how long it stays open.
+const int kCircuitBreakerThreshold = 5;
+const int kCircuitBreakerCooldownSeconds = 30;
 
-  std::string GetContentType() const override {
-    return response_->GetContentType();
-  }
+const char kAcceptEncodingHeader[] = "Accept-Encoding";
+const char kContentEncodingHeader[] = "Content-Encoding";
+const char kGzipEncoding[] = "gzip";
 
-  std::string GetData() const override { return data_; }
+// Limit for inflated response bodies.
+const size_t kMaxResponseBodySize = 16 * 1024 * 1024;
 
- private:
-  std::unique_ptr<brillo::http::Response> response_;
-  std::string data_;
-  DISALLOW_COPY_AND_ASSIGN(ResponseImpl);
-};
+// After this many requests were started from other queues while a queue had
+// a request that could start, one request of that queue is started.
+const size_t kMaxSkippedDispatches = 16;
 
-void OnSuccessCallback(const HttpClient::SendRequestCallback& callback,
-                       int id,
-                       std::unique_ptr<brillo::http::Response> response) {
-  callback.Run(std::unique_ptr<HttpClient::Response>{new ResponseImpl{
-                   std::move(response)}},
-               nullptr);
+// Chunk size for reading bodies of unknown length.
+const size_t kBodyReadChunkSize = 16 * 1024;
+
+// Reads the body of |response| straight into a string. Unlike
+// ExtractDataAsString() this skips the intermediate byte vector.
+std::string ReadBody(brillo::http::Response* response) {
+  std::string body;
+  brillo::ErrorPtr error;
+  brillo::StreamPtr stream = response->ExtractDataStream(&error);
+  if (!stream)
+    return body;
+  if (stream->CanGetSize()) {
+    body.resize(stream->GetRemainingSize());
+    if (!stream->ReadAllBlocking(&body[0], body.size(), &error)) {
+      LOG(ERROR) << "Failed to read response body: " << error->GetMessage();
+      body.clear();
+    }
+    return body;
+  }
+  for (;;) {
+    size_t offset = body.size();
+    body.resize(offset + kBodyReadChunkSize);
+    size_t size_read = 0;
+    if (!stream->ReadBlocking(&body[offset], kBodyReadChunkSize, &size_read,
+                              &error)) {
+      LOG(ERROR) << "Failed to read response body: " << error->GetMessage();
+      body.clear();
+      return body;
+    }
+    body.resize(offset + size_read);
+    if (size_read == 0)
+      return body;
+  }
+}
+
+bool HasHeader(const HttpClient::Headers& headers, const std::string& name) {
+  for (const auto& header : headers) {
+    if (base::EqualsCaseInsensitiveASCII(header.first, name))
+      return true;
+  }
+  return false;
 }
 
 void OnErrorCallback(const HttpClient::SendRequestCallback& callback,
@@ -70,37 +116,651 @@ void OnErrorCallback(const HttpClient::SendRequestCallback& callback,
   callback.Run(nullptr, std::move(error));
 }
 
+// Extracts the host name and port of an "http" or "https" |url|.
+bool ParseHostAndPort(const std::string& url,
+                      std::string* host,
+                      uint16_t* port) {
+  size_t scheme_end = url.find("://");
+  if (scheme_end == std::string::npos)
+    return false;
+  std::string scheme = url.substr(0, scheme_end);
+  if (scheme == "https")
+    *port = 443;
+  else if (scheme == "http")
+    *port = 80;
+  else
+    return false;
+
+  size_t host_begin = scheme_end + 3;
+  size_t host_end = url.find_first_of("/?#", host_begin);
+  std::string authority = url.substr(host_begin, host_end - host_begin);
+  if (authority.find('@') != std::string::npos)
+    return false;
+  size_t port_begin = authority.rfind(':');
+  // A colon inside brackets belongs to an IPv6 literal.
+  if (port_begin != std::string::npos &&
+      authority.find(']', port_begin) == std::string::npos) {
+    unsigned value = 0;
+    if (!base::StringToUint(authority.substr(port_begin + 1), &value) ||
+        value == 0 || value > 0xFFFF) {
+      return false;
+    }
+    *port = static_cast<uint16_t>(value);
+    authority.resize(port_begin);
+  }
+  if (authority.empty() || authority.front() == '[')
+    return false;
+  *host = authority;
+  return true;
+}
+
 }  // anonymous namespace
 
-HttpTransportClient::HttpTransportClient()
-    : transport_{brillo::http::Transport::CreateDefault()} {
-  transport_->SetDefaultTimeout(
-      base::TimeDelta::FromSeconds(kRequestTimeoutSeconds));
+HttpTransportResponse::HttpTransportResponse(
+    std::unique_ptr<brillo::http::Response> response)
+    : response_{std::move(response)} {}
+
+HttpTransportResponse::~HttpTransportResponse() {}
+
+int HttpTransportResponse::GetStatusCode() const {
+  return response_->GetStatusCode();
+}
+
+std::string HttpTransportResponse::GetContentType() const {
+  return response_->GetContentType();
+}
+
+bool HttpTransportResponse::IsGzipEncoded() const {
+  return base::EqualsCaseInsensitiveASCII(
+      response_->GetHeader(kContentEncodingHeader), kGzipEncoding);
+}
+
+bool HttpTransportResponse::LoadBody() const {
+  if (body_)
+    return body_valid_;
+  std::string body = ReadBody(response_.get());
+  encoded_body_size_ = body.size();
+  if (IsGzipEncoded()) {
+    std::string inflated;
+    body_valid_ = compression::Decompress(body, compression::Format::kGzip,
+                                          kMaxResponseBodySize, &inflated);
+    if (!body_valid_)
+      LOG(ERROR) << "Failed to inflate gzip-encoded response body";
+    body.swap(inflated);
+  }
+  body_ = std::make_shared<const std::string>(std::move(body));
+  return body_valid_;
+}
+
+std::string HttpTransportResponse::GetData() const {
+  return *GetSharedBody();
+}
+
+base::StringPiece HttpTransportResponse::GetBody() const {
+  return *GetSharedBody();
+}
+
+std::shared_ptr<const std::string> HttpTransportResponse::GetSharedBody()
+    const {
+  LoadBody();
+  return body_;
 }
 
-HttpTransportClient::~HttpTransportClient() {}
+HttpTransportClient::HttpTransportClient(DnsCache* dns_cache)
+    : transport_factory_{base::Bind(&brillo::http::Transport::CreateDefault)},
+      dns_cache_{dns_cache} {
+  // libweave's OAuth token refreshes and command updates.
+  AddPriorityRule("/oauth2/", TaskPriority::kInteractive);
+  AddPriorityRule("/commands/", TaskPriority::kInteractive);
+  AddPriorityRule("/patchState", TaskPriority::kBackground);
+}
+
+HttpTransportClient::~HttpTransportClient() {
+  for (const auto& pair : pools_) {
+    for (const PooledTransport& idle : pair.second.idle)
+      brillo::MessageLoop::current()->CancelTask(idle.evict_task);
+  }
+}
+
+void HttpTransportClient::SetTransportFactory(
+    const TransportFactory& factory) {
+  transport_factory_ = factory;
+}
+
+void HttpTransportClient::AddPriorityRule(const std::string& url_part,
+                                          TaskPriority priority) {
+  priority_rules_.emplace_back(url_part, priority);
+}
+
+const HttpTransportClient::PriorityStats&
+HttpTransportClient::GetPriorityStats(TaskPriority priority) const {
+  size_t index = static_cast<size_t>(priority);
+  CHECK_LT(index, kPriorityCount);
+  return priority_stats_[index];
+}
+
+std::map<std::string, HttpTransportClient::PoolStats>
+HttpTransportClient::GetPoolStats() const {
+  std::map<std::string, PoolStats> stats;
+  for (const auto& pair : pools_) {
+    PoolStats& pool_stats = stats[pair.first];
+    pool_stats = pair.second.stats;
+    pool_stats.busy_connections = pair.second.busy.size();
+    pool_stats.idle_connections = pair.second.idle.size();
+    pool_stats.smoothed_rtt = pair.second.smoothed_rtt;
+    pool_stats.request_timeout = GetRequestTimeout(pair.second);
+    pool_stats.response_timeout = GetResponseTimeout(pair.second);
+  }
+  return stats;
+}
 
 void HttpTransportClient::SendRequest(Method method,
                                       const std::string& url,
                                       const Headers& headers,
                                       const std::string& data,
                                       const SendRequestCallback& callback) {
-  brillo::http::Request request(url, weave::EnumToString(method), transport_);
-  request.AddHeaders(headers);
-  if (!data.empty()) {
-    auto stream = brillo::MemoryStream::OpenCopyOf(data, nullptr);
+  // The request outlives |data|, so this is the one copy of the body.
+  SendRequest(method, url, headers, std::string{data}, callback);
+}
+
+void HttpTransportClient::SendRequest(Method method,
+                                      const std::string& url,
+                                      const Headers& headers,
+                                      std::string&& data,
+                                      const SendRequestCallback& callback) {
+  std::unique_ptr<PendingRequest> request{
+      new PendingRequest{method, url, headers, std::move(data), callback}};
+  request->priority = GetRequestPriority(url);
+  // URLs that do not parse share the pool with the empty key.
+  if (ParseHostAndPort(url, &request->host, &request->port)) {
+    request->pool_key =
+        request->host + ":" + base::UintToString(request->port);
+  }
+  priority_stats_[static_cast<size_t>(request->priority)].requests++;
+  EnqueueRequest(std::move(request));
+}
+
+void HttpTransportClient::EnqueueRequest(
+    std::unique_ptr<PendingRequest> request) {
+  // Retries come through here as well.
+  HostPool& pool = pools_[request->pool_key];
+  if (base::TimeTicks::Now() < pool.circuit_open_until) {
+    pool.stats.requests_rejected++;
+    weave::ErrorPtr error;
+    weave::Error::AddTo(&error, FROM_HERE, "unreachable",
+                        request->pool_key +
+                            " is unreachable, not sending requests for now");
+    brillo::MessageLoop::current()->PostTask(
+        FROM_HERE,
+        base::Bind(request->callback, nullptr, base::Passed(&error)));
+    return;
+  }
+  request->queued_time = base::TimeTicks::Now();
+  size_t index = static_cast<size_t>(request->priority);
+  if (requests_in_flight_ >= max_requests_in_flight_)
+    priority_stats_[index].requests_queued++;
+  if (!HasFreeTransport(request->pool_key))
+    pool.stats.requests_queued++;
+  request_queues_[index].push_back(std::move(request));
+  DispatchRequests();
+}
+
+uint64_t HttpTransportClient::GetDnsGeneration() const {
+  return dns_cache_ ? dns_cache_->GetGeneration() : 0;
+}
+
+TaskPriority HttpTransportClient::GetRequestPriority(
+    const std::string& url) const {
+  TaskPriority priority = PrioritizedTaskRunner::GetCurrentPriority();
+  if (priority != TaskPriority::kNormal)
+    return priority;
+  for (const auto& rule : priority_rules_) {
+    if (url.find(rule.first) != std::string::npos)
+      return rule.second;
+  }
+  return TaskPriority::kNormal;
+}
+
+void HttpTransportClient::DispatchRequests() {
+  // Requests that fail right away finish from within the loop below.
+  if (dispatching_)
+    return;
+  dispatching_ = true;
+  while (requests_in_flight_ < max_requests_in_flight_) {
+    // The oldest request of each queue that its pool can take. Requests of
+    // full pools neither start nor hold up the others.
+    std::deque<std::unique_ptr<PendingRequest>>::iterator
+        next[kPriorityCount];
+    size_t first = kPriorityCount;
+    for (size_t index = 0; index < kPriorityCount; index++) {
+      auto& queue = request_queues_[index];
+      if (queue.empty())
+        skipped_dispatches_[index] = 0;
+      next[index] = std::find_if(
+          queue.begin(), queue.end(),
+          [this](const std::unique_ptr<PendingRequest>& request) {
+            return HasFreeTransport(request->pool_key);
+          });
+      if (next[index] == queue.end())
+        continue;
+      if (first == kPriorityCount)
+        first = index;
+    }
+    if (first == kPriorityCount)
+      break;
+
+    // Promotes the queue that was passed over most often, the more important
+    // one on a tie.
+    size_t index = first;
+    size_t starved = first;
+    for (size_t lane = first + 1; lane < kPriorityCount; lane++) {
+      if (next[lane] != request_queues_[lane].end() &&
+          skipped_dispatches_[lane] > skipped_dispatches_[starved]) {
+        starved = lane;
+      }
+    }
+    if (skipped_dispatches_[starved] >= kMaxSkippedDispatches)
+      index = starved;
+    for (size_t lane = 0; lane < kPriorityCount; lane++) {
+      if (lane != index && next[lane] != request_queues_[lane].end())
+        skipped_dispatches_[lane]++;
+    }
+    skipped_dispatches_[index] = 0;
+
+    std::unique_ptr<PendingRequest> request = std::move(*next[index]);
+    request_queues_[index].erase(next[index]);
+    requests_in_flight_++;
+    PriorityStats& stats = priority_stats_[index];
+    base::TimeDelta queue_time = base::TimeTicks::Now() - request->queued_time;
+    stats.total_queue_time += queue_time;
+    stats.max_queue_time = std::max(stats.max_queue_time, queue_time);
+    AcquireTransport(std::move(request));
+  }
+  dispatching_ = false;
+}
+
+bool HttpTransportClient::HasFreeTransport(
+    const std::string& pool_key) const {
+  auto it = pools_.find(pool_key);
+  return it == pools_.end() || !it->second.idle.empty() ||
+         it->second.busy.size() < pool_options_.max_connections_per_host;
+}
+
+void HttpTransportClient::FinishRequest() {
+  CHECK_GT(requests_in_flight_, 0u);
+  requests_in_flight_--;
+  DispatchRequests();
+}
+
+bool HttpTransportClient::CompressRequestBody(PendingRequest* request) {
+  if (request->compressed)
+    return true;
+  if (!compression_options_.compress_requests ||
+      request->data.size() < compression_options_.min_request_size ||
+      HasHeader(request->headers, kContentEncodingHeader)) {
+    return false;
+  }
+  std::string compressed;
+  if (!compression::Compress(request->data, compression::Format::kGzip,
+                             &compressed) ||
+      compressed.size() >= request->data.size()) {
+    return false;
+  }
+  compression_stats_.requests_compressed++;
+  compression_stats_.request_bytes_saved +=
+      request->data.size() - compressed.size();
+  request->data.swap(compressed);
+  request->compressed = true;
+  return true;
+}
+
+void HttpTransportClient::UpdateRoundTripTime(HostPool* pool,
+                                              base::TimeDelta rtt) {
+  // A zero estimate means that there was no sample yet.
+  rtt = std::max(rtt, base::TimeDelta::FromMilliseconds(1));
+  if (pool->smoothed_rtt.is_zero()) {
+    pool->smoothed_rtt = rtt;
+    pool->rtt_variation = rtt / 2;
+    return;
+  }
+  base::TimeDelta deviation = (pool->smoothed_rtt - rtt).magnitude();
+  pool->rtt_variation = (pool->rtt_variation * 3 + deviation) / 4;
+  pool->smoothed_rtt = (pool->smoothed_rtt * 7 + rtt) / 8;
+}
+
+base::TimeDelta HttpTransportClient::GetRequestTimeout(
+    const HostPool& pool) const {
+  // The round trip times are those of whole requests, mostly small ones, and
+  // the timeout covers the whole transfer. Fast round trips therefore do not
+  // shorten it, or a large body on a slow link would be cut off.
+  base::TimeDelta timeout =
+      base::TimeDelta::FromSeconds(kDefaultRequestTimeoutSeconds);
+  if (!pool.smoothed_rtt.is_zero())
+    timeout = std::max(timeout, pool.smoothed_rtt + pool.rtt_variation * 4);
+  return std::min(timeout,
+                  base::TimeDelta::FromSeconds(kMaxRequestTimeoutSeconds));
+}
+
+base::TimeDelta HttpTransportClient::GetResponseTimeout(
+    const HostPool& pool) const {
+  // RFC 6298 retransmission timeout, for requests whose transfer takes about
+  // as long as the requests the estimate comes from.
+  if (pool.smoothed_rtt.is_zero())
+    return base::TimeDelta{};
+  base::TimeDelta timeout = std::max(
+      pool.smoothed_rtt + pool.rtt_variation * 4,
+      base::TimeDelta::FromSeconds(kMinResponseTimeoutSeconds));
+  return std::min(timeout, GetRequestTimeout(pool));
+}
+
+void HttpTransportClient::OnResponseTimeout(
+    const std::shared_ptr<PendingRequest>& request,
+    brillo::http::Transport* transport) {
+  request->timeout_task = brillo::MessageLoop::kTaskIdNull;
+  HostPool& pool = pools_[request->pool_key];
+  pool.stats.requests_timed_out++;
+  VLOG(1) << "Cancelling " << request->url << " after "
+          << GetResponseTimeout(pool).InMilliseconds() << " ms";
+  // The transport does not run the callbacks of a cancelled request.
+  transport->CancelRequest(request->request_id);
+  brillo::ErrorPtr error;
+  brillo::Error::AddTo(&error, FROM_HERE, brillo::errors::http::kDomain,
+                       "request_timeout", "Request timed out");
+  OnRequestError(request, transport, request->request_id, error.get());
+}
+
+bool HttpTransportClient::CanRetry(const PendingRequest& request) const {
+  return request.retries < retry_options_.max_retries &&
+         (request.method == Method::kGet || request.method == Method::kPut);
+}
+
+void HttpTransportClient::RetryRequest(const PendingRequest& request) {
+  std::unique_ptr<PendingRequest> retry{new PendingRequest(request)};
+  retry->retries++;
+  pools_[retry->pool_key].stats.retries++;
+
+  base::TimeDelta backoff = retry_options_.initial_backoff;
+  for (int i = 1; i < retry->retries && backoff < retry_options_.max_backoff;
+       i++) {
+    backoff *= 2;
+  }
+  backoff = std::min(backoff, retry_options_.max_backoff);
+  // Keeps clients that failed together from retrying in lockstep.
+  int64_t half_backoff_us = backoff.InMicroseconds() / 2;
+  base::TimeDelta delay = base::TimeDelta::FromMicroseconds(
+      half_backoff_us + base::RandGenerator(half_backoff_us + 1));
+  VLOG(1) << "Retrying " << retry->url << " in " << delay.InMilliseconds()
+          << " ms";
+  brillo::MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&HttpTransportClient::EnqueueRequest,
+                 weak_ptr_factory_.GetWeakPtr(), base::Passed(&retry)),
+      delay);
+}
+
+void HttpTransportClient::AcquireTransport(
+    std::unique_ptr<PendingRequest> request) {
+  HostPool& pool = pools_[request->pool_key];
+  pool.stats.requests++;
+
+  // Transports pinned to addresses from before the last DNS cache flush are
+  // closed instead of reused.
+  uint64_t dns_generation = GetDnsGeneration();
+  auto stale = std::stable_partition(
+      pool.idle.begin(), pool.idle.end(),
+      [dns_generation](const PooledTransport& idle) {
+        return idle.dns_generation == dns_generation;
+      });
+  for (auto it = stale; it != pool.idle.end(); ++it) {
+    brillo::MessageLoop::current()->CancelTask(it->evict_task);
+    pool.stats.connections_evicted++;
+  }
+  pool.idle.erase(stale, pool.idle.end());
+
+  if (!pool.idle.empty()) {
+    PooledTransport transport = pool.idle.back();
+    brillo::MessageLoop::current()->CancelTask(transport.evict_task);
+    transport.evict_task = brillo::MessageLoop::kTaskIdNull;
+    pool.idle.pop_back();
+    pool.busy.push_back(transport);
+    pool.stats.connections_reused++;
+    StartRequest(std::move(request), transport.transport);
+  } else {
+    CHECK_LT(pool.busy.size(), pool_options_.max_connections_per_host);
+    OpenTransport(std::move(request));
+  }
+}
+
+void HttpTransportClient::OpenTransport(
+    std::unique_ptr<PendingRequest> request) {
+  HostPool& pool = pools_[request->pool_key];
+  PooledTransport pooled;
+  pooled.transport = transport_factory_.Run();
+  pooled.dns_generation = GetDnsGeneration();
+  pool.busy.push_back(pooled);
+  pool.stats.connections_opened++;
+  if (!dns_cache_ || request->pool_key.empty()) {
+    StartRequest(std::move(request), pooled.transport);
+    return;
+  }
+  std::string host = request->host;
+  uint16_t port = request->port;
+  dns_cache_->Resolve(
+      host, port,
+      base::Bind(&HttpTransportClient::OnHostResolved,
+                 weak_ptr_factory_.GetWeakPtr(), base::Passed(&request),
+                 pooled.transport));
+}
+
+void HttpTransportClient::OnHostResolved(
+    std::unique_ptr<PendingRequest> request,
+    const std::shared_ptr<brillo::http::Transport>& transport,
+    const ResolveResult& result) {
+  if (result.addresses.empty()) {
+    brillo::ErrorPtr brillo_error;
+    brillo::errors::system::AddSystemError(&brillo_error, FROM_HERE,
+                                           result.error);
+    weave::ErrorPtr error;
+    ConvertError(*brillo_error, &error);
+    DropTransport(request->pool_key, transport.get());
+    FinishRequest();
+    request->callback.Run(nullptr, std::move(error));
+    return;
+  }
+  // Pins the host once per transport, so that the transport does not look it
+  // up again.
+#if LIBCURL_VERSION_NUM >= 0x073b00
+  // curl 7.59.0 and later take a list, and fall back from one address to the
+  // next.
+  std::vector<std::string> addresses;
+  for (const SocketAddress& address : result.addresses)
+    addresses.push_back(GetIPAddress(address));
+  transport->ResolveHostToIp(request->host, request->port,
+                             base::JoinString(addresses, ","));
+#else
+  // Older curl rejects a list and resolves the host on its own, bypassing the
+  // cache. Pins the address the resolver prefers.
+  transport->ResolveHostToIp(request->host, request->port,
+                             GetIPAddress(result.addresses.front()));
+#endif
+  StartRequest(std::move(request), transport);
+}
+
+void HttpTransportClient::StartRequest(
+    std::unique_ptr<PendingRequest> pending,
+    const std::shared_ptr<brillo::http::Transport>& transport) {
+  const SendRequestCallback& callback = pending->callback;
+  transport->SetDefaultTimeout(GetRequestTimeout(pools_[pending->pool_key]));
+  brillo::http::Request request(
+      pending->url, weave::EnumToString(pending->method), transport);
+  request.AddHeaders(pending->headers);
+  if (!HasHeader(pending->headers, kAcceptEncodingHeader))
+    request.AddHeader(kAcceptEncodingHeader, kGzipEncoding);
+  if (CompressRequestBody(pending.get()))
+    request.AddHeader(kContentEncodingHeader, kGzipEncoding);
+  base::TimeDelta response_timeout;
+  if (pending->data.size() <= kMaxWatchedRequestSize)
+    response_timeout = GetResponseTimeout(pools_[pending->pool_key]);
+  if (!pending->data.empty()) {
+    // OpenCopyOf() takes the string by value, so the body is moved, not
+    // copied, into the stream. Requests that may be retried keep theirs.
+    auto stream = brillo::MemoryStream::OpenCopyOf(
+        CanRetry(*pending) ? pending->data : std::move(pending->data),
+        nullptr);
     CHECK(stream->GetRemainingSize());
     brillo::ErrorPtr cromeos_error;
     if (!request.AddRequestBody(std::move(stream), &cromeos_error)) {
       weave::ErrorPtr error;
       ConvertError(*cromeos_error, &error);
-      transport_->RunCallbackAsync(
+      transport->RunCallbackAsync(
           FROM_HERE, base::Bind(callback, nullptr, base::Passed(&error)));
+      ReleaseTransport(pending->pool_key, transport.get());
+      FinishRequest();
       return;
     }
   }
-  request.GetResponse(base::Bind(&OnSuccessCallback, callback),
-                      base::Bind(&OnErrorCallback, callback));
+  pending->start_time = base::TimeTicks::Now();
+  // The callbacks identify the transport by address. Holding a reference
+  // would keep the transport alive through its own pending request.
+  std::shared_ptr<PendingRequest> shared_pending{std::move(pending)};
+  // Posted first, so that a request that finishes right away cancels it.
+  shared_pending->timeout_task = brillo::MessageLoop::kTaskIdNull;
+  if (!response_timeout.is_zero()) {
+    shared_pending->timeout_task =
+        brillo::MessageLoop::current()->PostDelayedTask(
+            FROM_HERE,
+            base::Bind(&HttpTransportClient::OnResponseTimeout,
+                       weak_ptr_factory_.GetWeakPtr(), shared_pending,
+                       transport.get()),
+            response_timeout);
+  }
+  shared_pending->request_id = request.GetResponse(
+      base::Bind(&HttpTransportClient::OnResponse,
+                 weak_ptr_factory_.GetWeakPtr(), shared_pending,
+                 transport.get()),
+      base::Bind(&HttpTransportClient::OnRequestError,
+                 weak_ptr_factory_.GetWeakPtr(), shared_pending,
+                 transport.get()));
+}
+
+void HttpTransportClient::OnResponse(
+    const std::shared_ptr<PendingRequest>& request,
+    brillo::http::Transport* transport,
+    int request_id,
+    std::unique_ptr<brillo::http::Response> response) {
+  brillo::MessageLoop::current()->CancelTask(request->timeout_task);
+  HostPool& pool = pools_[request->pool_key];
+  UpdateRoundTripTime(&pool, base::TimeTicks::Now() - request->start_time);
+  pool.consecutive_failures = 0;
+  ReleaseTransport(request->pool_key, transport);
+  FinishRequest();
+  int status_code = response->GetStatusCode();
+  if ((status_code == brillo::http::status_code::BadGateway ||
+       status_code == brillo::http::status_code::ServiceUnavailable ||
+       status_code == brillo::http::status_code::GatewayTimeout) &&
+      CanRetry(*request)) {
+    RetryRequest(*request);
+    return;
+  }
+  const SendRequestCallback& callback = request->callback;
+  std::unique_ptr<HttpTransportResponse> http_response{
+      new HttpTransportResponse{std::move(response)}};
+  if (http_response->IsGzipEncoded()) {
+    // Reads the body right away, so that a corrupt one fails the request.
+    if (!http_response->LoadBody()) {
+      weave::ErrorPtr error;
+      weave::Error::AddTo(&error, FROM_HERE, "invalid_response",
+                          "Failed to inflate gzip-encoded response body");
+      callback.Run(nullptr, std::move(error));
+      return;
+    }
+    size_t body_size = http_response->GetBody().size();
+    compression_stats_.responses_decompressed++;
+    if (body_size > http_response->GetEncodedBodySize()) {
+      compression_stats_.response_bytes_saved +=
+          body_size - http_response->GetEncodedBodySize();
+    }
+  }
+  callback.Run(std::unique_ptr<HttpClient::Response>{std::move(http_response)},
+               nullptr);
+}
+
+void HttpTransportClient::OnRequestError(
+    const std::shared_ptr<PendingRequest>& request,
+    brillo::http::Transport* transport,
+    int request_id,
+    const brillo::Error* error) {
+  brillo::MessageLoop::current()->CancelTask(request->timeout_task);
+  request->timeout_task = brillo::MessageLoop::kTaskIdNull;
+  HostPool& pool = pools_[request->pool_key];
+  if (++pool.consecutive_failures >= kCircuitBreakerThreshold &&
+      base::TimeTicks::Now() >= pool.circuit_open_until) {
+    LOG(WARNING) << "Not sending requests to " << request->pool_key
+                 << " for a while after " << pool.consecutive_failures
+                 << " failures in a row";
+    pool.circuit_open_until =
+        base::TimeTicks::Now() +
+        base::TimeDelta::FromSeconds(kCircuitBreakerCooldownSeconds);
+    pool.stats.circuit_breaker_trips++;
+  }
+  ReleaseTransport(request->pool_key, transport);
+  FinishRequest();
+  if (CanRetry(*request) &&
+      base::TimeTicks::Now() >= pool.circuit_open_until) {
+    RetryRequest(*request);
+    return;
+  }
+  OnErrorCallback(request->callback, request_id, error);
+}
+
+void HttpTransportClient::ReleaseTransport(
+    const std::string& pool_key,
+    brillo::http::Transport* transport) {
+  HostPool& pool = pools_[pool_key];
+  auto it = std::find_if(pool.busy.begin(), pool.busy.end(),
+                         [transport](const PooledTransport& busy) {
+                           return busy.transport.get() == transport;
+                         });
+  CHECK(it != pool.busy.end());
+  if (it->dns_generation != GetDnsGeneration()) {
+    pool.stats.connections_evicted++;
+    DropTransport(pool_key, transport);
+    return;
+  }
+
+  // The next request to start takes it from there, see DispatchRequests().
+  PooledTransport idle = *it;
+  pool.busy.erase(it);
+  idle.evict_task = brillo::MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&HttpTransportClient::EvictIdleTransport,
+                 weak_ptr_factory_.GetWeakPtr(), pool_key, transport),
+      pool_options_.idle_timeout);
+  pool.idle.push_back(idle);
+}
+
+void HttpTransportClient::DropTransport(const std::string& pool_key,
+                                        brillo::http::Transport* transport) {
+  HostPool& pool = pools_[pool_key];
+  auto it = std::find_if(pool.busy.begin(), pool.busy.end(),
+                         [transport](const PooledTransport& busy) {
+                           return busy.transport.get() == transport;
+                         });
+  CHECK(it != pool.busy.end());
+  pool.busy.erase(it);
+}
+
+void HttpTransportClient::EvictIdleTransport(
+    const std::string& pool_key,
+    brillo::http::Transport* transport) {
+  HostPool& pool = pools_[pool_key];
+  auto it = std::find_if(pool.idle.begin(), pool.idle.end(),
+                         [transport](const PooledTransport& idle) {
+                           return idle.transport.get() == transport;
+                         });
+  CHECK(it != pool.idle.end());
+  pool.idle.erase(it);
+  pool.stats.connections_evicted++;
 }
 
 }  // namespace buffet
@@ -15,33 +15,322 @@
 #ifndef BUFFET_HTTP_TRANSPORT_CLIENT_H_
 #define BUFFET_HTTP_TRANSPORT_CLIENT_H_
 
+#include <deque>
+#include <map>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include <base/macros.h>
+#include <base/memory/weak_ptr.h>
+#include <base/strings/string_piece.h>
+#include <base/time/time.h>
+#include <brillo/message_loops/message_loop.h>
 #include <weave/provider/http_client.h>
 
+#include "buffet/prioritized_task_runner.h"
+
 namespace brillo {
 namespace http {
+class Response;
 class Transport;
 }
 }
 
 namespace buffet {
 
+class DnsCache;
+struct ResolveResult;
+
+// Response of HttpTransportClient. The body is read on first use into a
+// buffer that all accessors share, and inflated if the server gzip-encoded
+// it.
+class HttpTransportResponse final
+    : public weave::provider::HttpClient::Response {
+ public:
+  explicit HttpTransportResponse(
+      std::unique_ptr<brillo::http::Response> response);
+  ~HttpTransportResponse() override;
+
+  int GetStatusCode() const override;
+  std::string GetContentType() const override;
+  // Returns a copy of the body, as HttpClient::Response requires. GetBody()
+  // and GetSharedBody() do not copy.
+  std::string GetData() const override;
+
+  // Valid as long as this response.
+  base::StringPiece GetBody() const;
+  std::shared_ptr<const std::string> GetSharedBody() const;
+
+  bool IsGzipEncoded() const;
+  // Reads the body unless that happened already. Returns false if it could
+  // not be inflated, in which case the body is empty.
+  bool LoadBody() const;
+  // Size of the body as the server sent it. Valid after LoadBody().
+  size_t GetEncodedBodySize() const { return encoded_body_size_; }
+
+ private:
+  std::unique_ptr<brillo::http::Response> response_;
+  mutable std::shared_ptr<const std::string> body_;
+  mutable size_t encoded_body_size_{0};
+  mutable bool body_valid_{true};
+
+  DISALLOW_COPY_AND_ASSIGN(HttpTransportResponse);
+};
+
+// Sends libweave's HTTP requests. Requests to the same host and port share a
+// pool of transports that run one request at a time, so that the TCP and TLS
+// connection of a transport is kept alive and reused by the next request.
+//
+// Requests wait in one FIFO queue per TaskPriority until their pool has a
+// transport for them and fewer than a limit of requests are in flight. The
+// most important request that can start goes first, so a backlog of state
+// patches does not hold up command results or OAuth token refreshes, and a
+// full pool does not hold up requests to other hosts. A request gets the
+// priority of the current ScopedTaskPriority if that is not kNormal, otherwise
+// the priority of the first priority rule its URL matches.
+//
+// Requests time out after a fixed time, which grows on hosts with slow round
+// trips, estimated as TCP derives its retransmission timeout (RFC 6298).
+// After several transport failures in a row, requests to the host, retries
+// included, fail right away for a while instead of waiting for their
+// timeouts.
 class HttpTransportClient : public weave::provider::HttpClient {
  public:
-  HttpTransportClient();
+  struct PoolOptions {
+    // Transports per host, busy or idle. Further requests wait for one.
+    size_t max_connections_per_host{4};
+    // Idle transports are closed after this long.
+    base::TimeDelta idle_timeout{base::TimeDelta::FromSeconds(60)};
+  };
+
+  struct PoolStats {
+    uint64_t requests{0};
+    uint64_t connections_opened{0};
+    uint64_t connections_reused{0};
+    uint64_t connections_evicted{0};
+    // Requests that waited for a transport of a full pool.
+    uint64_t requests_queued{0};
+    size_t busy_connections{0};
+    size_t idle_connections{0};
+    uint64_t retries{0};
+    // Times the circuit breaker opened, and requests it failed right away.
+    uint64_t circuit_breaker_trips{0};
+    uint64_t requests_rejected{0};
+    base::TimeDelta smoothed_rtt;
+    base::TimeDelta request_timeout;
+    // Small requests are cancelled once they took this long, zero until
+    // there is a round trip time estimate. See GetResponseTimeout().
+    base::TimeDelta response_timeout;
+    uint64_t requests_timed_out{0};
+  };
+
+  // Retries are off unless |max_retries| is set. Only GET and PUT requests
+  // are retried, after transport errors and 502, 503 and 504 responses.
+  struct RetryOptions {
+    int max_retries{0};
+    // Doubles with every retry, up to |max_backoff|. Each delay is picked
+    // at random from the upper half of the backoff.
+    base::TimeDelta initial_backoff{base::TimeDelta::FromSeconds(1)};
+    base::TimeDelta max_backoff{base::TimeDelta::FromSeconds(30)};
+  };
+
+  struct PriorityStats {
+    uint64_t requests{0};
+    // Requests that waited because too many were in flight.
+    uint64_t requests_queued{0};
+    base::TimeDelta total_queue_time;
+    base::TimeDelta max_queue_time;
+  };
+
+  struct CompressionOptions {
+    // Whether request bodies are gzip-encoded. Responses are always accepted
+    // gzip-encoded.
+    bool compress_requests{true};
+    // Smaller request bodies are sent as they are.
+    size_t min_request_size{1024};
+  };
+
+  struct CompressionStats {
+    uint64_t requests_compressed{0};
+    uint64_t request_bytes_saved{0};
+    uint64_t responses_decompressed{0};
+    uint64_t response_bytes_saved{0};
+  };
+
+  using TransportFactory =
+      base::Callback<std::shared_ptr<brillo::http::Transport>()>;
+
+  // Host names are resolved through |dns_cache|, if it is not null. A new
+  // transport is pinned to the addresses of its host, and transports opened
+  // before the last flush of |dns_cache| are not reused.
+  explicit HttpTransportClient(DnsCache* dns_cache);
 
   ~HttpTransportClient() override;
 
+  void SetPoolOptions(const PoolOptions& options) { pool_options_ = options; }
+
+  void SetCompressionOptions(const CompressionOptions& options) {
+    compression_options_ = options;
+  }
+
+  void SetRetryOptions(const RetryOptions& options) {
+    retry_options_ = options;
+  }
+
+  void SetMaxRequestsInFlight(size_t max_requests) {
+    max_requests_in_flight_ = max_requests;
+  }
+
+  // Sends requests whose URL contains |url_part| with |priority|. Rules added
+  // first win.
+  void AddPriorityRule(const std::string& url_part, TaskPriority priority);
+
+  // Creates transports with |factory| instead of the default one, e.g. fakes.
+  void SetTransportFactory(const TransportFactory& factory);
+
+  // Pool statistics by "host:port".
+  std::map<std::string, PoolStats> GetPoolStats() const;
+
+  const PriorityStats& GetPriorityStats(TaskPriority priority) const;
+
+  const CompressionStats& GetCompressionStats() const {
+    return compression_stats_;
+  }
+
   void SendRequest(Method method,
                    const std::string& url,
                    const Headers& headers,
                    const std::string& data,
                    const SendRequestCallback& callback) override;
 
+  // Same as above, but moves |data| into the request instead of copying it.
+  void SendRequest(Method method,
+                   const std::string& url,
+                   const Headers& headers,
+                   std::string&& data,
+                   const SendRequestCallback& callback);
+
  private:
-  std::shared_ptr<brillo::http::Transport> transport_;
+  struct PendingRequest {
+    Method method;
+    std::string url;
+    Headers headers;
+    std::string data;
+    SendRequestCallback callback;
+    // Key of the pool that sends the request.
+    std::string pool_key;
+    std::string host;
+    uint16_t port;
+    TaskPriority priority;
+    base::TimeTicks queued_time;
+    base::TimeTicks start_time;
+    // Retries made so far.
+    int retries;
+    // Whether |data| is gzip-encoded already.
+    bool compressed;
+    // ID of the request on its transport, and the task that cancels it
+    // after the response timeout.
+    brillo::http::RequestID request_id;
+    brillo::MessageLoop::TaskId timeout_task;
+  };
+
+  struct PooledTransport {
+    std::shared_ptr<brillo::http::Transport> transport;
+    // DnsCache::GetGeneration() when the host of the transport was pinned.
+    uint64_t dns_generation{0};
+    // Closes the transport once it was idle for too long.
+    brillo::MessageLoop::TaskId evict_task{brillo::MessageLoop::kTaskIdNull};
+  };
+
+  struct HostPool {
+    std::vector<PooledTransport> busy;
+    // Most recently used last.
+    std::vector<PooledTransport> idle;
+    PoolStats stats;
+    // RFC 6298 round trip time estimate.
+    base::TimeDelta smoothed_rtt;
+    base::TimeDelta rtt_variation;
+    int consecutive_failures{0};
+    // Requests fail right away until then.
+    base::TimeTicks circuit_open_until;
+  };
+
+  TaskPriority GetRequestPriority(const std::string& url) const;
+  // Queues |request| for DispatchRequests(), or fails it while the circuit
+  // breaker of its host is open.
+  void EnqueueRequest(std::unique_ptr<PendingRequest> request);
+  // Starts queued requests, most important first, while fewer than
+  // |max_requests_in_flight_| are in flight. Requests whose pool is full stay
+  // queued.
+  void DispatchRequests();
+  // Whether the pool of |pool_key| has an idle transport or room for a new
+  // one.
+  bool HasFreeTransport(const std::string& pool_key) const;
+  // Lets the next queued request start.
+  void FinishRequest();
+  // Gzip-encodes the body of |request| if that is worth it. Returns whether
+  // it did.
+  bool CompressRequestBody(PendingRequest* request);
+  // Sends |request| on an idle or new transport of its pool, which must not
+  // be full.
+  void AcquireTransport(std::unique_ptr<PendingRequest> request);
+  // Sends |request| on a new transport, once its host is resolved.
+  void OpenTransport(std::unique_ptr<PendingRequest> request);
+  void OnHostResolved(std::unique_ptr<PendingRequest> request,
+                      const std::shared_ptr<brillo::http::Transport>& transport,
+                      const ResolveResult& result);
+  uint64_t GetDnsGeneration() const;
+  void StartRequest(std::unique_ptr<PendingRequest> request,
+                    const std::shared_ptr<brillo::http::Transport>& transport);
+  void OnResponse(const std::shared_ptr<PendingRequest>& request,
+                  brillo::http::Transport* transport,
+                  int request_id,
+                  std::unique_ptr<brillo::http::Response> response);
+  void OnRequestError(const std::shared_ptr<PendingRequest>& request,
+                      brillo::http::Transport* transport,
+                      int request_id,
+                      const brillo::Error* error);
+  void UpdateRoundTripTime(HostPool* pool, base::TimeDelta rtt);
+  base::TimeDelta GetRequestTimeout(const HostPool& pool) const;
+  base::TimeDelta GetResponseTimeout(const HostPool& pool) const;
+  // Cancels |request| on |transport| and fails it.
+  void OnResponseTimeout(const std::shared_ptr<PendingRequest>& request,
+                         brillo::http::Transport* transport);
+  bool CanRetry(const PendingRequest& request) const;
+  // Sends a copy of |request| again after a backoff delay.
+  void RetryRequest(const PendingRequest& request);
+  // Keeps |transport| idle for the next request of its pool, unless it is
+  // stale.
+  void ReleaseTransport(const std::string& pool_key,
+                        brillo::http::Transport* transport);
+  // Closes the busy |transport|.
+  void DropTransport(const std::string& pool_key,
+                     brillo::http::Transport* transport);
+  void EvictIdleTransport(const std::string& pool_key,
+                          brillo::http::Transport* transport);
+
+  TransportFactory transport_factory_;
+  DnsCache* dns_cache_{nullptr};
+  PoolOptions pool_options_;
+  CompressionOptions compression_options_;
+  CompressionStats compression_stats_;
+
+  static const size_t kPriorityCount = 3;
+
+  size_t max_requests_in_flight_{8};
+  size_t requests_in_flight_{0};
+  std::vector<std::pair<std::string, TaskPriority>> priority_rules_;
+  std::deque<std::unique_ptr<PendingRequest>> request_queues_[kPriorityCount];
+  PriorityStats priority_stats_[kPriorityCount];
+  // Requests started from other queues since a request of each queue last
+  // started, counted while the queue had a request that could start.
+  size_t skipped_dispatches_[kPriorityCount] = {};
+  bool dispatching_{false};
+  std::map<std::string, HostPool> pools_;
+
+  base::WeakPtrFactory<HttpTransportClient> weak_ptr_factory_{this};
   DISALLOW_COPY_AND_ASSIGN(HttpTransportClient);
 };
 
@@ -0,0 +1,114 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "buffet/http_transport_client.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <base/bind.h>
+#include <brillo/bind_lambda.h>
+#include <brillo/http/mock_connection.h>
+#include <brillo/http/mock_transport.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <brillo/streams/stream.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "buffet/allocation_counter.h"
+
+namespace buffet {
+
+using ::testing::_;
+using ::testing::Invoke;
+using ::testing::NiceMock;
+using ::testing::Return;
+
+namespace {
+
+const char kUrl[] = "https://www.example.com/state";
+
+// Request bodies of state patches and command results can be large.
+const size_t kBodySize = 1024 * 1024;
+
+}  // namespace
+
+// Runs in weaved_allocation_test, which counts every operator new.
+class HttpTransportClientAllocationTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    loop_.SetAsCurrent();
+    client_.SetTransportFactory(
+        base::Bind(&HttpTransportClientAllocationTest::CreateTransport,
+                   base::Unretained(this)));
+    // Compression allocates buffers of the body size on purpose.
+    HttpTransportClient::CompressionOptions options;
+    options.compress_requests = false;
+    client_.SetCompressionOptions(options);
+  }
+
+  // Creates a transport whose requests never finish.
+  std::shared_ptr<brillo::http::Transport> CreateTransport() {
+    auto transport = std::make_shared<NiceMock<brillo::http::MockTransport>>();
+    auto connection =
+        std::make_shared<NiceMock<brillo::http::MockConnection>>(transport);
+    connections_.push_back(connection);
+    std::weak_ptr<brillo::http::Connection> weak_connection = connection;
+    ON_CALL(*transport, CreateConnection(_, _, _, _, _, _))
+        .WillByDefault(Invoke([weak_connection](
+            const std::string& url, const std::string& method,
+            const brillo::http::HeaderList& headers,
+            const std::string& user_agent, const std::string& referer,
+            brillo::ErrorPtr* error) { return weak_connection.lock(); }));
+    ON_CALL(*connection, SendHeaders(_, _)).WillByDefault(Return(true));
+    ON_CALL(*connection, MockSetRequestData(_, _))
+        .WillByDefault(Invoke([this](brillo::Stream* stream,
+                                     brillo::ErrorPtr* error) {
+          sent_body_size_ = stream->GetRemainingSize();
+          return true;
+        }));
+    ON_CALL(*connection, FinishRequestAsync(_, _)).WillByDefault(Return(1));
+    return transport;
+  }
+
+ protected:
+  brillo::FakeMessageLoop loop_{nullptr};
+  std::vector<std::shared_ptr<brillo::http::Connection>> connections_;
+  HttpTransportClient client_{nullptr};
+  uint64_t sent_body_size_{0};
+};
+
+TEST_F(HttpTransportClientAllocationTest, MovesBody) {
+  std::string body(kBodySize, 'x');
+  AllocationCounter counter{kBodySize};
+  client_.SendRequest(HttpTransportClient::Method::kPost, kUrl, {},
+                      std::move(body),
+                      HttpTransportClient::SendRequestCallback{});
+  EXPECT_EQ(0u, counter.allocations());
+  EXPECT_EQ(kBodySize, sent_body_size_);
+}
+
+TEST_F(HttpTransportClientAllocationTest, CopiesConstBody) {
+  const std::string body(kBodySize, 'x');
+  AllocationCounter counter{kBodySize};
+  client_.SendRequest(HttpTransportClient::Method::kPost, kUrl, {}, body,
+                      HttpTransportClient::SendRequestCallback{});
+  EXPECT_EQ(1u, counter.allocations());
+  EXPECT_EQ(kBodySize, body.size());
+  EXPECT_EQ(kBodySize, sent_body_size_);
+}
+
+}  // namespace buffet
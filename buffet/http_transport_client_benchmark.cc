@@ -0,0 +1,114 @@
+// Copyright 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <inttypes.h>
+
+#include <algorithm>
+#include <string>
+
+#include <base/bind.h>
+#include <base/logging.h>
+#include <base/message_loop/message_loop.h>
+#include <base/strings/stringprintf.h>
+#include <benchmark/benchmark.h>
+#include <brillo/bind_lambda.h>
+#include <brillo/http/http_request.h>
+#include <brillo/http/http_transport_fake.h>
+#include <brillo/message_loops/base_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
+#include <brillo/mime_utils.h>
+
+#include "buffet/allocation_counter.h"
+#include "buffet/http_transport_client.h"
+
+namespace buffet {
+
+namespace {
+
+const char kUrl[] = "https://www.example.com/commands/queue";
+
+// Device drafts and command queues reach this size.
+const size_t kResponseSize = 1024 * 1024;
+
+using weave::provider::HttpClient;
+
+// Fetches a response of kResponseSize bytes from a fake transport in every
+// iteration, and hands its body to |consume|. The label reports heap
+// allocations per iteration.
+void FetchResponses(
+    benchmark::State& state,
+    const base::Callback<size_t(const HttpTransportResponse&)>& consume) {
+  base::MessageLoopForIO base_loop;
+  brillo::BaseMessageLoop brillo_loop{&base_loop};
+  brillo_loop.SetAsCurrent();
+
+  std::shared_ptr<brillo::http::fake::Transport> transport{
+      new brillo::http::fake::Transport};
+  transport->AddSimpleReplyHandler(
+      kUrl, brillo::http::request_type::kGet, brillo::http::status_code::Ok,
+      std::string(kResponseSize, 'x'), brillo::mime::application::kJson);
+  HttpTransportClient client{nullptr};
+  client.SetTransportFactory(
+      base::Bind([transport]() -> std::shared_ptr<brillo::http::Transport> {
+        return transport;
+      }));
+
+  AllocationCounter counter;
+  while (state.KeepRunning()) {
+    std::unique_ptr<HttpClient::Response> response;
+    client.SendRequest(
+        HttpClient::Method::kGet, kUrl, {}, {},
+        base::Bind(
+            [&response](std::unique_ptr<HttpClient::Response> value,
+                        weave::ErrorPtr error) {
+              CHECK(!error) << error->GetMessage();
+              response = std::move(value);
+            }));
+    brillo::MessageLoopRunUntil(
+        &brillo_loop, base::TimeDelta::FromSeconds(10),
+        base::Bind([&response]() { return !!response; }));
+    CHECK(response);
+    CHECK_EQ(kResponseSize,
+             consume.Run(*static_cast<HttpTransportResponse*>(response.get())));
+  }
+  uint64_t iterations = std::max<size_t>(state.iterations(), 1);
+  uint64_t allocations = counter.allocations() / iterations;
+  uint64_t allocated_bytes = counter.allocated_bytes() / iterations;
+
+  state.SetBytesProcessed(state.iterations() * kResponseSize);
+  state.SetLabel(base::StringPrintf("%" PRIu64 " allocations, %" PRIu64
+                                    " KiB allocated per response",
+                                    allocations, allocated_bytes / 1024));
+}
+
+}  // namespace
+
+// What libweave does: one copy of the body through GetData().
+void BM_HttpResponseGetData(benchmark::State& state) {
+  FetchResponses(state, base::Bind([](const HttpTransportResponse& response) {
+                   return response.GetData().size();
+                 }));
+}
+BENCHMARK(BM_HttpResponseGetData);
+
+// No copy through GetBody().
+void BM_HttpResponseGetBody(benchmark::State& state) {
+  FetchResponses(state, base::Bind([](const HttpTransportResponse& response) {
+                   return response.GetBody().size();
+                 }));
+}
+BENCHMARK(BM_HttpResponseGetBody);
+
+}  // namespace buffet
@@ -0,0 +1,487 @@
+// Copyright 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "buffet/http_transport_client.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <base/bind.h>
+#include <brillo/bind_lambda.h>
+#include <brillo/http/http_response.h>
+#include <brillo/http/http_transport_fake.h>
+#include <brillo/http/mock_connection.h>
+#include <brillo/http/mock_transport.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <brillo/mime_utils.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "buffet/compression.h"
+
+namespace buffet {
+
+using ::testing::_;
+using ::testing::Invoke;
+using ::testing::NiceMock;
+using ::testing::Return;
+
+namespace {
+
+const char kUrl[] = "https://www.example.com/state";
+const char kPoolKey[] = "www.example.com:443";
+
+}  // namespace
+
+class HttpTransportClientTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    loop_.SetAsCurrent();
+    client_.SetTransportFactory(base::Bind(
+        &HttpTransportClientTest::CreateTransport, base::Unretained(this)));
+  }
+
+  // Creates a transport whose requests finish on CompleteRequest().
+  std::shared_ptr<brillo::http::Transport> CreateTransport() {
+    auto transport = std::make_shared<NiceMock<brillo::http::MockTransport>>();
+    auto connection =
+        std::make_shared<NiceMock<brillo::http::MockConnection>>(transport);
+    connections_.push_back(connection);
+    transports_.push_back(transport.get());
+    std::weak_ptr<brillo::http::Connection> weak_connection = connection;
+    // The connection refers to its transport, so only the test holds it.
+    ON_CALL(*transport, CreateConnection(_, _, _, _, _, _))
+        .WillByDefault(Invoke([this, weak_connection](
+            const std::string& url, const std::string& method,
+            const brillo::http::HeaderList& headers,
+            const std::string& user_agent, const std::string& referer,
+            brillo::ErrorPtr* error) {
+          started_urls_.push_back(url);
+          return weak_connection.lock();
+        }));
+    ON_CALL(*connection, SendHeaders(_, _)).WillByDefault(Return(true));
+    ON_CALL(*connection, FinishRequestAsync(_, _))
+        .WillByDefault(Invoke([this, weak_connection](
+            const brillo::http::SuccessCallback& success_callback,
+            const brillo::http::ErrorCallback& error_callback) {
+          pending_requests_.push_back(PendingRequest{
+              weak_connection.lock(), success_callback, error_callback});
+          return 1;
+        }));
+    return transport;
+  }
+
+  void SendRequest(const std::string& url = kUrl,
+                   HttpTransportClient::Method method =
+                       HttpTransportClient::Method::kGet) {
+    client_.SendRequest(method, url, {}, "",
+                        base::Bind(&HttpTransportClientTest::OnResponse,
+                                   base::Unretained(this)));
+  }
+
+  void OnResponse(std::unique_ptr<weave::provider::HttpClient::Response>,
+                  weave::ErrorPtr error) {
+    if (error)
+      errors_++;
+    else
+      responses_++;
+  }
+
+  // Finishes the oldest request that is still pending.
+  void CompleteRequest() {
+    ASSERT_FALSE(pending_requests_.empty());
+    PendingRequest pending = pending_requests_.front();
+    pending_requests_.erase(pending_requests_.begin());
+    pending.success_callback.Run(
+        1, std::unique_ptr<brillo::http::Response>{
+               new brillo::http::Response{pending.connection}});
+  }
+
+  // Fails the oldest request that is still pending with a transport error.
+  void FailRequest() {
+    ASSERT_FALSE(pending_requests_.empty());
+    PendingRequest pending = pending_requests_.front();
+    pending_requests_.erase(pending_requests_.begin());
+    brillo::ErrorPtr error;
+    brillo::Error::AddTo(&error, FROM_HERE, "curl_easy_error", "7",
+                         "Couldn't connect to server");
+    pending.error_callback.Run(1, error.get());
+  }
+
+  HttpTransportClient::PoolStats GetPoolStats() {
+    return client_.GetPoolStats()[kPoolKey];
+  }
+
+ protected:
+  brillo::FakeMessageLoop loop_{nullptr};
+  std::vector<std::shared_ptr<brillo::http::Connection>> connections_;
+  // Owned by |client_|.
+  std::vector<brillo::http::MockTransport*> transports_;
+  std::vector<std::string> started_urls_;
+  struct PendingRequest {
+    std::shared_ptr<brillo::http::Connection> connection;
+    brillo::http::SuccessCallback success_callback;
+    brillo::http::ErrorCallback error_callback;
+  };
+  std::vector<PendingRequest> pending_requests_;
+  HttpTransportClient client_{nullptr};
+  int responses_{0};
+  int errors_{0};
+};
+
+TEST_F(HttpTransportClientTest, ReusesIdleConnection) {
+  SendRequest();
+  CompleteRequest();
+  SendRequest();
+  CompleteRequest();
+  EXPECT_EQ(2, responses_);
+  EXPECT_EQ(1u, connections_.size());
+  HttpTransportClient::PoolStats stats = GetPoolStats();
+  EXPECT_EQ(2u, stats.requests);
+  EXPECT_EQ(1u, stats.connections_opened);
+  EXPECT_EQ(1u, stats.connections_reused);
+  EXPECT_EQ(0u, stats.busy_connections);
+  EXPECT_EQ(1u, stats.idle_connections);
+}
+
+TEST_F(HttpTransportClientTest, QueuesRequestsOfFullPool) {
+  HttpTransportClient::PoolOptions options;
+  options.max_connections_per_host = 1;
+  client_.SetPoolOptions(options);
+  SendRequest();
+  SendRequest();
+  EXPECT_EQ(1u, pending_requests_.size());
+  EXPECT_EQ(1u, GetPoolStats().requests_queued);
+
+  // The queued request goes out on the connection of the first one.
+  CompleteRequest();
+  EXPECT_EQ(1u, pending_requests_.size());
+  CompleteRequest();
+  EXPECT_EQ(2, responses_);
+  EXPECT_EQ(1u, connections_.size());
+  EXPECT_EQ(1u, GetPoolStats().connections_reused);
+}
+
+TEST_F(HttpTransportClientTest, OpensConnectionsUpToLimit) {
+  HttpTransportClient::PoolOptions options;
+  options.max_connections_per_host = 2;
+  client_.SetPoolOptions(options);
+  SendRequest();
+  SendRequest();
+  SendRequest();
+  EXPECT_EQ(2u, connections_.size());
+  HttpTransportClient::PoolStats stats = GetPoolStats();
+  EXPECT_EQ(2u, stats.connections_opened);
+  EXPECT_EQ(2u, stats.busy_connections);
+  EXPECT_EQ(1u, stats.requests_queued);
+}
+
+TEST_F(HttpTransportClientTest, EvictsIdleConnections) {
+  SendRequest();
+  CompleteRequest();
+  EXPECT_EQ(1u, GetPoolStats().idle_connections);
+  // Runs the eviction once the idle timeout passed.
+  EXPECT_TRUE(loop_.RunOnce(true));
+  HttpTransportClient::PoolStats stats = GetPoolStats();
+  EXPECT_EQ(0u, stats.idle_connections);
+  EXPECT_EQ(1u, stats.connections_evicted);
+
+  SendRequest();
+  EXPECT_EQ(2u, GetPoolStats().connections_opened);
+}
+
+TEST_F(HttpTransportClientTest, LimitsRequestsInFlight) {
+  client_.SetMaxRequestsInFlight(1);
+  SendRequest("https://www.example.com/devices/1/patchState");
+  SendRequest("https://www.example.com/devices/1");
+  SendRequest("https://accounts.example.com/o/oauth2/token");
+  ASSERT_EQ(1u, started_urls_.size());
+
+  // The token refresh overtakes the request that waited longer.
+  CompleteRequest();
+  ASSERT_EQ(2u, started_urls_.size());
+  EXPECT_EQ("https://accounts.example.com/o/oauth2/token", started_urls_[1]);
+  CompleteRequest();
+  ASSERT_EQ(3u, started_urls_.size());
+  EXPECT_EQ("https://www.example.com/devices/1", started_urls_[2]);
+  CompleteRequest();
+  EXPECT_EQ(3, responses_);
+
+  const HttpTransportClient::PriorityStats& background =
+      client_.GetPriorityStats(TaskPriority::kBackground);
+  EXPECT_EQ(1u, background.requests);
+  EXPECT_EQ(0u, background.requests_queued);
+  EXPECT_EQ(1u,
+            client_.GetPriorityStats(TaskPriority::kNormal).requests_queued);
+  EXPECT_EQ(
+      1u, client_.GetPriorityStats(TaskPriority::kInteractive).requests_queued);
+}
+
+TEST_F(HttpTransportClientTest, FullPoolDoesNotHoldUpOtherRequests) {
+  // With the default limits, 8 requests in flight and 4 per host.
+  for (int i = 0; i < 8; i++)
+    SendRequest("https://www.example.com/devices/1/patchState");
+  EXPECT_EQ(4u, started_urls_.size());
+  EXPECT_EQ(4u, GetPoolStats().requests_queued);
+
+  // The queued state patches hold no slots, so the token refresh starts on a
+  // transport of its own host.
+  SendRequest("https://accounts.example.com/o/oauth2/token");
+  ASSERT_EQ(5u, started_urls_.size());
+  EXPECT_EQ("https://accounts.example.com/o/oauth2/token", started_urls_[4]);
+
+  // A command result overtakes the state patches queued for its host.
+  SendRequest("https://www.example.com/commands/1");
+  EXPECT_EQ(5u, started_urls_.size());
+  CompleteRequest();
+  ASSERT_EQ(6u, started_urls_.size());
+  EXPECT_EQ("https://www.example.com/commands/1", started_urls_[5]);
+  CompleteRequest();
+  ASSERT_EQ(7u, started_urls_.size());
+  EXPECT_EQ("https://www.example.com/devices/1/patchState", started_urls_[6]);
+  EXPECT_EQ(4u, GetPoolStats().busy_connections);
+}
+
+TEST_F(HttpTransportClientTest, EveryWaitingQueueIsServed) {
+  client_.SetMaxRequestsInFlight(1);
+  SendRequest("https://www.example.com/commands/0");
+  SendRequest("https://www.example.com/devices/1");
+  SendRequest("https://www.example.com/devices/1/patchState");
+  for (int i = 1; i <= 20; i++)
+    SendRequest("https://www.example.com/commands/" + std::to_string(i));
+  for (int i = 0; i < 18; i++)
+    CompleteRequest();
+
+  // Both less important queues get a turn after 16 command updates, the
+  // normal one first.
+  ASSERT_EQ(19u, started_urls_.size());
+  EXPECT_EQ("https://www.example.com/commands/16", started_urls_[16]);
+  EXPECT_EQ("https://www.example.com/devices/1", started_urls_[17]);
+  EXPECT_EQ("https://www.example.com/devices/1/patchState", started_urls_[18]);
+}
+
+TEST_F(HttpTransportClientTest, ExplicitPriority) {
+  client_.SetMaxRequestsInFlight(1);
+  SendRequest();
+  SendRequest("https://accounts.example.com/o/oauth2/token");
+  {
+    // Overrides the rule for command updates.
+    ScopedTaskPriority scoped_priority{TaskPriority::kBackground};
+    SendRequest("https://www.example.com/commands/1");
+  }
+  EXPECT_EQ(1u, client_.GetPriorityStats(TaskPriority::kBackground).requests);
+  EXPECT_EQ(1u, client_.GetPriorityStats(TaskPriority::kInteractive).requests);
+  EXPECT_EQ(1u, client_.GetPriorityStats(TaskPriority::kNormal).requests);
+}
+
+TEST_F(HttpTransportClientTest, AdaptsTimeoutToRoundTripTime) {
+  SendRequest();
+  EXPECT_EQ(base::TimeDelta::FromSeconds(30), GetPoolStats().request_timeout);
+  CompleteRequest();
+  // A fast round trip does not shorten the timeout of large transfers.
+  EXPECT_EQ(base::TimeDelta::FromSeconds(30), GetPoolStats().request_timeout);
+  EXPECT_FALSE(GetPoolStats().smoothed_rtt.is_zero());
+  // Small requests time out sooner.
+  EXPECT_EQ(base::TimeDelta::FromSeconds(5), GetPoolStats().response_timeout);
+}
+
+TEST_F(HttpTransportClientTest, CancelsStalledSmallRequest) {
+  SendRequest();
+  // There is no round trip time estimate yet.
+  EXPECT_FALSE(loop_.RunOnce(true));
+  CompleteRequest();
+  SendRequest();
+  EXPECT_CALL(*transports_.back(), CancelRequest(1)).WillOnce(Return(true));
+  // Runs the response timeout, which comes before the idle timeout.
+  EXPECT_TRUE(loop_.RunOnce(true));
+  EXPECT_EQ(1, responses_);
+  EXPECT_EQ(1, errors_);
+  HttpTransportClient::PoolStats stats = GetPoolStats();
+  EXPECT_EQ(1u, stats.requests_timed_out);
+  EXPECT_EQ(0u, stats.busy_connections);
+}
+
+TEST_F(HttpTransportClientTest, DoesNotCancelLargeRequest) {
+  HttpTransportClient::CompressionOptions options;
+  options.compress_requests = false;
+  client_.SetCompressionOptions(options);
+  SendRequest();
+  CompleteRequest();
+  client_.SendRequest(HttpTransportClient::Method::kPost, kUrl, {},
+                      std::string(64 * 1024, 'x'),
+                      HttpTransportClient::SendRequestCallback{});
+  EXPECT_CALL(*transports_.back(), CancelRequest(_)).Times(0);
+  EXPECT_FALSE(loop_.RunOnce(true));
+  EXPECT_EQ(0u, GetPoolStats().requests_timed_out);
+}
+
+TEST_F(HttpTransportClientTest, RetriesIdempotentRequests) {
+  HttpTransportClient::RetryOptions options;
+  options.max_retries = 1;
+  client_.SetRetryOptions(options);
+  SendRequest();
+  FailRequest();
+  EXPECT_EQ(0, errors_);
+  // Runs the retry after its backoff.
+  EXPECT_TRUE(loop_.RunOnce(true));
+  ASSERT_EQ(2u, started_urls_.size());
+  FailRequest();
+  EXPECT_EQ(1, errors_);
+  EXPECT_EQ(1u, GetPoolStats().retries);
+}
+
+TEST_F(HttpTransportClientTest, DoesNotRetryPost) {
+  HttpTransportClient::RetryOptions options;
+  options.max_retries = 1;
+  client_.SetRetryOptions(options);
+  SendRequest(kUrl, HttpTransportClient::Method::kPost);
+  FailRequest();
+  EXPECT_EQ(1, errors_);
+  EXPECT_EQ(0u, GetPoolStats().retries);
+}
+
+TEST_F(HttpTransportClientTest, FailsFastWhileHostIsUnreachable) {
+  for (int i = 0; i < 5; i++) {
+    SendRequest();
+    FailRequest();
+  }
+  EXPECT_EQ(5, errors_);
+  EXPECT_EQ(1u, GetPoolStats().circuit_breaker_trips);
+
+  SendRequest();
+  EXPECT_TRUE(pending_requests_.empty());
+  EXPECT_TRUE(loop_.RunOnce(false));
+  EXPECT_EQ(6, errors_);
+  EXPECT_EQ(1u, GetPoolStats().requests_rejected);
+}
+
+TEST_F(HttpTransportClientTest, DoesNotRetryWhileHostIsUnreachable) {
+  HttpTransportClient::RetryOptions options;
+  options.max_retries = 1;
+  client_.SetRetryOptions(options);
+  SendRequest();
+  FailRequest();
+  // The circuit breaker opens while the retry waits for its backoff.
+  for (int i = 0; i < 4; i++) {
+    SendRequest(kUrl, HttpTransportClient::Method::kPost);
+    FailRequest();
+  }
+  EXPECT_EQ(4, errors_);
+  EXPECT_EQ(1u, GetPoolStats().circuit_breaker_trips);
+
+  EXPECT_TRUE(loop_.RunOnce(true));
+  EXPECT_TRUE(pending_requests_.empty());
+  EXPECT_TRUE(loop_.RunOnce(false));
+  EXPECT_EQ(5, errors_);
+  EXPECT_EQ(5u, started_urls_.size());
+  EXPECT_EQ(1u, GetPoolStats().requests_rejected);
+}
+
+// Runs requests against brillo's fake HTTP server.
+class HttpTransportClientCompressionTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    loop_.SetAsCurrent();
+    client_.SetTransportFactory(
+        base::Bind([](std::shared_ptr<brillo::http::fake::Transport> transport)
+                       -> std::shared_ptr<brillo::http::Transport> {
+                     return transport;
+                   },
+                   transport_));
+    transport_->AddHandler(
+        kUrl, brillo::http::request_type::kPost,
+        base::Bind(&HttpTransportClientCompressionTest::HandleRequest,
+                   base::Unretained(this)));
+  }
+
+  // Echoes the request body, gzip-encoded if the client accepts that.
+  void HandleRequest(const brillo::http::fake::ServerRequest& request,
+                     brillo::http::fake::ServerResponse* response) {
+    content_encoding_ = request.GetHeader("Content-Encoding");
+    accept_encoding_ = request.GetHeader("Accept-Encoding");
+    std::string body{request.GetData().begin(), request.GetData().end()};
+    if (content_encoding_ == "gzip") {
+      std::string inflated;
+      ASSERT_TRUE(compression::Decompress(body, compression::Format::kGzip,
+                                          body.size() * 1024, &inflated));
+      body.swap(inflated);
+    }
+    received_body_ = body;
+    if (accept_encoding_ == "gzip") {
+      std::string compressed;
+      ASSERT_TRUE(compression::Compress(body, compression::Format::kGzip,
+                                        &compressed));
+      body.swap(compressed);
+      response->AddHeaders({{"Content-Encoding", "gzip"}});
+    }
+    response->Reply(brillo::http::status_code::Ok, body.data(), body.size(),
+                    brillo::mime::application::kJson);
+  }
+
+  // Sends |body| and returns the body of the response.
+  std::string Send(const std::string& body) {
+    std::unique_ptr<weave::provider::HttpClient::Response> response;
+    client_.SendRequest(
+        HttpTransportClient::Method::kPost, kUrl, {}, body,
+        base::Bind(
+            [&response](
+                std::unique_ptr<weave::provider::HttpClient::Response> value,
+                weave::ErrorPtr error) {
+              EXPECT_EQ(nullptr, error);
+              response = std::move(value);
+            }));
+    while (!response && loop_.RunOnce(false)) {
+    }
+    EXPECT_NE(nullptr, response);
+    return response ? response->GetData() : std::string{};
+  }
+
+ protected:
+  brillo::FakeMessageLoop loop_{nullptr};
+  std::shared_ptr<brillo::http::fake::Transport> transport_{
+      std::make_shared<brillo::http::fake::Transport>()};
+  HttpTransportClient client_{nullptr};
+  std::string content_encoding_;
+  std::string accept_encoding_;
+  std::string received_body_;
+};
+
+TEST_F(HttpTransportClientCompressionTest, CompressesLargeRequests) {
+  std::string body;
+  while (body.size() < 4096)
+    body += "{\"temperature\":21.5,\"humidity\":40},";
+  EXPECT_EQ(body, Send(body));
+  EXPECT_EQ("gzip", content_encoding_);
+  EXPECT_EQ("gzip", accept_encoding_);
+  EXPECT_EQ(body, received_body_);
+
+  const HttpTransportClient::CompressionStats& stats =
+      client_.GetCompressionStats();
+  EXPECT_EQ(1u, stats.requests_compressed);
+  EXPECT_LT(0u, stats.request_bytes_saved);
+  EXPECT_EQ(1u, stats.responses_decompressed);
+  EXPECT_LT(0u, stats.response_bytes_saved);
+}
+
+TEST_F(HttpTransportClientCompressionTest, SendsSmallRequestsAsTheyAre) {
+  const std::string body = "{\"temperature\":21.5}";
+  EXPECT_EQ(body, Send(body));
+  EXPECT_EQ("", content_encoding_);
+  EXPECT_EQ(body, received_body_);
+  EXPECT_EQ(0u, client_.GetCompressionStats().requests_compressed);
+}
+
+}  // namespace buffet
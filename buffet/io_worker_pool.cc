@@ -0,0 +1,109 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/io_worker_pool.h"
+
+#include <base/logging.h>
+#include <base/message_loop/message_loop.h>
+
+namespace buffet {
+
+IoWorkerPool::IoWorkerPool(size_t thread_count) {
+  CHECK_GT(thread_count, 0u);
+  for (size_t i = 0; i < thread_count; i++) {
+    threads_.emplace_back(new base::DelegateSimpleThread{this, "weaved_io"});
+    threads_.back()->Start();
+  }
+}
+
+IoWorkerPool::~IoWorkerPool() {
+  {
+    base::AutoLock auto_lock(lock_);
+    shutting_down_ = true;
+    work_available_.Broadcast();
+  }
+  for (const auto& thread : threads_)
+    thread->Join();
+}
+
+void IoWorkerPool::PostTaskAndReply(const tracked_objects::Location& from_here,
+                                    const std::string& sequence,
+                                    const base::Closure& task,
+                                    const base::Closure& reply) {
+  Job job;
+  job.from_here = from_here;
+  job.sequence = sequence;
+  job.task = task;
+  job.reply = reply;
+  job.origin = base::MessageLoop::current()->task_runner();
+
+  base::AutoLock auto_lock(lock_);
+  CHECK(!shutting_down_);
+  if (!sequence.empty())
+    sequence_job_counts_[sequence]++;
+  queue_.push_back(job);
+  work_available_.Signal();
+}
+
+void IoWorkerPool::WaitForSequence(const std::string& sequence) {
+  base::AutoLock auto_lock(lock_);
+  while (sequence_job_counts_.count(sequence) > 0)
+    job_done_.Wait();
+}
+
+void IoWorkerPool::Run() {
+  base::AutoLock auto_lock(lock_);
+  for (;;) {
+    Job job;
+    if (!TakeRunnableJob(&job)) {
+      if (shutting_down_ && queue_.empty())
+        return;
+      work_available_.Wait();
+      continue;
+    }
+
+    std::string sequence = job.sequence;
+    {
+      base::AutoUnlock auto_unlock(lock_);
+      job.task.Run();
+      job.origin->PostTask(job.from_here, job.reply);
+      // Release everything bound to the job outside of the lock.
+      job = Job{};
+    }
+
+    if (!sequence.empty()) {
+      running_sequences_.erase(sequence);
+      if (--sequence_job_counts_[sequence] == 0)
+        sequence_job_counts_.erase(sequence);
+      // Another job of this sequence may be runnable now.
+      work_available_.Broadcast();
+    }
+    job_done_.Broadcast();
+  }
+}
+
+bool IoWorkerPool::TakeRunnableJob(Job* job) {
+  for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+    if (!it->sequence.empty() && running_sequences_.count(it->sequence) > 0)
+      continue;
+    *job = *it;
+    queue_.erase(it);
+    if (!job->sequence.empty())
+      running_sequences_.insert(job->sequence);
+    return true;
+  }
+  return false;
+}
+
+}  // namespace buffet
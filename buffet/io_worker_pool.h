@@ -0,0 +1,121 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BUFFET_IO_WORKER_POOL_H_
+#define BUFFET_IO_WORKER_POOL_H_
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/callback.h>
+#include <base/location.h>
+#include <base/macros.h>
+#include <base/memory/ref_counted.h>
+#include <base/single_thread_task_runner.h>
+#include <base/synchronization/condition_variable.h>
+#include <base/synchronization/lock.h>
+#include <base/threading/simple_thread.h>
+
+namespace buffet {
+
+// A small fixed-size pool of threads for blocking operations (disk, DNS,
+// keystore) that must not run on the main message loop. Every task comes with
+// a reply which is posted back to the message loop of the thread that posted
+// the task once the task is done.
+class IoWorkerPool final : private base::DelegateSimpleThread::Delegate {
+ public:
+  explicit IoWorkerPool(size_t thread_count);
+  // Runs all tasks that are still queued, then joins the worker threads.
+  // Replies are still posted, so they should be bound to weak pointers.
+  ~IoWorkerPool();
+
+  // Runs |task| on a worker thread, followed by |reply| on the current thread.
+  // Tasks that share a non-empty |sequence| name run one at a time, in the
+  // order they were posted. Tasks with an empty |sequence| are unordered.
+  void PostTaskAndReply(const tracked_objects::Location& from_here,
+                        const std::string& sequence,
+                        const base::Closure& task,
+                        const base::Closure& reply);
+
+  // Like PostTaskAndReply(), but passes the value returned by |task| to
+  // |reply|.
+  template <typename R>
+  void PostTaskAndReplyWithResult(
+      const tracked_objects::Location& from_here,
+      const std::string& sequence,
+      const base::Callback<R()>& task,
+      const base::Callback<void(const R&)>& reply) {
+    R* result = new R;
+    PostTaskAndReply(from_here, sequence,
+                     base::Bind(&IoWorkerPool::RunAndStore<R>, task,
+                                base::Unretained(result)),
+                     base::Bind(&IoWorkerPool::ReplyWithResult<R>, reply,
+                                base::Owned(result)));
+  }
+
+  // Blocks until every task posted to |sequence| so far has finished. Meant
+  // for shutdown paths that have to make sure their pending work is done.
+  void WaitForSequence(const std::string& sequence);
+
+ private:
+  struct Job {
+    tracked_objects::Location from_here;
+    std::string sequence;
+    base::Closure task;
+    base::Closure reply;
+    scoped_refptr<base::SingleThreadTaskRunner> origin;
+  };
+
+  template <typename R>
+  static void RunAndStore(const base::Callback<R()>& task, R* result) {
+    *result = task.Run();
+  }
+
+  template <typename R>
+  static void ReplyWithResult(const base::Callback<void(const R&)>& reply,
+                              R* result) {
+    reply.Run(*result);
+  }
+
+  // base::DelegateSimpleThread::Delegate implementation.
+  void Run() override;
+
+  // Removes the first job that may run now from |queue_|. Must be called with
+  // |lock_| held.
+  bool TakeRunnableJob(Job* job);
+
+  base::Lock lock_;
+  // Signalled when a job is queued or a sequence becomes runnable again.
+  base::ConditionVariable work_available_{&lock_};
+  // Signalled whenever a job completes.
+  base::ConditionVariable job_done_{&lock_};
+  std::deque<Job> queue_;
+  std::set<std::string> running_sequences_;
+  // Number of queued or running jobs per non-empty sequence name.
+  std::map<std::string, size_t> sequence_job_counts_;
+  bool shutting_down_{false};
+
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads_;
+
+  DISALLOW_COPY_AND_ASSIGN(IoWorkerPool);
+};
+
+}  // namespace buffet
+
+#endif  // BUFFET_IO_WORKER_POOL_H_
@@ -0,0 +1,76 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/io_worker_pool.h"
+
+#include <string>
+
+#include <base/bind.h>
+#include <base/message_loop/message_loop.h>
+#include <base/threading/platform_thread.h>
+#include <brillo/bind_lambda.h>
+#include <brillo/message_loops/base_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
+#include <gtest/gtest.h>
+
+namespace buffet {
+
+class IoWorkerPoolTest : public ::testing::Test {
+ public:
+  void SetUp() override { brillo_loop_.SetAsCurrent(); }
+
+  void RunUntil(const base::Callback<bool()>& condition) {
+    brillo::MessageLoopRunUntil(&brillo_loop_, base::TimeDelta::FromSeconds(5),
+                                condition);
+  }
+
+ protected:
+  base::MessageLoopForIO base_loop_;
+  brillo::BaseMessageLoop brillo_loop_{&base_loop_};
+  IoWorkerPool pool_{3};
+};
+
+TEST_F(IoWorkerPoolTest, ReplyRunsOnOriginThread) {
+  base::PlatformThreadId origin = base::PlatformThread::CurrentId();
+  base::PlatformThreadId worker = origin;
+  std::string result;
+  pool_.PostTaskAndReplyWithResult(
+      FROM_HERE, std::string{}, base::Bind([&worker]() {
+        worker = base::PlatformThread::CurrentId();
+        return std::string{"done"};
+      }),
+      base::Bind([&result, origin](const std::string& value) {
+        EXPECT_EQ(origin, base::PlatformThread::CurrentId());
+        result = value;
+      }));
+  RunUntil(base::Bind([&result]() { return !result.empty(); }));
+  EXPECT_EQ("done", result);
+  EXPECT_NE(origin, worker);
+}
+
+TEST_F(IoWorkerPoolTest, SequencedTasksRunInOrder) {
+  std::string order;
+  int replies = 0;
+  for (char c = 'a'; c <= 'z'; c++) {
+    pool_.PostTaskAndReply(FROM_HERE, "test",
+                           base::Bind([&order, c]() { order += c; }),
+                           base::Bind([&replies]() { replies++; }));
+  }
+  pool_.WaitForSequence("test");
+  EXPECT_EQ("abcdefghijklmnopqrstuvwxyz", order);
+  RunUntil(base::Bind([&replies]() { return replies == 26; }));
+  EXPECT_EQ(26, replies);
+}
+
+}  // namespace buffet
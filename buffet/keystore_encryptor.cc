@@ -16,36 +16,145 @@
 
 #include <memory>
 
+#include <base/logging.h>
 #include <keystore/keystore_client_impl.h>
 
+#include "buffet/aead.h"
+
 namespace {
 
 const char kBuffetKeyName[] = "buffet_config_b4f594c3";
 
+// Ciphertexts in the envelope format start with this header, followed by the
+// big-endian 16-bit length of the wrapped data key, the wrapped data key and
+// the output of aead::Seal(). The header and wrapped key are authenticated as
+// additional data. Anything else is a ciphertext produced by keystore alone.
+const char kEnvelopeHeader[] = "WVE\x01";
+const size_t kEnvelopeHeaderSize = sizeof(kEnvelopeHeader) - 1;
+const size_t kWrappedKeyLengthSize = 2;
+
+std::string ToString(const brillo::SecureBlob& blob) {
+  return std::string{blob.begin(), blob.end()};
+}
+
 }  // namespace
 
 namespace buffet {
 
-std::unique_ptr<Encryptor> Encryptor::CreateDefaultEncryptor() {
+std::unique_ptr<Encryptor> Encryptor::CreateDefaultEncryptor(
+    const base::FilePath& settings) {
+  // The keys live in keystore.
   return std::unique_ptr<Encryptor>(
       new KeystoreEncryptor(std::unique_ptr<keystore::KeystoreClient>(
-          new keystore::KeystoreClientImpl)));
+                                new keystore::KeystoreClientImpl),
+                            kBuffetKeyName));
 }
 
 KeystoreEncryptor::KeystoreEncryptor(
-    std::unique_ptr<keystore::KeystoreClient> keystore)
-    : keystore_(std::move(keystore)) {}
+    std::unique_ptr<keystore::KeystoreClient> keystore,
+    const std::string& key_name)
+    : keystore_(std::move(keystore)), key_name_(key_name) {}
 
 bool KeystoreEncryptor::EncryptWithAuthentication(const std::string& plaintext,
                                                   std::string* ciphertext) {
-  return keystore_->encryptWithAuthentication(kBuffetKeyName, plaintext,
-                                              ciphertext);
+  brillo::SecureBlob key;
+  std::string wrapped_key;
+  {
+    base::AutoLock auto_lock(lock_);
+    if (!EnsureDataKey())
+      return false;
+    key = data_key_;
+    wrapped_key = wrapped_data_key_;
+  }
+
+  std::string header(kEnvelopeHeader, kEnvelopeHeaderSize);
+  header.push_back(static_cast<char>((wrapped_key.size() >> 8) & 0xff));
+  header.push_back(static_cast<char>(wrapped_key.size() & 0xff));
+  header += wrapped_key;
+  std::string sealed;
+  if (!aead::Seal(key, plaintext, header, &sealed))
+    return false;
+  *ciphertext = header + sealed;
+  return true;
 }
 
 bool KeystoreEncryptor::DecryptWithAuthentication(const std::string& ciphertext,
                                                   std::string* plaintext) {
-  return keystore_->decryptWithAuthentication(kBuffetKeyName, ciphertext,
-                                              plaintext);
+  if (ciphertext.compare(0, kEnvelopeHeaderSize, kEnvelopeHeader) != 0) {
+    // Written before the envelope format was introduced. It is migrated the
+    // next time the settings are saved.
+    return keystore_->decryptWithAuthentication(key_name_, ciphertext,
+                                                plaintext);
+  }
+
+  size_t offset = kEnvelopeHeaderSize;
+  if (ciphertext.size() < offset + kWrappedKeyLengthSize)
+    return false;
+  size_t wrapped_key_size =
+      (static_cast<uint8_t>(ciphertext[offset]) << 8) |
+      static_cast<uint8_t>(ciphertext[offset + 1]);
+  offset += kWrappedKeyLengthSize;
+  if (ciphertext.size() < offset + wrapped_key_size)
+    return false;
+  std::string wrapped_key = ciphertext.substr(offset, wrapped_key_size);
+  offset += wrapped_key_size;
+
+  brillo::SecureBlob key;
+  if (!GetDataKey(wrapped_key, &key))
+    return false;
+  return aead::Open(key, ciphertext.substr(offset),
+                    ciphertext.substr(0, offset), plaintext);
+}
+
+bool KeystoreEncryptor::EnsureDataKey() {
+  lock_.AssertAcquired();
+  if (!data_key_.empty())
+    return true;
+
+  brillo::SecureBlob key;
+  if (!aead::GenerateKey(&key))
+    return false;
+  std::string key_string = ToString(key);
+  std::string wrapped_key;
+  bool wrapped = keystore_->encryptWithAuthentication(
+      key_name_, key_string, &wrapped_key);
+  brillo::SecureMemset(&key_string[0], 0, key_string.size());
+  if (!wrapped || wrapped_key.size() > 0xffff) {
+    LOG(ERROR) << "Failed to wrap settings data key.";
+    return false;
+  }
+  data_key_ = key;
+  wrapped_data_key_ = wrapped_key;
+  return true;
+}
+
+bool KeystoreEncryptor::GetDataKey(const std::string& wrapped_key,
+                                   brillo::SecureBlob* key) {
+  {
+    base::AutoLock auto_lock(lock_);
+    if (!data_key_.empty() && wrapped_key == wrapped_data_key_) {
+      *key = data_key_;
+      return true;
+    }
+    auto it = unwrapped_keys_.find(wrapped_key);
+    if (it != unwrapped_keys_.end()) {
+      *key = it->second;
+      return true;
+    }
+  }
+
+  std::string key_string;
+  if (!keystore_->decryptWithAuthentication(key_name_, wrapped_key,
+                                            &key_string)) {
+    LOG(ERROR) << "Failed to unwrap settings data key.";
+    return false;
+  }
+  *key = brillo::SecureBlob{key_string};
+  brillo::SecureMemset(&key_string[0], 0, key_string.size());
+
+  base::AutoLock auto_lock(lock_);
+  unwrapped_keys_[wrapped_key] = *key;
+  return true;
 }
 
 }  // namespace buffet
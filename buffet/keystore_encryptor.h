@@ -17,8 +17,12 @@
 
 #include "buffet/encryptor.h"
 
+#include <map>
 #include <memory>
+#include <string>
 
+#include <base/synchronization/lock.h>
+#include <brillo/secure_blob.h>
 #include <keystore/keystore_client.h>
 
 namespace buffet {
@@ -26,10 +30,18 @@ namespace buffet {
 // An Encryptor implementation backed by Brillo Keystore. This class is intended
 // to be the default encryptor on platforms that support it. An implementation
 // of Encryptor::CreateDefaultEncryptor is provided for this class.
+//
+// Data is encrypted in-process with a random data key, which is generated once
+// per instance and wrapped by keystore. The wrapped key is stored with every
+// ciphertext, so keystore is only involved once per data key. Ciphertexts
+// produced by older versions, which sent all data through keystore, are still
+// decrypted. This class is thread-safe.
 class KeystoreEncryptor : public Encryptor {
  public:
-  explicit KeystoreEncryptor(
-      std::unique_ptr<keystore::KeystoreClient> keystore);
+  // Data keys are wrapped with the keystore key |key_name|, which is created
+  // on first use.
+  KeystoreEncryptor(std::unique_ptr<keystore::KeystoreClient> keystore,
+                    const std::string& key_name);
   ~KeystoreEncryptor() override = default;
 
   bool EncryptWithAuthentication(const std::string& plaintext,
@@ -38,7 +50,19 @@ class KeystoreEncryptor : public Encryptor {
                                  std::string* plaintext) override;
 
  private:
+  // Creates and wraps |data_key_| on first use.
+  bool EnsureDataKey();
+  // Returns the data key for |wrapped_key|, unwrapping it if necessary.
+  bool GetDataKey(const std::string& wrapped_key, brillo::SecureBlob* key);
+
   std::unique_ptr<keystore::KeystoreClient> keystore_;
+  const std::string key_name_;
+
+  base::Lock lock_;
+  brillo::SecureBlob data_key_;
+  std::string wrapped_data_key_;
+  // Data keys of other instances (e.g. earlier boots) unwrapped so far.
+  std::map<std::string, brillo::SecureBlob> unwrapped_keys_;
 };
 
 }  // namespace buffet
@@ -18,6 +18,7 @@
 #include <sysexits.h>
 
 #include <base/files/file_path.h>
+#include <base/time/time.h>
 #include <binderwrapper/binder_wrapper.h>
 #include <brillo/binder_watcher.h>
 #include <brillo/daemons/dbus_daemon.h>
@@ -90,6 +91,21 @@ int main(int argc, char* argv[]) {
               "Connect to GCD via a persistent XMPP connection.");
   DEFINE_bool(disable_privet, false, "disable Privet protocol");
   DEFINE_bool(enable_ping, false, "enable test HTTP handler at /privet/ping");
+  DEFINE_int32(settings_write_delay_ms, 500,
+               "Window in which repeated settings saves are coalesced into "
+               "a single write.");
+  DEFINE_bool(settings_container, false,
+              "Keep all settings files in a single container file.");
+  DEFINE_bool(compress_settings, true,
+              "Compress settings before encrypting them.");
+  DEFINE_int32(connectivity_debounce_ms, 1000,
+               "Time a new connectivity state has to hold before it is "
+               "reported.");
+  DEFINE_int32(offline_hysteresis_ms, 5000,
+               "Time connectivity has to be lost before going offline is "
+               "reported.");
+  DEFINE_int32(http_max_retries, 0,
+               "Times failed GET and PUT requests to the cloud are retried.");
   DEFINE_string(device_whitelist, "",
                 "Comma separated list of network interfaces to monitor for "
                 "connectivity (an empty list enables all interfaces).");
@@ -123,6 +139,11 @@ int main(int argc, char* argv[]) {
   options.disable_privet = FLAGS_disable_privet;
   options.enable_ping = FLAGS_enable_ping;
   options.device_whitelist = {device_whitelist.begin(), device_whitelist.end()};
+  options.connectivity_debounce =
+      base::TimeDelta::FromMilliseconds(FLAGS_connectivity_debounce_ms);
+  options.offline_hysteresis =
+      base::TimeDelta::FromMilliseconds(FLAGS_offline_hysteresis_ms);
+  options.http_max_retries = FLAGS_http_max_retries;
 
   options.config_options.defaults = base::FilePath{FLAGS_config_path};
   options.config_options.settings = base::FilePath{FLAGS_state_path};
@@ -130,6 +151,10 @@ int main(int argc, char* argv[]) {
   options.config_options.test_definitions =
       base::FilePath{FLAGS_test_definitions_path};
   options.config_options.test_privet_ssid = FLAGS_test_privet_ssid;
+  options.config_options.settings_write_delay =
+      base::TimeDelta::FromMilliseconds(FLAGS_settings_write_delay_ms);
+  options.config_options.use_settings_container = FLAGS_settings_container;
+  options.config_options.compress_settings = FLAGS_compress_settings;
 
   buffet::Daemon daemon{options};
   return daemon.Run();
@@ -14,9 +14,12 @@
 
 #include "buffet/manager.h"
 
+#include <inttypes.h>
+
 #include <map>
 #include <set>
 #include <string>
+#include <utility>
 
 #include <base/bind.h>
 #include <base/bind_helpers.h>
@@ -25,6 +28,7 @@
 #include <base/json/json_reader.h>
 #include <base/json/json_writer.h>
 #include <base/message_loop/message_loop.h>
+#include <base/strings/stringprintf.h>
 #include <base/time/time.h>
 #include <binderwrapper/binder_wrapper.h>
 #include <cutils/properties.h>
@@ -43,9 +47,14 @@
 #include "brillo/weaved_system_properties.h"
 #include "buffet/bluetooth_client.h"
 #include "buffet/buffet_config.h"
+#include "buffet/dns_cache.h"
 #include "buffet/http_transport_client.h"
+#include "buffet/io_worker_pool.h"
 #include "buffet/mdns_client.h"
+#include "buffet/prioritized_task_runner.h"
 #include "buffet/shill_client.h"
+#include "buffet/stream_meter.h"
+#include "buffet/tls_session_cache.h"
 #include "buffet/weave_error_conversion.h"
 #include "buffet/webserv_client.h"
 #include "common/binder_utils.h"
@@ -62,6 +71,10 @@ const char kErrorDomain[] = "buffet";
 const char kFileReadError[] = "file_read_error";
 const char kBaseComponent[] = "base";
 const char kRebootCommand[] = "base.reboot";
+// Blocking disk, DNS and keystore work is spread over this many threads.
+const size_t kIoWorkerThreadCount = 2;
+// dumpsys argument that makes ShillClient report connectivity again.
+const char kRecheckConnectivityArg[] = "--recheck-connectivity";
 
 bool LoadFile(const base::FilePath& file_path,
               std::string* data,
@@ -77,7 +90,7 @@ bool LoadFile(const base::FilePath& file_path,
 }
 
 void LoadTraitDefinitions(const BuffetConfig::Options& options,
-                          weave::Device* device) {
+                          std::vector<std::string>* definitions) {
   // Load component-specific device trait definitions.
   base::FilePath dir{options.definitions.Append("traits")};
   LOG(INFO) << "Looking for trait definitions in " << dir.value();
@@ -89,13 +102,13 @@ void LoadTraitDefinitions(const BuffetConfig::Options& options,
     LOG(INFO) << "Loading trait definition from " << path.value();
     std::string json;
     CHECK(LoadFile(path, &json, nullptr));
-    device->AddTraitDefinitionsFromJson(json);
+    definitions->push_back(json);
   }
 }
 
 void LoadCommandDefinitions(const BuffetConfig::Options& options,
-                            weave::Device* device) {
-  auto load_packages = [device](const base::FilePath& root,
+                            std::vector<std::string>* definitions) {
+  auto load_packages = [definitions](const base::FilePath& root,
                                 const base::FilePath::StringType& pattern) {
     base::FilePath dir{root.Append("commands")};
     LOG(INFO) << "Looking for command schemas in " << dir.value();
@@ -106,7 +119,7 @@ void LoadCommandDefinitions(const BuffetConfig::Options& options,
       LOG(INFO) << "Loading command schema from " << path.value();
       std::string json;
       CHECK(LoadFile(path, &json, nullptr));
-      device->AddCommandDefinitionsFromJson(json);
+      definitions->push_back(json);
     }
   };
   load_packages(options.definitions, FILE_PATH_LITERAL("*.json"));
@@ -115,7 +128,7 @@ void LoadCommandDefinitions(const BuffetConfig::Options& options,
 }
 
 void LoadStateDefinitions(const BuffetConfig::Options& options,
-                          weave::Device* device) {
+                          std::vector<std::string>* definitions) {
   // Load component-specific device state definitions.
   base::FilePath dir{options.definitions.Append("states")};
   LOG(INFO) << "Looking for state definitions in " << dir.value();
@@ -127,12 +140,12 @@ void LoadStateDefinitions(const BuffetConfig::Options& options,
     LOG(INFO) << "Loading state definition from " << path.value();
     std::string json;
     CHECK(LoadFile(path, &json, nullptr));
-    device->AddStateDefinitionsFromJson(json);
+    definitions->push_back(json);
   }
 }
 
 void LoadStateDefaults(const BuffetConfig::Options& options,
-                       weave::Device* device) {
+                       std::vector<std::string>* defaults) {
   // Load component-specific device state defaults.
   base::FilePath dir{options.definitions.Append("states")};
   LOG(INFO) << "Looking for state defaults in " << dir.value();
@@ -144,7 +157,7 @@ void LoadStateDefaults(const BuffetConfig::Options& options,
     LOG(INFO) << "Loading state defaults from " << path.value();
     std::string json;
     CHECK(LoadFile(path, &json, nullptr));
-    CHECK(device->SetStatePropertiesFromJson(json, nullptr));
+    defaults->push_back(json);
   }
 }
 
@@ -164,18 +177,21 @@ void UpdateValue(Manager* manager,
 
 }  // anonymous namespace
 
-class Manager::TaskRunner : public weave::provider::TaskRunner {
- public:
-  void PostDelayedTask(const tracked_objects::Location& from_here,
-                       const base::Closure& task,
-                       base::TimeDelta delay) override {
-    brillo::MessageLoop::current()->PostDelayedTask(from_here, task, delay);
-  }
+struct Manager::Definitions {
+  std::vector<std::string> traits;
+  std::vector<std::string> commands;
+  std::vector<std::string> states;
+  std::vector<std::string> state_defaults;
 };
 
 Manager::Manager(const Options& options,
                  const scoped_refptr<dbus::Bus>& bus)
-    : options_{options}, bus_{bus} {}
+    : options_{options},
+      bus_{bus},
+      io_worker_pool_{new IoWorkerPool{kIoWorkerThreadCount}},
+      dns_cache_{new DnsCache{io_worker_pool_.get(), DnsCache::Options{}}},
+      tls_session_cache_{new TlsSessionCache},
+      stream_meter_{new StreamMeter} {}
 
 Manager::~Manager() {
   android::BinderWrapper* binder_wrapper = android::BinderWrapper::Get();
@@ -197,12 +213,21 @@ void Manager::Start(AsyncEventSequencer* sequencer) {
 void Manager::RestartWeave(AsyncEventSequencer* sequencer) {
   Stop();
 
-  task_runner_.reset(new TaskRunner{});
+  task_runner_.reset(new PrioritizedTaskRunner);
   config_.reset(new BuffetConfig{options_.config_options});
-  http_client_.reset(new HttpTransportClient);
+  config_->SetIoWorkerPool(io_worker_pool_.get());
+  http_client_.reset(new HttpTransportClient{dns_cache_.get()});
+  HttpTransportClient::RetryOptions retry_options;
+  retry_options.max_retries = options_.http_max_retries;
+  http_client_->SetRetryOptions(retry_options);
   shill_client_.reset(new ShillClient{bus_,
                                       options_.device_whitelist,
-                                      !options_.xmpp_enabled});
+                                      !options_.xmpp_enabled,
+                                      dns_cache_.get(),
+                                      tls_session_cache_.get()});
+  shill_client_->SetStreamMeter(stream_meter_.get());
+  shill_client_->SetConnectivityDelays(options_.connectivity_debounce,
+                                       options_.offline_hysteresis);
   weave::provider::HttpServer* http_server{nullptr};
 #ifdef BUFFET_USE_WIFI_BOOTSTRAPPING
   if (!options_.disable_privet) {
@@ -230,18 +255,46 @@ void Manager::RestartWeave(AsyncEventSequencer* sequencer) {
 }
 
 void Manager::CreateDevice() {
-  if (device_)
+  if (device_ || loading_definitions_)
+    return;
+
+  loading_definitions_ = true;
+  io_worker_pool_->PostTaskAndReplyWithResult(
+      FROM_HERE, std::string{},
+      base::Bind(&Manager::LoadDefinitions, options_.config_options),
+      base::Bind(&Manager::OnDefinitionsLoaded,
+                 weak_ptr_factory_.GetWeakPtr()));
+}
+
+Manager::Definitions Manager::LoadDefinitions(
+    const BuffetConfig::Options& options) {
+  Definitions definitions;
+  LoadTraitDefinitions(options, &definitions.traits);
+  LoadCommandDefinitions(options, &definitions.commands);
+  LoadStateDefinitions(options, &definitions.states);
+  LoadStateDefaults(options, &definitions.state_defaults);
+  return definitions;
+}
+
+void Manager::OnDefinitionsLoaded(const Definitions& definitions) {
+  // Weave may have been stopped while the definitions were loading.
+  if (!loading_definitions_ || device_)
     return;
+  loading_definitions_ = false;
 
   device_ = weave::Device::Create(config_.get(), task_runner_.get(),
                                   http_client_.get(), shill_client_.get(),
                                   mdns_client_.get(), web_serv_client_.get(),
                                   shill_client_.get(), bluetooth_client_.get());
 
-  LoadTraitDefinitions(options_.config_options, device_.get());
-  LoadCommandDefinitions(options_.config_options, device_.get());
-  LoadStateDefinitions(options_.config_options, device_.get());
-  LoadStateDefaults(options_.config_options, device_.get());
+  for (const std::string& json : definitions.traits)
+    device_->AddTraitDefinitionsFromJson(json);
+  for (const std::string& json : definitions.commands)
+    device_->AddCommandDefinitionsFromJson(json);
+  for (const std::string& json : definitions.states)
+    device_->AddStateDefinitionsFromJson(json);
+  for (const std::string& json : definitions.state_defaults)
+    CHECK(device_->SetStatePropertiesFromJson(json, nullptr));
 
   device_->AddSettingsChangedCallback(
       base::Bind(&Manager::OnConfigChanged, weak_ptr_factory_.GetWeakPtr()));
@@ -271,6 +324,7 @@ void Manager::CreateDevice() {
 }
 
 void Manager::Stop() {
+  loading_definitions_ = false;
   device_.reset();
 #ifdef BUFFET_USE_WIFI_BOOTSTRAPPING
   web_serv_client_.reset();
@@ -282,6 +336,130 @@ void Manager::Stop() {
   task_runner_.reset();
 }
 
+android::status_t Manager::dump(
+    int fd,
+    const android::Vector<android::String16>& args) {
+  std::string output;
+  if (config_) {
+    const BuffetConfig::Stats& stats = config_->GetStats();
+    base::StringAppendF(&output,
+                        "Settings:\n"
+                        "  saves requested: %" PRIu64 "\n"
+                        "  saves written: %" PRIu64 "\n"
+                        "  journal records written: %" PRIu64 "\n"
+                        "  bytes written: %" PRIu64 "\n",
+                        stats.saves_requested, stats.saves_written,
+                        stats.journal_records_written, stats.bytes_written);
+  }
+  if (shill_client_) {
+    for (const android::String16& arg : args) {
+      if (arg == android::String16{kRecheckConnectivityArg})
+        shill_client_->ForceConnectivityCheck();
+    }
+    const ShillClient::Stats& stats = shill_client_->GetStats();
+    base::StringAppendF(&output,
+                        "Connectivity:\n"
+                        "  notifications sent: %" PRIu64 "\n"
+                        "  notifications suppressed: %" PRIu64 "\n"
+                        "  forced checks: %" PRIu64 "\n",
+                        stats.notifications_sent,
+                        stats.notifications_suppressed, stats.forced_checks);
+  }
+  const DnsCache::Stats& dns_stats = dns_cache_->GetStats();
+  base::StringAppendF(&output,
+                      "DNS cache:\n"
+                      "  hits: %" PRIu64 "\n"
+                      "  negative hits: %" PRIu64 "\n"
+                      "  misses: %" PRIu64 "\n"
+                      "  flushes: %" PRIu64 "\n",
+                      dns_stats.hits, dns_stats.negative_hits,
+                      dns_stats.misses, dns_stats.flushes);
+  if (http_client_) {
+    output += "HTTP requests:\n";
+    const std::pair<const char*, TaskPriority> priorities[] = {
+        {"interactive", TaskPriority::kInteractive},
+        {"normal", TaskPriority::kNormal},
+        {"background", TaskPriority::kBackground},
+    };
+    for (const auto& priority : priorities) {
+      const HttpTransportClient::PriorityStats& stats =
+          http_client_->GetPriorityStats(priority.second);
+      int64_t average_ms =
+          stats.requests
+              ? stats.total_queue_time.InMilliseconds() / stats.requests
+              : 0;
+      base::StringAppendF(&output,
+                          "  %s: %" PRIu64 " requests, %" PRIu64
+                          " queued, queue time %" PRId64 " ms average, %" PRId64
+                          " ms max\n",
+                          priority.first, stats.requests, stats.requests_queued,
+                          average_ms, stats.max_queue_time.InMilliseconds());
+    }
+    const HttpTransportClient::CompressionStats& compression =
+        http_client_->GetCompressionStats();
+    base::StringAppendF(&output,
+                        "  gzip: %" PRIu64 " requests saved %" PRIu64
+                        " bytes, %" PRIu64 " responses saved %" PRIu64
+                        " bytes\n",
+                        compression.requests_compressed,
+                        compression.request_bytes_saved,
+                        compression.responses_decompressed,
+                        compression.response_bytes_saved);
+    output += "HTTP connection pools:\n";
+    for (const auto& pair : http_client_->GetPoolStats()) {
+      const HttpTransportClient::PoolStats& stats = pair.second;
+      base::StringAppendF(
+          &output,
+          "  %s: %" PRIu64 " requests, %" PRIu64 " queued, %" PRIu64
+          " connections opened, %" PRIu64 " reused, %" PRIu64
+          " evicted, %zu busy, %zu idle\n",
+          pair.first.c_str(), stats.requests, stats.requests_queued,
+          stats.connections_opened, stats.connections_reused,
+          stats.connections_evicted, stats.busy_connections,
+          stats.idle_connections);
+      base::StringAppendF(
+          &output,
+          "    rtt %" PRId64 " ms, timeout %" PRId64 " ms, response timeout %"
+          PRId64 " ms, %" PRIu64 " timed out, %" PRIu64
+          " retries, circuit breaker opened %" PRIu64 " times, %" PRIu64
+          " requests rejected\n",
+          stats.smoothed_rtt.InMilliseconds(),
+          stats.request_timeout.InMilliseconds(),
+          stats.response_timeout.InMilliseconds(), stats.requests_timed_out,
+          stats.retries, stats.circuit_breaker_trips, stats.requests_rejected);
+    }
+  }
+  const TlsSessionCache::Stats& tls_stats = tls_session_cache_->GetStats();
+  base::StringAppendF(&output,
+                      "TLS:\n"
+                      "  full handshakes: %" PRIu64 "\n"
+                      "  resumed handshakes: %" PRIu64 "\n",
+                      tls_stats.full_handshakes, tls_stats.resumed_handshakes);
+  const StreamMeter::Totals traffic = stream_meter_->GetTotals();
+  base::StringAppendF(&output,
+                      "Cloud connections:\n"
+                      "  connections: %" PRIu64 "\n"
+                      "  bytes in: %" PRIu64 " in %" PRIu64 " reads\n"
+                      "  bytes out: %" PRIu64 " in %" PRIu64 " writes\n"
+                      "  socket bytes in: %" PRIu64 ", out: %" PRIu64 "\n",
+                      traffic.connections, traffic.bytes_read, traffic.reads,
+                      traffic.bytes_written, traffic.writes,
+                      traffic.socket_bytes_read, traffic.socket_bytes_written);
+  for (const StreamMeter::ConnectionStats* stats :
+       stream_meter_->GetOpenConnections()) {
+    base::StringAppendF(
+        &output,
+        "  open to %s: %" PRIu64 " bytes in, %" PRIu64 " bytes out, "
+        "handshake %" PRId64 " ms, first byte %" PRId64 " ms\n",
+        stats->host.c_str(), stats->bytes_read, stats->bytes_written,
+        stats->handshake_duration.InMilliseconds(),
+        stats->time_to_first_byte.InMilliseconds());
+  }
+  if (!base::WriteFileDescriptor(fd, output.data(), output.size()))
+    return android::UNKNOWN_ERROR;
+  return android::OK;
+}
+
 void Manager::OnTraitDefsChanged() {
   NotifyServiceManagerChange({NotificationListener::TRAITS});
 }
@@ -23,6 +23,7 @@
 #include <base/files/file_path.h>
 #include <base/macros.h>
 #include <base/memory/weak_ptr.h>
+#include <base/time/time.h>
 #include <base/values.h>
 #include <brillo/dbus/async_event_sequencer.h>
 #include <brillo/errors/error.h>
@@ -36,9 +37,14 @@
 namespace buffet {
 
 class BluetoothClient;
+class DnsCache;
 class HttpTransportClient;
+class IoWorkerPool;
 class MdnsClient;
+class PrioritizedTaskRunner;
 class ShillClient;
+class StreamMeter;
+class TlsSessionCache;
 class WebServClient;
 
 // The Manager is responsible for global state of Buffet.  It exposes
@@ -51,6 +57,11 @@ class Manager final : public android::weave::BnWeaveServiceManager {
     bool disable_privet = false;
     bool enable_ping = false;
     std::set<std::string> device_whitelist;
+    // See ShillClient::SetConnectivityDelays().
+    base::TimeDelta connectivity_debounce;
+    base::TimeDelta offline_hysteresis;
+    // Retries of failed cloud requests, see HttpTransportClient::RetryOptions.
+    int http_max_retries = 0;
 
     BuffetConfig::Options config_options;
   };
@@ -61,9 +72,20 @@ class Manager final : public android::weave::BnWeaveServiceManager {
   void Start(brillo::dbus_utils::AsyncEventSequencer* sequencer);
   void Stop();
 
+  // Writes weaved statistics to |fd|. Invoked by dumpsys.
+  android::status_t dump(
+      int fd,
+      const android::Vector<android::String16>& args) override;
+
  private:
+  struct Definitions;
+
   void RestartWeave(brillo::dbus_utils::AsyncEventSequencer* sequencer);
   void CreateDevice();
+  // Reads all trait, command and state definition files. Runs on a worker
+  // thread.
+  static Definitions LoadDefinitions(const BuffetConfig::Options& options);
+  void OnDefinitionsLoaded(const Definitions& definitions);
 
   // Binder methods for IWeaveServiceManager:
   using WeaveServiceManagerNotificationListener =
@@ -110,8 +132,14 @@ class Manager final : public android::weave::BnWeaveServiceManager {
   Options options_;
   scoped_refptr<dbus::Bus> bus_;
 
-  class TaskRunner;
-  std::unique_ptr<TaskRunner> task_runner_;
+  std::unique_ptr<IoWorkerPool> io_worker_pool_;
+  // Shared by |http_client_| and |shill_client_|; outlives Weave restarts.
+  std::unique_ptr<DnsCache> dns_cache_;
+  // Keeps TLS sessions across reconnects and Weave restarts.
+  std::unique_ptr<TlsSessionCache> tls_session_cache_;
+  // Traffic of the cloud connections, across Weave restarts.
+  std::unique_ptr<StreamMeter> stream_meter_;
+  std::unique_ptr<PrioritizedTaskRunner> task_runner_;
   std::unique_ptr<BluetoothClient> bluetooth_client_;
   std::unique_ptr<BuffetConfig> config_;
   std::unique_ptr<HttpTransportClient> http_client_;
@@ -119,6 +147,8 @@ class Manager final : public android::weave::BnWeaveServiceManager {
   std::unique_ptr<MdnsClient> mdns_client_;
   std::unique_ptr<WebServClient> web_serv_client_;
   std::unique_ptr<weave::Device> device_;
+  // True while the device definitions are read on |io_worker_pool_|.
+  bool loading_definitions_{false};
 
   std::vector<android::sp<android::weave::IWeaveClient>> pending_clients_;
   std::map<android::sp<android::weave::IWeaveClient>,
@@ -0,0 +1,137 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/prioritized_task_runner.h"
+
+#include <base/bind.h>
+#include <base/logging.h>
+#include <brillo/message_loops/message_loop.h>
+
+namespace buffet {
+
+namespace {
+
+// After this many tasks were taken from other lanes while a lane had work
+// waiting, one task of that lane is run to avoid starving it completely.
+const size_t kMaxSkippedDispatches = 16;
+
+// The default priority of newly posted tasks. Only accessed on the main thread.
+TaskPriority g_current_priority = TaskPriority::kNormal;
+
+}  // namespace
+
+PrioritizedTaskRunner::PrioritizedTaskRunner() {}
+
+PrioritizedTaskRunner::~PrioritizedTaskRunner() {}
+
+void PrioritizedTaskRunner::PostDelayedTask(
+    const tracked_objects::Location& from_here,
+    const base::Closure& task,
+    base::TimeDelta delay) {
+  PostDelayedTaskWithPriority(from_here, task, delay, g_current_priority);
+}
+
+void PrioritizedTaskRunner::PostDelayedTaskWithPriority(
+    const tracked_objects::Location& from_here,
+    const base::Closure& task,
+    base::TimeDelta delay,
+    TaskPriority priority) {
+  if (delay <= base::TimeDelta{}) {
+    Enqueue(priority, task);
+    return;
+  }
+  brillo::MessageLoop::current()->PostDelayedTask(
+      from_here,
+      base::Bind(&PrioritizedTaskRunner::Enqueue,
+                 weak_ptr_factory_.GetWeakPtr(), priority, task),
+      delay);
+}
+
+TaskPriority PrioritizedTaskRunner::GetCurrentPriority() {
+  return g_current_priority;
+}
+
+void PrioritizedTaskRunner::Enqueue(TaskPriority priority,
+                                    const base::Closure& task) {
+  size_t lane = static_cast<size_t>(priority);
+  CHECK_LT(lane, kLaneCount);
+  lanes_[lane].push_back(task);
+  ScheduleDispatch();
+}
+
+void PrioritizedTaskRunner::ScheduleDispatch() {
+  if (dispatch_scheduled_)
+    return;
+  dispatch_scheduled_ = true;
+  brillo::MessageLoop::current()->PostTask(
+      FROM_HERE, base::Bind(&PrioritizedTaskRunner::Dispatch,
+                            weak_ptr_factory_.GetWeakPtr()));
+}
+
+void PrioritizedTaskRunner::Dispatch() {
+  dispatch_scheduled_ = false;
+
+  size_t lane = kLaneCount;
+  for (size_t index = 0; index < kLaneCount; index++) {
+    if (lanes_[index].empty()) {
+      skipped_dispatches_[index] = 0;
+      continue;
+    }
+    if (lane == kLaneCount)
+      lane = index;
+  }
+  if (lane == kLaneCount)
+    return;
+
+  // Promotes the lane that was passed over most often, the more important one
+  // on a tie.
+  size_t starved = lane;
+  for (size_t index = lane + 1; index < kLaneCount; index++) {
+    if (skipped_dispatches_[index] > skipped_dispatches_[starved])
+      starved = index;
+  }
+  if (skipped_dispatches_[starved] >= kMaxSkippedDispatches)
+    lane = starved;
+  for (size_t index = 0; index < kLaneCount; index++) {
+    if (index != lane && !lanes_[index].empty())
+      skipped_dispatches_[index]++;
+  }
+  skipped_dispatches_[lane] = 0;
+
+  base::Closure task = lanes_[lane].front();
+  lanes_[lane].pop_front();
+
+  // Reschedule before running the task, since the task may destroy this
+  // runner.
+  for (const auto& queue : lanes_) {
+    if (!queue.empty()) {
+      ScheduleDispatch();
+      break;
+    }
+  }
+
+  ScopedTaskPriority scoped_priority{static_cast<TaskPriority>(lane)};
+  task.Run();
+}
+
+ScopedTaskPriority::ScopedTaskPriority(TaskPriority priority)
+    : previous_priority_{g_current_priority} {
+  g_current_priority = priority;
+}
+
+ScopedTaskPriority::~ScopedTaskPriority() {
+  g_current_priority = previous_priority_;
+}
+
+}  // namespace buffet
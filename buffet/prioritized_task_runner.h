@@ -0,0 +1,103 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BUFFET_PRIORITIZED_TASK_RUNNER_H_
+#define BUFFET_PRIORITIZED_TASK_RUNNER_H_
+
+#include <deque>
+
+#include <base/callback.h>
+#include <base/macros.h>
+#include <base/memory/weak_ptr.h>
+#include <base/time/time.h>
+#include <weave/provider/task_runner.h>
+
+namespace buffet {
+
+// Lanes of the PrioritizedTaskRunner, from the most to the least important.
+enum class TaskPriority {
+  // Latency-sensitive local work, such as privet request handling.
+  kInteractive = 0,
+  // Everything that does not say otherwise.
+  kNormal,
+  // Work nobody is waiting on: cloud state uploads, settings writes, retries.
+  kBackground,
+};
+
+// A weave::provider::TaskRunner that keeps one FIFO lane per TaskPriority on
+// top of the brillo message loop. Delayed tasks wait on the message loop until
+// they are due and are then queued in their lane. A single dispatch task runs
+// one queued task per message loop iteration, always from the most important
+// non-empty lane, so a backlog of background work never delays interactive
+// tasks by more than one task. A lane that keeps being passed over is
+// eventually served anyway, the one that waited longest first.
+//
+// libweave has no notion of priorities, so the lane of a task posted through
+// the weave::provider::TaskRunner interface is taken from the current
+// ScopedTaskPriority. Tasks run by the dispatcher execute under the priority
+// of their lane, so follow-up work inherits the priority of the task that
+// posted it.
+class PrioritizedTaskRunner : public weave::provider::TaskRunner {
+ public:
+  PrioritizedTaskRunner();
+  ~PrioritizedTaskRunner() override;
+
+  // weave::provider::TaskRunner implementation.
+  void PostDelayedTask(const tracked_objects::Location& from_here,
+                       const base::Closure& task,
+                       base::TimeDelta delay) override;
+
+  // Posts |task| to the lane for |priority| regardless of the current
+  // ScopedTaskPriority.
+  void PostDelayedTaskWithPriority(const tracked_objects::Location& from_here,
+                                   const base::Closure& task,
+                                   base::TimeDelta delay,
+                                   TaskPriority priority);
+
+  // Returns the priority that tasks posted right now would get by default.
+  static TaskPriority GetCurrentPriority();
+
+ private:
+  void Enqueue(TaskPriority priority, const base::Closure& task);
+  void ScheduleDispatch();
+  void Dispatch();
+
+  static const size_t kLaneCount = 3;
+
+  std::deque<base::Closure> lanes_[kLaneCount];
+  // Number of tasks run from other lanes while each lane was waiting. Used to
+  // make sure that every lane eventually makes progress.
+  size_t skipped_dispatches_[kLaneCount] = {};
+  bool dispatch_scheduled_{false};
+
+  base::WeakPtrFactory<PrioritizedTaskRunner> weak_ptr_factory_{this};
+  DISALLOW_COPY_AND_ASSIGN(PrioritizedTaskRunner);
+};
+
+// Sets the default priority of tasks posted (directly or indirectly) through
+// PrioritizedTaskRunner while this object is alive. Scopes nest. Must only be
+// used on the main thread.
+class ScopedTaskPriority {
+ public:
+  explicit ScopedTaskPriority(TaskPriority priority);
+  ~ScopedTaskPriority();
+
+ private:
+  TaskPriority previous_priority_;
+  DISALLOW_COPY_AND_ASSIGN(ScopedTaskPriority);
+};
+
+}  // namespace buffet
+
+#endif  // BUFFET_PRIORITIZED_TASK_RUNNER_H_
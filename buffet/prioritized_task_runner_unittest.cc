@@ -0,0 +1,135 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/prioritized_task_runner.h"
+
+#include <string>
+
+#include <base/bind.h>
+#include <brillo/bind_lambda.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <gtest/gtest.h>
+
+namespace buffet {
+
+class PrioritizedTaskRunnerTest : public ::testing::Test {
+ public:
+  void SetUp() override { loop_.SetAsCurrent(); }
+
+  base::Closure Record(const std::string& name) {
+    return base::Bind([this, name]() { order_ += name; });
+  }
+
+ protected:
+  brillo::FakeMessageLoop loop_{nullptr};
+  PrioritizedTaskRunner runner_;
+  std::string order_;
+};
+
+TEST_F(PrioritizedTaskRunnerTest, RunsMostImportantLaneFirst) {
+  runner_.PostDelayedTaskWithPriority(FROM_HERE, Record("b"), {},
+                                      TaskPriority::kBackground);
+  runner_.PostDelayedTaskWithPriority(FROM_HERE, Record("n"), {},
+                                      TaskPriority::kNormal);
+  runner_.PostDelayedTaskWithPriority(FROM_HERE, Record("B"), {},
+                                      TaskPriority::kBackground);
+  runner_.PostDelayedTaskWithPriority(FROM_HERE, Record("i"), {},
+                                      TaskPriority::kInteractive);
+  loop_.Run();
+  EXPECT_EQ("inbB", order_);
+}
+
+TEST_F(PrioritizedTaskRunnerTest, InheritsPriorityOfPostingTask) {
+  EXPECT_EQ(TaskPriority::kNormal, PrioritizedTaskRunner::GetCurrentPriority());
+  {
+    ScopedTaskPriority scoped_priority{TaskPriority::kBackground};
+    runner_.PostDelayedTask(FROM_HERE, base::Bind([this]() {
+      order_ += "b";
+      runner_.PostDelayedTask(FROM_HERE, Record("B"), {});
+    }), {});
+  }
+  runner_.PostDelayedTask(FROM_HERE, Record("n"), {});
+  {
+    ScopedTaskPriority scoped_priority{TaskPriority::kInteractive};
+    runner_.PostDelayedTask(FROM_HERE, Record("i"), {});
+  }
+  EXPECT_EQ(TaskPriority::kNormal, PrioritizedTaskRunner::GetCurrentPriority());
+  loop_.Run();
+  EXPECT_EQ("inbB", order_);
+}
+
+TEST_F(PrioritizedTaskRunnerTest, InteractiveTaskSkipsBacklog) {
+  for (int i = 0; i < 5; i++) {
+    runner_.PostDelayedTaskWithPriority(FROM_HERE, Record("b"), {},
+                                        TaskPriority::kBackground);
+  }
+  EXPECT_TRUE(loop_.RunOnce(false));
+  runner_.PostDelayedTaskWithPriority(FROM_HERE, Record("i"), {},
+                                      TaskPriority::kInteractive);
+  loop_.Run();
+  EXPECT_EQ("bibbbb", order_);
+}
+
+TEST_F(PrioritizedTaskRunnerTest, BackgroundLaneIsNotStarved) {
+  runner_.PostDelayedTaskWithPriority(FROM_HERE, Record("b"), {},
+                                      TaskPriority::kBackground);
+  // Keep the interactive lane permanently busy.
+  base::Closure keep_busy;
+  int interactive_runs = 0;
+  keep_busy = base::Bind([this, &keep_busy, &interactive_runs]() {
+    if (order_.empty() && ++interactive_runs < 100) {
+      runner_.PostDelayedTaskWithPriority(FROM_HERE, keep_busy, {},
+                                          TaskPriority::kInteractive);
+    }
+  });
+  runner_.PostDelayedTaskWithPriority(FROM_HERE, keep_busy, {},
+                                      TaskPriority::kInteractive);
+  loop_.Run();
+  EXPECT_EQ("b", order_);
+  EXPECT_LT(interactive_runs, 100);
+}
+
+TEST_F(PrioritizedTaskRunnerTest, EveryWaitingLaneIsServed) {
+  runner_.PostDelayedTaskWithPriority(FROM_HERE, Record("b"), {},
+                                      TaskPriority::kBackground);
+  runner_.PostDelayedTaskWithPriority(FROM_HERE, Record("n"), {},
+                                      TaskPriority::kNormal);
+  // Keep the interactive lane busy until both other lanes got a turn.
+  base::Closure keep_busy;
+  int interactive_runs = 0;
+  keep_busy = base::Bind([this, &keep_busy, &interactive_runs]() {
+    if (order_.size() < 2 && ++interactive_runs < 100) {
+      runner_.PostDelayedTaskWithPriority(FROM_HERE, keep_busy, {},
+                                          TaskPriority::kInteractive);
+    }
+  });
+  runner_.PostDelayedTaskWithPriority(FROM_HERE, keep_busy, {},
+                                      TaskPriority::kInteractive);
+  loop_.Run();
+  // Both lanes waited equally long, so the more important one goes first.
+  EXPECT_EQ("nb", order_);
+  EXPECT_LT(interactive_runs, 100);
+}
+
+TEST_F(PrioritizedTaskRunnerTest, DelayedTask) {
+  runner_.PostDelayedTaskWithPriority(FROM_HERE, Record("i"),
+                                      base::TimeDelta::FromSeconds(1),
+                                      TaskPriority::kInteractive);
+  runner_.PostDelayedTaskWithPriority(FROM_HERE, Record("b"), {},
+                                      TaskPriority::kBackground);
+  loop_.Run();
+  EXPECT_EQ("bi", order_);
+}
+
+}  // namespace buffet
@@ -0,0 +1,143 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "buffet/settings_journal.h"
+
+#include <memory>
+
+#include <base/json/json_reader.h>
+#include <base/json/json_writer.h>
+#include <base/values.h>
+#include <openssl/sha.h>
+
+namespace buffet {
+namespace settings_journal {
+
+namespace {
+
+const char kMagic[] = "WVJ\x01";
+const size_t kMagicSize = sizeof(kMagic) - 1;
+const size_t kHeaderSize = kMagicSize + SHA256_DIGEST_LENGTH;
+const size_t kRecordLengthSize = 4;
+
+const char kSetKey[] = "set";
+const char kRemoveKey[] = "remove";
+
+std::unique_ptr<base::DictionaryValue> ParseObject(const std::string& json) {
+  std::unique_ptr<base::Value> value{base::JSONReader::Read(json).release()};
+  base::DictionaryValue* dict = nullptr;
+  if (!value || !value->GetAsDictionary(&dict))
+    return nullptr;
+  value.release();  // Now owned by the returned pointer.
+  return std::unique_ptr<base::DictionaryValue>{dict};
+}
+
+}  // namespace
+
+std::string CreateHeader(const std::string& snapshot) {
+  uint8_t digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const uint8_t*>(snapshot.data()), snapshot.size(),
+         digest);
+  std::string header(kMagic, kMagicSize);
+  header.append(reinterpret_cast<const char*>(digest), sizeof(digest));
+  return header;
+}
+
+std::string EncodeRecord(const std::string& record) {
+  uint32_t size = record.size();
+  std::string encoded;
+  encoded.reserve(kRecordLengthSize + record.size());
+  for (int shift = 24; shift >= 0; shift -= 8)
+    encoded.push_back(static_cast<char>((size >> shift) & 0xff));
+  encoded.append(record);
+  return encoded;
+}
+
+bool ParseJournal(const std::string& journal,
+                  const std::string& snapshot,
+                  std::vector<std::string>* records) {
+  records->clear();
+  if (journal.size() < kHeaderSize ||
+      journal.compare(0, kHeaderSize, CreateHeader(snapshot)) != 0) {
+    return false;
+  }
+  size_t pos = kHeaderSize;
+  while (journal.size() - pos >= kRecordLengthSize) {
+    uint32_t size = 0;
+    for (size_t i = 0; i < kRecordLengthSize; i++)
+      size = (size << 8) | static_cast<uint8_t>(journal[pos + i]);
+    pos += kRecordLengthSize;
+    if (journal.size() - pos < size)
+      break;
+    records->push_back(journal.substr(pos, size));
+    pos += size;
+  }
+  return true;
+}
+
+bool CreateDelta(const std::string& old_settings,
+                 const std::string& new_settings,
+                 std::string* delta) {
+  std::unique_ptr<base::DictionaryValue> old_dict = ParseObject(old_settings);
+  std::unique_ptr<base::DictionaryValue> new_dict = ParseObject(new_settings);
+  if (!old_dict || !new_dict)
+    return false;
+
+  std::unique_ptr<base::DictionaryValue> set{new base::DictionaryValue};
+  std::unique_ptr<base::ListValue> remove{new base::ListValue};
+  for (base::DictionaryValue::Iterator it(*new_dict); !it.IsAtEnd();
+       it.Advance()) {
+    const base::Value* old_value = nullptr;
+    if (!old_dict->GetWithoutPathExpansion(it.key(), &old_value) ||
+        !old_value->Equals(&it.value())) {
+      set->SetWithoutPathExpansion(it.key(), it.value().DeepCopy());
+    }
+  }
+  for (base::DictionaryValue::Iterator it(*old_dict); !it.IsAtEnd();
+       it.Advance()) {
+    if (!new_dict->HasKey(it.key()))
+      remove->AppendString(it.key());
+  }
+
+  delta->clear();
+  if (set->empty() && remove->empty())
+    return true;
+  base::DictionaryValue delta_dict;
+  delta_dict.SetWithoutPathExpansion(kSetKey, set.release());
+  delta_dict.SetWithoutPathExpansion(kRemoveKey, remove.release());
+  return base::JSONWriter::Write(delta_dict, delta);
+}
+
+bool ApplyDelta(const std::string& delta, std::string* settings) {
+  std::unique_ptr<base::DictionaryValue> delta_dict = ParseObject(delta);
+  std::unique_ptr<base::DictionaryValue> dict = ParseObject(*settings);
+  const base::DictionaryValue* set = nullptr;
+  const base::ListValue* remove = nullptr;
+  if (!delta_dict || !dict ||
+      !delta_dict->GetDictionaryWithoutPathExpansion(kSetKey, &set) ||
+      !delta_dict->GetListWithoutPathExpansion(kRemoveKey, &remove)) {
+    return false;
+  }
+  for (base::DictionaryValue::Iterator it(*set); !it.IsAtEnd(); it.Advance())
+    dict->SetWithoutPathExpansion(it.key(), it.value().DeepCopy());
+  for (const base::Value* key : *remove) {
+    std::string key_string;
+    if (!key->GetAsString(&key_string))
+      return false;
+    dict->RemoveWithoutPathExpansion(key_string, nullptr);
+  }
+  return base::JSONWriter::Write(*dict, settings);
+}
+
+}  // namespace settings_journal
+}  // namespace buffet
@@ -0,0 +1,56 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef BUFFET_SETTINGS_JOURNAL_H_
+#define BUFFET_SETTINGS_JOURNAL_H_
+
+#include <string>
+#include <vector>
+
+namespace buffet {
+
+// Helpers for the journal of settings changes BuffetConfig keeps next to each
+// settings snapshot file. A journal starts with a header that binds it to one
+// snapshot, followed by length-prefixed records. Each record is an encrypted
+// delta of the top-level keys of the settings JSON object. A journal that does
+// not match the snapshot next to it is stale and ignored, so replacing the
+// snapshot atomically also discards the journal.
+namespace settings_journal {
+
+// Returns the header of a new journal on top of |snapshot|, the contents of
+// the settings snapshot file.
+std::string CreateHeader(const std::string& snapshot);
+
+// Returns |record| framed for appending to a journal.
+std::string EncodeRecord(const std::string& record);
+
+// Splits |journal| into records. Returns false if |journal| does not belong to
+// |snapshot|. A truncated record at the end, left by an interrupted append, is
+// dropped.
+bool ParseJournal(const std::string& journal,
+                  const std::string& snapshot,
+                  std::vector<std::string>* records);
+
+// Computes the changes from |old_settings| to |new_settings|. |delta| is empty
+// if nothing changed. Returns false if either is not a JSON object.
+bool CreateDelta(const std::string& old_settings,
+                 const std::string& new_settings,
+                 std::string* delta);
+
+// Applies a delta created by CreateDelta() to |settings|.
+bool ApplyDelta(const std::string& delta, std::string* settings);
+
+}  // namespace settings_journal
+}  // namespace buffet
+
+#endif  // BUFFET_SETTINGS_JOURNAL_H_
@@ -0,0 +1,58 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "buffet/settings_journal.h"
+
+#include <gtest/gtest.h>
+
+namespace buffet {
+
+TEST(SettingsJournalTest, CreateAndApplyDelta) {
+  const std::string old_settings = R"({"a":1,"b":"x","c":{"d":true}})";
+  const std::string new_settings = R"({"a":1,"b":"y","e":[1,2]})";
+  std::string delta;
+  ASSERT_TRUE(
+      settings_journal::CreateDelta(old_settings, new_settings, &delta));
+  EXPECT_EQ(std::string::npos, delta.find("\"a\""));
+
+  std::string settings = old_settings;
+  ASSERT_TRUE(settings_journal::ApplyDelta(delta, &settings));
+  EXPECT_EQ(new_settings, settings);
+
+  ASSERT_TRUE(
+      settings_journal::CreateDelta(new_settings, new_settings, &delta));
+  EXPECT_TRUE(delta.empty());
+  EXPECT_FALSE(settings_journal::CreateDelta("", new_settings, &delta));
+  EXPECT_FALSE(settings_journal::CreateDelta(old_settings, "[]", &delta));
+}
+
+TEST(SettingsJournalTest, ParseJournal) {
+  std::string journal = settings_journal::CreateHeader("snapshot") +
+                        settings_journal::EncodeRecord("record1") +
+                        settings_journal::EncodeRecord("") +
+                        settings_journal::EncodeRecord("record3");
+  std::vector<std::string> records;
+  ASSERT_TRUE(settings_journal::ParseJournal(journal, "snapshot", &records));
+  EXPECT_EQ((std::vector<std::string>{"record1", "", "record3"}), records);
+
+  // Journals of other snapshots are stale.
+  EXPECT_FALSE(settings_journal::ParseJournal(journal, "other", &records));
+  EXPECT_FALSE(settings_journal::ParseJournal("", "snapshot", &records));
+
+  // A partially written record is dropped.
+  journal.resize(journal.size() - 1);
+  ASSERT_TRUE(settings_journal::ParseJournal(journal, "snapshot", &records));
+  EXPECT_EQ((std::vector<std::string>{"record1", ""}), records);
+}
+
+}  // namespace buffet
@@ -14,18 +14,23 @@
 
 #include "buffet/shill_client.h"
 
+#include <algorithm>
 #include <set>
 
 #include <base/message_loop/message_loop.h>
 #include <base/stl_util.h>
 #include <brillo/any.h>
+#include <brillo/dbus/data_serialization.h>
 #include <brillo/errors/error.h>
 #include <brillo/variant_dictionary.h>
+#include <dbus/message.h>
+#include <dbus/scoped_dbus_error.h>
 #include <dbus/shill/dbus-constants.h>
 #include <weave/enum_to_string.h>
 
 #include "buffet/ap_manager_client.h"
-#include "buffet/socket_stream.h"
+#include "buffet/dns_cache.h"
+#include "buffet/tls_stream.h"
 #include "buffet/weave_error_conversion.h"
 
 using brillo::Any;
@@ -44,15 +49,20 @@ namespace buffet {
 
 namespace {
 
+// Delivers PropertyChanged signals of all shill objects. Signals of objects
+// weaved does not track are dropped in ShillClient::OnPropertyChanged().
+const char kPropertyChangedMatchRule[] =
+    "type='signal',sender='org.chromium.flimflam',member='PropertyChanged'";
+
 void IgnoreDetachEvent() {}
 
-bool GetStateForService(ServiceProxy* service, string* state) {
-  CHECK(service) << "|service| was nullptr in GetStateForService()";
-  VariantDictionary properties;
-  if (!service->GetProperties(&properties, nullptr)) {
-    LOG(WARNING) << "Failed to read properties from service.";
-    return false;
-  }
+void LogPropertiesError(const string& object_type, brillo::Error* error) {
+  LOG(WARNING) << "Failed to read properties from " << object_type << ": "
+               << error->GetMessage();
+}
+
+bool GetStateFromProperties(const VariantDictionary& properties,
+                            string* state) {
   auto property_it = properties.find(shill::kStateProperty);
   if (property_it == properties.end()) {
     LOG(WARNING) << "No state found in service properties.";
@@ -98,43 +108,144 @@ Network::State ShillServiceStateToNetworkState(const string& state) {
 
 ShillClient::ShillClient(const scoped_refptr<dbus::Bus>& bus,
                          const set<string>& device_whitelist,
-                         bool disable_xmpp)
+                         bool disable_xmpp,
+                         DnsCache* dns_cache,
+                         TlsSessionCache* tls_session_cache)
     : bus_{bus},
       manager_proxy_{bus_},
       device_whitelist_{device_whitelist},
       disable_xmpp_{disable_xmpp},
+      dns_cache_{dns_cache},
+      tls_session_cache_{tls_session_cache},
       ap_manager_client_{new ApManagerClient(bus)} {
-  manager_proxy_.RegisterPropertyChangedSignalHandler(
-      base::Bind(&ShillClient::OnManagerPropertyChange,
-                 weak_factory_.GetWeakPtr()),
-      base::Bind(&ShillClient::OnManagerPropertyChangeRegistration,
-                 weak_factory_.GetWeakPtr()));
+  // A single match rule covers the manager and every device and service,
+  // instead of one rule and registration round trip per object proxy.
+  bus_->AssertOnDBusThread();
+  bus_->AddFilterFunction(&ShillClient::HandleMessageThunk, this);
+  dbus::ScopedDBusError error;
+  bus_->AddMatch(kPropertyChangedMatchRule, error.get());
+  CHECK(!error.is_set()) << "Failed to subscribe to shill signals: "
+                         << error.message();
   auto owner_changed_cb = base::Bind(&ShillClient::OnShillServiceOwnerChange,
                                      weak_factory_.GetWeakPtr());
   bus_->GetObjectProxy(shill::kFlimflamServiceName, ObjectPath{"/"})
       ->SetNameOwnerChangedCallback(owner_changed_cb);
+  // Empty if shill is not running yet.
+  shill_owner_ = bus_->GetServiceOwnerAndBlock(shill::kFlimflamServiceName,
+                                               dbus::Bus::SUPPRESS_ERRORS);
 
   Init();
 }
 
-ShillClient::~ShillClient() {}
+ShillClient::~ShillClient() {
+  // Their callbacks are bound to this object.
+  for (const auto& pair : pending_tls_connects_)
+    pair.second.Run();
+  dbus::ScopedDBusError error;
+  bus_->RemoveMatch(kPropertyChangedMatchRule, error.get());
+  bus_->RemoveFilterFunction(&ShillClient::HandleMessageThunk, this);
+}
+
+// static
+DBusHandlerResult ShillClient::HandleMessageThunk(DBusConnection* connection,
+                                                  DBusMessage* raw_message,
+                                                  void* user_data) {
+  return static_cast<ShillClient*>(user_data)->HandleMessage(raw_message);
+}
+
+DBusHandlerResult ShillClient::HandleMessage(DBusMessage* raw_message) {
+  if (dbus_message_get_type(raw_message) != DBUS_MESSAGE_TYPE_SIGNAL)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  // dbus::Signal releases its reference when done, and the message still
+  // belongs to libdbus.
+  dbus_message_ref(raw_message);
+  std::unique_ptr<dbus::Signal> signal{
+      dbus::Signal::FromRawMessage(raw_message).release()};
+  if (signal->GetMember() != shill::kMonitorPropertyChanged)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  // The match rule only selects which signals reach this connection. Filters
+  // see every signal, so any peer could pose as shill. Signals of a new shill
+  // instance that arrive before its owner change is handled are dropped, which
+  // is fine since Init() then reads all properties again.
+  if (shill_owner_.empty() || signal->GetSender() != shill_owner_)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  dbus::MessageReader reader{signal.get()};
+  string property_name;
+  Any property_value;
+  if (!reader.PopString(&property_name) ||
+      !brillo::dbus_utils::PopVariantValueFromReader(&reader,
+                                                     &property_value)) {
+    LOG(WARNING) << "Malformed PropertyChanged signal from "
+                 << signal->GetPath().value();
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  }
+  // Other filters may be interested in the same signal, and handlers must
+  // not call into the bus from inside a filter.
+  base::MessageLoop::current()->PostTask(
+      FROM_HERE,
+      base::Bind(&ShillClient::OnPropertyChanged, weak_factory_.GetWeakPtr(),
+                 signal->GetInterface(), signal->GetPath(), property_name,
+                 property_value));
+  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+void ShillClient::OnPropertyChanged(const string& interface,
+                                    const ObjectPath& path,
+                                    const string& property_name,
+                                    const Any& property_value) {
+  if (interface == shill::kFlimflamManagerInterface) {
+    OnManagerPropertyChange(property_name, property_value);
+  } else if (interface == shill::kFlimflamDeviceInterface) {
+    OnDevicePropertyChange(path, property_name, property_value);
+  } else if (interface == shill::kFlimflamServiceInterface &&
+             FindService(path)) {
+    OnServicePropertyChange(path, property_name, property_value);
+  }
+}
 
 void ShillClient::Init() {
   VLOG(2) << "ShillClient::Init();";
+  Reset();
+  RequestManagerProperties();
+}
+
+void ShillClient::Reset() {
   CleanupConnectingService();
   devices_.clear();
+  pending_devices_.clear();
+  connectivity_index_.Clear();
+  stats_.notifications_suppressed += pending_update_count_;
+  pending_update_count_ = 0;
+  pending_connectivity_update_.Cancel();
   connectivity_state_ = Network::State::kOffline;
-  VariantDictionary properties;
-  if (!manager_proxy_.GetProperties(&properties, nullptr)) {
-    LOG(ERROR) << "Unable to get properties from Manager, waiting for "
-                  "Manager to come back online.";
+  // Replies to requests made before now describe a previous shill instance.
+  shill_generation_++;
+}
+
+void ShillClient::RequestManagerProperties() {
+  manager_proxy_.GetPropertiesAsync(
+      base::Bind(&ShillClient::OnManagerProperties, weak_factory_.GetWeakPtr(),
+                 shill_generation_),
+      base::Bind(&ShillClient::OnManagerPropertiesError,
+                 weak_factory_.GetWeakPtr()));
+}
+
+void ShillClient::OnManagerProperties(uint64_t shill_generation,
+                                      const VariantDictionary& properties) {
+  if (shill_generation != shill_generation_)
     return;
-  }
   auto it = properties.find(shill::kDevicesProperty);
   CHECK(it != properties.end()) << "shill should always publish a device list.";
   OnManagerPropertyChange(shill::kDevicesProperty, it->second);
 }
 
+void ShillClient::OnManagerPropertiesError(brillo::Error* error) {
+  LOG(ERROR) << "Unable to get properties from Manager, waiting for "
+                "Manager to come back online: "
+             << error->GetMessage();
+}
+
 void ShillClient::Connect(const string& ssid,
                           const string& passphrase,
                           const weave::DoneCallback& callback) {
@@ -173,11 +284,7 @@ void ShillClient::Connect(const string& ssid,
   connecting_service_.reset(new ServiceProxy{bus_, service_path});
   connecting_service_->Connect(nullptr);
   connect_done_callback_ = callback;
-  connecting_service_->RegisterPropertyChangedSignalHandler(
-      base::Bind(&ShillClient::OnServicePropertyChange,
-                 weak_factory_.GetWeakPtr(), service_path),
-      base::Bind(&ShillClient::OnServicePropertyChangeRegistration,
-                 weak_factory_.GetWeakPtr(), service_path));
+  RequestServiceProperties(service_path);
   base::MessageLoop::current()->PostDelayedTask(
       FROM_HERE, base::Bind(&ShillClient::ConnectToServiceError,
                             weak_factory_.GetWeakPtr(), connecting_service_),
@@ -216,15 +323,8 @@ void ShillClient::AddConnectionChangedCallback(
   connectivity_listeners_.push_back(listener);
 }
 
-bool ShillClient::IsMonitoredDevice(DeviceProxy* device) {
-  if (device_whitelist_.empty()) {
-    return true;
-  }
-  VariantDictionary device_properties;
-  if (!device->GetProperties(&device_properties, nullptr)) {
-    LOG(ERROR) << "Devices without properties aren't whitelisted.";
-    return false;
-  }
+bool ShillClient::IsMonitoredDevice(
+    const VariantDictionary& device_properties) {
   auto it = device_properties.find(shill::kInterfaceProperty);
   if (it == device_properties.end()) {
     LOG(ERROR) << "Failed to find interface property in device properties.";
@@ -236,31 +336,14 @@ bool ShillClient::IsMonitoredDevice(DeviceProxy* device) {
 void ShillClient::OnShillServiceOwnerChange(const string& old_owner,
                                             const string& new_owner) {
   VLOG(1) << "Shill service owner name changed to '" << new_owner << "'";
+  shill_owner_ = new_owner;
   if (new_owner.empty()) {
-    CleanupConnectingService();
-    devices_.clear();
-    connectivity_state_ = Network::State::kOffline;
+    Reset();
   } else {
     Init();  // New service owner means shill reset!
   }
 }
 
-void ShillClient::OnManagerPropertyChangeRegistration(const string& interface,
-                                                      const string& signal_name,
-                                                      bool success) {
-  VLOG(3) << "Registered ManagerPropertyChange handler.";
-  CHECK(success) << "privetd requires Manager signals.";
-  VariantDictionary properties;
-  if (!manager_proxy_.GetProperties(&properties, nullptr)) {
-    LOG(ERROR) << "Unable to get properties from Manager, waiting for "
-                  "Manager to come back online.";
-    return;
-  }
-  auto it = properties.find(shill::kDevicesProperty);
-  CHECK(it != properties.end()) << "Shill should always publish a device list.";
-  OnManagerPropertyChange(shill::kDevicesProperty, it->second);
-}
-
 void ShillClient::OnManagerPropertyChange(const string& property_name,
                                           const Any& property_value) {
   if (property_name != shill::kDevicesProperty) {
@@ -273,58 +356,95 @@ void ShillClient::OnManagerPropertyChange(const string& property_name,
   for (const auto& kv : devices_) {
     device_paths_to_remove.insert(kv.first);
   }
+  for (const auto& kv : pending_devices_) {
+    device_paths_to_remove.insert(kv.first);
+  }
   for (const auto& device_path : property_value.TryGet<vector<ObjectPath>>()) {
     if (!device_path.IsValid()) {
       LOG(ERROR) << "Ignoring invalid device path in Manager's device list.";
       return;
     }
-    auto it = devices_.find(device_path);
-    if (it != devices_.end()) {
+    if (ContainsKey(devices_, device_path) ||
+        ContainsKey(pending_devices_, device_path)) {
       // Found an existing proxy.  Since the whitelist never changes,
       // this still a valid device.
       device_paths_to_remove.erase(device_path);
       continue;
     }
     std::unique_ptr<DeviceProxy> device{new DeviceProxy{bus_, device_path}};
-    if (!IsMonitoredDevice(device.get())) {
+    if (device_whitelist_.empty()) {
+      AddDevice(device_path, std::move(device));
+      update_connectivity = true;
       continue;
     }
-    VLOG(3) << "Creating device proxy at " << device_path.value();
-    devices_[device_path].device = std::move(device);
-    update_connectivity = true;
-    devices_[device_path].device->RegisterPropertyChangedSignalHandler(
-        base::Bind(&ShillClient::OnDevicePropertyChange,
-                   weak_factory_.GetWeakPtr(), device_path),
-        base::Bind(&ShillClient::OnDevicePropertyChangeRegistration,
-                   weak_factory_.GetWeakPtr(), device_path));
+    // Check the interface names of all new devices in parallel.
+    PendingDevice& pending = pending_devices_[device_path];
+    pending.device = std::move(device);
+    pending.id = ++last_device_id_;
+    pending.device->GetPropertiesAsync(
+        base::Bind(&ShillClient::OnNewDeviceProperties,
+                   weak_factory_.GetWeakPtr(), device_path, pending.id),
+        base::Bind(&ShillClient::OnNewDevicePropertiesError,
+                   weak_factory_.GetWeakPtr(), device_path, pending.id));
   }
   // Clean up devices/services related to removed devices.
   for (const ObjectPath& device_path : device_paths_to_remove) {
-    devices_.erase(device_path);
-    update_connectivity = true;
+    pending_devices_.erase(device_path);
+    connectivity_index_.RemoveDevice(device_path);
+    if (devices_.erase(device_path) > 0)
+      update_connectivity = true;
   }
 
   if (update_connectivity)
     UpdateConnectivityState();
 }
 
-void ShillClient::OnDevicePropertyChangeRegistration(
-    const ObjectPath& device_path,
-    const string& interface,
-    const string& signal_name,
-    bool success) {
-  VLOG(3) << "Registered DevicePropertyChange handler.";
-  auto it = devices_.find(device_path);
-  if (it == devices_.end()) {
+void ShillClient::OnNewDeviceProperties(const ObjectPath& device_path,
+                                        uint64_t device_id,
+                                        const VariantDictionary& properties) {
+  auto it = pending_devices_.find(device_path);
+  if (it == pending_devices_.end() || it->second.id != device_id)
+    return;  // The device was removed or shill restarted meanwhile.
+  std::unique_ptr<DeviceProxy> device = std::move(it->second.device);
+  pending_devices_.erase(it);
+  if (!IsMonitoredDevice(properties))
     return;
-  }
-  CHECK(success) << "Failed to subscribe to Device property changes.";
-  DeviceProxy* device = it->second.device.get();
-  VariantDictionary properties;
-  if (!device->GetProperties(&properties, nullptr)) {
-    LOG(WARNING) << "Failed to get device properties?";
+  AddDevice(device_path, std::move(device));
+  UpdateConnectivityState();
+}
+
+void ShillClient::OnNewDevicePropertiesError(const ObjectPath& device_path,
+                                             uint64_t device_id,
+                                             brillo::Error* error) {
+  auto it = pending_devices_.find(device_path);
+  if (it == pending_devices_.end() || it->second.id != device_id)
+    return;
+  LOG(ERROR) << "Devices without properties aren't whitelisted: "
+             << error->GetMessage();
+  pending_devices_.erase(it);
+}
+
+void ShillClient::AddDevice(const ObjectPath& device_path,
+                            std::unique_ptr<DeviceProxy> device) {
+  VLOG(3) << "Creating device proxy at " << device_path.value();
+  DeviceState& device_state = devices_[device_path];
+  device_state.device = std::move(device);
+  device_state.id = ++last_device_id_;
+  connectivity_index_.AddDevice(device_path);
+  // Signals are already subscribed to, so the properties read now cannot
+  // miss a change.
+  device_state.device->GetPropertiesAsync(
+      base::Bind(&ShillClient::OnDeviceProperties, weak_factory_.GetWeakPtr(),
+                 device_path, device_state.id),
+      base::Bind(&LogPropertiesError, string{"device"}));
+}
+
+void ShillClient::OnDeviceProperties(const ObjectPath& device_path,
+                                     uint64_t device_id,
+                                     const VariantDictionary& properties) {
+  auto it = devices_.find(device_path);
+  if (it == devices_.end() || it->second.id != device_id)
     return;
-  }
   auto prop_it = properties.find(shill::kSelectedServiceProperty);
   if (prop_it == properties.end()) {
     LOG(WARNING) << "Failed to get device's selected service?";
@@ -361,9 +481,10 @@ void ShillClient::OnDevicePropertyChange(const ObjectPath& device_path,
       return;  // Spurious update?
     }
     device_state.selected_service.reset();
-    device_state.service_state = Network::State::kOffline;
     removed_old_service = true;
   }
+  // The state of the new service is read below.
+  connectivity_index_.SelectService(device_path, service_path);
   const bool reuse_connecting_service =
       service_path.value() != "/" && connecting_service_ &&
       connecting_service_->GetObjectPath() == service_path;
@@ -373,56 +494,73 @@ void ShillClient::OnDevicePropertyChange(const ObjectPath& device_path,
     // cached state is correct.  Normally, we do this by relying reading the
     // state when our signal handlers finish registering, but this may have
     // happened long in the past for the connecting service.
-    string state;
-    if (GetStateForService(connecting_service_.get(), &state)) {
-      device_state.service_state = ShillServiceStateToNetworkState(state);
-    } else {
-      LOG(WARNING) << "Failed to read properties from existing service "
-                      "on selection.";
-    }
+    connecting_service_->GetPropertiesAsync(
+        base::Bind(&ShillClient::OnReusedServiceProperties,
+                   weak_factory_.GetWeakPtr(), device_path, device_state.id,
+                   service_path),
+        base::Bind(&LogPropertiesError, string{"selected service"}));
   } else if (service_path.value() != "/") {
     // The device has selected a new service we haven't see before.
     device_state.selected_service =
         std::make_shared<ServiceProxy>(bus_, service_path);
-    device_state.selected_service->RegisterPropertyChangedSignalHandler(
-        base::Bind(&ShillClient::OnServicePropertyChange,
-                   weak_factory_.GetWeakPtr(), service_path),
-        base::Bind(&ShillClient::OnServicePropertyChangeRegistration,
-                   weak_factory_.GetWeakPtr(), service_path));
+    RequestServiceProperties(service_path);
   }
 
-  if (reuse_connecting_service || removed_old_service) {
+  if (removed_old_service) {
     UpdateConnectivityState();
   }
 }
 
-void ShillClient::OnServicePropertyChangeRegistration(const ObjectPath& path,
-                                                      const string& interface,
-                                                      const string& signal_name,
-                                                      bool success) {
-  VLOG(3) << "OnServicePropertyChangeRegistration(" << path.value() << ");";
-  ServiceProxy* service{nullptr};
-  if (connecting_service_ && connecting_service_->GetObjectPath() == path) {
-    // Note that the connecting service might also be a selected service.
-    service = connecting_service_.get();
-    if (!success)
-      CleanupConnectingService();
-  } else {
-    for (const auto& kv : devices_) {
-      if (kv.second.selected_service &&
-          kv.second.selected_service->GetObjectPath() == path) {
-        service = kv.second.selected_service.get();
-        break;
-      }
-    }
-  }
-  if (service == nullptr || !success) {
-    return;  // A failure or success for a proxy we no longer care about.
-  }
-  VariantDictionary properties;
-  if (!service->GetProperties(&properties, nullptr)) {
+void ShillClient::OnReusedServiceProperties(
+    const ObjectPath& device_path,
+    uint64_t device_id,
+    const ObjectPath& service_path,
+    const VariantDictionary& properties) {
+  auto it = devices_.find(device_path);
+  if (it == devices_.end() || it->second.id != device_id ||
+      !it->second.selected_service ||
+      it->second.selected_service->GetObjectPath() != service_path) {
+    return;  // The device selected another service meanwhile.
+  }
+  string state;
+  if (!GetStateFromProperties(properties, &state)) {
+    LOG(WARNING) << "Failed to read properties from existing service "
+                    "on selection.";
     return;
   }
+  connectivity_index_.SetDeviceState(device_path,
+                                     ShillServiceStateToNetworkState(state));
+  UpdateConnectivityState();
+}
+
+void ShillClient::RequestServiceProperties(const ObjectPath& path) {
+  VLOG(3) << "RequestServiceProperties(" << path.value() << ");";
+  ServiceProxy* service = FindService(path);
+  if (service == nullptr)
+    return;
+  service->GetPropertiesAsync(
+      base::Bind(&ShillClient::OnServiceProperties, weak_factory_.GetWeakPtr(),
+                 path),
+      base::Bind(&LogPropertiesError, string{"service"}));
+}
+
+ServiceProxy* ShillClient::FindService(const ObjectPath& path) const {
+  if (connecting_service_ && connecting_service_->GetObjectPath() == path) {
+    // Note that the connecting service might also be a selected service.
+    return connecting_service_.get();
+  }
+  const ObjectPath* device_path = connectivity_index_.FindDevice(path);
+  if (!device_path)
+    return nullptr;
+  auto it = devices_.find(*device_path);
+  CHECK(it != devices_.end());
+  return it->second.selected_service.get();
+}
+
+void ShillClient::OnServiceProperties(const ObjectPath& path,
+                                      const VariantDictionary& properties) {
+  if (!FindService(path))
+    return;  // The service was released while the request was in flight.
   // Give ourselves property changed signals for the initial property
   // values.
   for (auto name : {shill::kStateProperty, shill::kSignalStrengthProperty,
@@ -519,44 +657,77 @@ void ShillClient::OnStateChangeForSelectedService(
   // Find the device/service pair responsible for this update
   VLOG(3) << "State for potentially selected service " << service_path.value()
           << " have changed to " << state;
-  for (auto& kv : devices_) {
-    if (kv.second.selected_service &&
-        kv.second.selected_service->GetObjectPath() == service_path) {
-      VLOG(3) << "Updated cached connection state for selected service.";
-      kv.second.service_state = ShillServiceStateToNetworkState(state);
-      UpdateConnectivityState();
-      return;
-    }
+  if (connectivity_index_.SetServiceState(
+          service_path, ShillServiceStateToNetworkState(state))) {
+    VLOG(3) << "Updated cached connection state for selected service.";
+    UpdateConnectivityState();
   }
 }
 
 void ShillClient::UpdateConnectivityState() {
-  // Update the connectivity state of the device by picking the
-  // state of the currently most connected selected service.
-  Network::State new_connectivity_state{Network::State::kOffline};
-  for (const auto& kv : devices_) {
-    if (kv.second.service_state > new_connectivity_state) {
-      new_connectivity_state = kv.second.service_state;
-    }
+  // The connectivity state of the device is the state of the currently most
+  // connected selected service.
+  Network::State new_connectivity_state =
+      connectivity_index_.GetConnectivityState();
+  if (new_connectivity_state == connectivity_state_) {
+    // Either nothing changed, or a change flapped back before it was
+    // reported.
+    stats_.notifications_suppressed += pending_update_count_ + 1;
+    pending_update_count_ = 0;
+    pending_connectivity_update_.Cancel();
+    return;
   }
-  VLOG(1) << "Connectivity changed: " << EnumToString(connectivity_state_)
-          << " -> " << EnumToString(new_connectivity_state);
-  // Notify listeners even if state changed to the same value. Listeners may
-  // want to handle this event.
-  connectivity_state_ = new_connectivity_state;
+
   // We may call UpdateConnectivityState whenever we mutate a data structure
   // such that our connectivity status could change.  However, we don't want
   // to allow people to call into ShillClient while some other operation is
-  // underway.  Therefore, call our callbacks later, when we're in a good
-  // state.
+  // underway.  Therefore, apply the change later, when we're in a good
+  // state. Every update restarts the window, so that only a state that held
+  // for the whole window is reported.
+  base::TimeDelta delay = debounce_;
+  if (connectivity_state_ == Network::State::kOnline)
+    delay = std::max(delay, offline_hysteresis_);
+  pending_update_count_++;
+  pending_connectivity_update_.Reset(base::Bind(
+      &ShillClient::ApplyConnectivityState, weak_factory_.GetWeakPtr()));
+  base::MessageLoop::current()->PostDelayedTask(
+      FROM_HERE, pending_connectivity_update_.callback(), delay);
+}
+
+void ShillClient::ApplyConnectivityState() {
+  Network::State new_connectivity_state =
+      connectivity_index_.GetConnectivityState();
+  uint64_t update_count = pending_update_count_;
+  pending_update_count_ = 0;
+  if (new_connectivity_state == connectivity_state_) {
+    stats_.notifications_suppressed += update_count;
+    return;
+  }
+  VLOG(1) << "Connectivity changed: " << EnumToString(connectivity_state_)
+          << " -> " << EnumToString(new_connectivity_state);
+  connectivity_state_ = new_connectivity_state;
+  if (update_count > 0)
+    stats_.notifications_suppressed += update_count - 1;
+  NotifyConnectivityListeners(connectivity_state_ == Network::State::kOnline);
+}
+
+void ShillClient::ForceConnectivityCheck() {
+  stats_.forced_checks++;
+  stats_.notifications_suppressed += pending_update_count_;
+  pending_update_count_ = 0;
+  pending_connectivity_update_.Cancel();
+  connectivity_state_ = connectivity_index_.GetConnectivityState();
   base::MessageLoop::current()->PostTask(
       FROM_HERE, base::Bind(&ShillClient::NotifyConnectivityListeners,
                             weak_factory_.GetWeakPtr(),
-                            GetConnectionState() == Network::State::kOnline));
+                            connectivity_state_ == Network::State::kOnline));
 }
 
 void ShillClient::NotifyConnectivityListeners(bool am_online) {
   VLOG(3) << "Notifying connectivity listeners that online=" << am_online;
+  stats_.notifications_sent++;
+  // Addresses resolved on the previous network may not be reachable anymore.
+  dns_cache_->Flush();
   for (const auto& listener : connectivity_listeners_)
     listener.Run();
 }
@@ -575,19 +746,23 @@ void ShillClient::OpenSslSocket(const std::string& host,
                                 const OpenSslSocketCallback& callback) {
   if (disable_xmpp_)
     return;
-  std::unique_ptr<weave::Stream> raw_stream{
-      SocketStream::ConnectBlocking(host, port)};
-  if (!raw_stream) {
-    brillo::ErrorPtr error;
-    brillo::errors::system::AddSystemError(&error, FROM_HERE, errno);
-    weave::ErrorPtr weave_error;
-    ConvertError(*error.get(), &weave_error);
-    base::MessageLoop::current()->PostTask(
-        FROM_HERE, base::Bind(callback, nullptr, base::Passed(&weave_error)));
-    return;
-  }
+  TlsStream::ConnectOptions options;
+  options.meter = stream_meter_;
+  uint64_t connect_id = ++last_tls_connect_id_;
+  pending_tls_connects_[connect_id] = TlsStream::Connect(
+      dns_cache_, tls_session_cache_, host, port, options,
+      base::Bind(&ShillClient::OnTlsConnected, weak_factory_.GetWeakPtr(),
+                 connect_id, callback));
+}
 
-  SocketStream::TlsConnect(std::move(raw_stream), host, callback);
+void ShillClient::OnTlsConnected(uint64_t connect_id,
+                                 const OpenSslSocketCallback& callback,
+                                 std::unique_ptr<weave::Stream> stream,
+                                 weave::ErrorPtr error) {
+  pending_tls_connects_.erase(connect_id);
+  if (error)
+    LOG(WARNING) << "TLS connection failed: " << error->GetMessage();
+  callback.Run(std::move(stream), std::move(error));
 }
 
 }  // namespace buffet
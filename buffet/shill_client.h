@@ -25,21 +25,40 @@
 #include <base/macros.h>
 #include <base/memory/ref_counted.h>
 #include <base/memory/weak_ptr.h>
+#include <brillo/errors/error.h>
+#include <brillo/variant_dictionary.h>
 #include <dbus/bus.h>
 #include <shill/dbus-proxies.h>
 #include <weave/provider/network.h>
 #include <weave/provider/wifi.h>
 
+#include "buffet/connectivity_index.h"
+
 namespace buffet {
 
 class ApManagerClient;
+class DnsCache;
+class StreamMeter;
+class TlsSessionCache;
 
 class ShillClient final : public weave::provider::Network,
                           public weave::provider::Wifi {
  public:
+  // Counters of connectivity change notifications.
+  struct Stats {
+    // Notifications delivered to listeners, including forced ones.
+    uint64_t notifications_sent{0};
+    // Connectivity updates that did not lead to a notification, because the
+    // state did not change or was superseded within the debounce window.
+    uint64_t notifications_suppressed{0};
+    uint64_t forced_checks{0};
+  };
+
   ShillClient(const scoped_refptr<dbus::Bus>& bus,
               const std::set<std::string>& device_whitelist,
-              bool disable_xmpp);
+              bool disable_xmpp,
+              DnsCache* dns_cache,
+              TlsSessionCache* tls_session_cache);
   ~ShillClient();
 
   // NetworkProvider implementation.
@@ -61,6 +80,24 @@ class ShillClient final : public weave::provider::Network,
   // regarding 5.0 GHz support.
   bool IsWifi50Supported() const override { return false; }
 
+  // Listeners are notified of a connectivity change once the new state held
+  // for |debounce|, or for |offline_hysteresis| when going from online to any
+  // other state. Zero delays notify on every change.
+  // Makes cloud connections report their traffic to |meter|.
+  void SetStreamMeter(StreamMeter* meter) { stream_meter_ = meter; }
+
+  void SetConnectivityDelays(base::TimeDelta debounce,
+                             base::TimeDelta offline_hysteresis) {
+    debounce_ = debounce;
+    offline_hysteresis_ = offline_hysteresis;
+  }
+
+  // Reports the current connectivity state right away, and notifies listeners
+  // even if it did not change.
+  void ForceConnectivityCheck();
+
+  const Stats& GetStats() const { return stats_; }
+
  private:
   struct DeviceState {
     std::unique_ptr<org::chromium::flimflam::DeviceProxy> device;
@@ -69,30 +106,65 @@ class ShillClient final : public weave::provider::Network,
     // service (for instance, in the period between configuring a WiFi service
     // with credentials, and when Connect() is called.)
     std::shared_ptr<org::chromium::flimflam::ServiceProxy> selected_service;
-    State service_state{State::kOffline};
+    // Tells replies to requests for this device apart from replies for an
+    // earlier device at the same path.
+    uint64_t id{0};
   };
 
-  void Init();
+  // A device whose interface name is being checked against the whitelist.
+  struct PendingDevice {
+    std::unique_ptr<org::chromium::flimflam::DeviceProxy> device;
+    uint64_t id{0};
+  };
 
-  bool IsMonitoredDevice(org::chromium::flimflam::DeviceProxy* device);
+  void Init();
+  // Forgets all state of the current shill instance.
+  void Reset();
+  void RequestManagerProperties();
+  void OnManagerProperties(uint64_t shill_generation,
+                           const brillo::VariantDictionary& properties);
+  void OnManagerPropertiesError(brillo::Error* error);
+
+  bool IsMonitoredDevice(const brillo::VariantDictionary& device_properties);
+  void OnNewDeviceProperties(const dbus::ObjectPath& device_path,
+                             uint64_t device_id,
+                             const brillo::VariantDictionary& properties);
+  void OnNewDevicePropertiesError(const dbus::ObjectPath& device_path,
+                                  uint64_t device_id,
+                                  brillo::Error* error);
+  void AddDevice(const dbus::ObjectPath& device_path,
+                 std::unique_ptr<org::chromium::flimflam::DeviceProxy> device);
   void OnShillServiceOwnerChange(const std::string& old_owner,
                                  const std::string& new_owner);
-  void OnManagerPropertyChangeRegistration(const std::string& interface,
-                                           const std::string& signal_name,
-                                           bool success);
+  // Filters PropertyChanged signals of all shill objects.
+  static DBusHandlerResult HandleMessageThunk(DBusConnection* connection,
+                                              DBusMessage* raw_message,
+                                              void* user_data);
+  DBusHandlerResult HandleMessage(DBusMessage* raw_message);
+  // Passes a PropertyChanged signal on to the handler for its object.
+  void OnPropertyChanged(const std::string& interface,
+                         const dbus::ObjectPath& path,
+                         const std::string& property_name,
+                         const brillo::Any& property_value);
   void OnManagerPropertyChange(const std::string& property_name,
                                const brillo::Any& property_value);
-  void OnDevicePropertyChangeRegistration(const dbus::ObjectPath& device_path,
-                                          const std::string& interface,
-                                          const std::string& signal_name,
-                                          bool success);
+  void OnDeviceProperties(const dbus::ObjectPath& device_path,
+                          uint64_t device_id,
+                          const brillo::VariantDictionary& properties);
   void OnDevicePropertyChange(const dbus::ObjectPath& device_path,
                               const std::string& property_name,
                               const brillo::Any& property_value);
-  void OnServicePropertyChangeRegistration(const dbus::ObjectPath& path,
-                                           const std::string& interface,
-                                           const std::string& signal_name,
-                                           bool success);
+  void OnReusedServiceProperties(const dbus::ObjectPath& device_path,
+                                 uint64_t device_id,
+                                 const dbus::ObjectPath& service_path,
+                                 const brillo::VariantDictionary& properties);
+  // Reads the initial properties of the connecting or a selected service.
+  void RequestServiceProperties(const dbus::ObjectPath& path);
+  // Returns the connecting or a selected service at |path|, if any.
+  org::chromium::flimflam::ServiceProxy* FindService(
+      const dbus::ObjectPath& path) const;
+  void OnServiceProperties(const dbus::ObjectPath& path,
+                           const brillo::VariantDictionary& properties);
   void OnServicePropertyChange(const dbus::ObjectPath& service_path,
                                const std::string& property_name,
                                const brillo::Any& property_value);
@@ -103,9 +175,15 @@ class ShillClient final : public weave::provider::Network,
   void OnStateChangeForSelectedService(const dbus::ObjectPath& service_path,
                                        const std::string& state);
   void UpdateConnectivityState();
+  // Reports the state of |connectivity_index_| if it changed.
+  void ApplyConnectivityState();
   void NotifyConnectivityListeners(bool am_online);
   // Clean up state related to a connecting service.
   void CleanupConnectingService();
+  void OnTlsConnected(uint64_t connect_id,
+                      const OpenSslSocketCallback& callback,
+                      std::unique_ptr<weave::Stream> stream,
+                      weave::ErrorPtr error);
 
   void ConnectToServiceError(
       std::shared_ptr<org::chromium::flimflam::ServiceProxy>
@@ -117,6 +195,14 @@ class ShillClient final : public weave::provider::Network,
   // in OnManagerPropertyChange.  Do not be tempted to remove this const.
   const std::set<std::string> device_whitelist_;
   bool disable_xmpp_{false};
+  // Resolves the hosts of cloud sockets. Flushed on connectivity changes.
+  DnsCache* dns_cache_{nullptr};
+  // Lets XMPP reconnects resume the previous TLS session.
+  TlsSessionCache* tls_session_cache_{nullptr};
+  // Aborts TLS connections still being set up, by connection ID.
+  std::map<uint64_t, base::Closure> pending_tls_connects_;
+  uint64_t last_tls_connect_id_{0};
+  StreamMeter* stream_meter_{nullptr};
   std::vector<ConnectionChangedCallback> connectivity_listeners_;
 
   // State for tracking where we are in our attempts to connect to a service.
@@ -127,7 +213,26 @@ class ShillClient final : public weave::provider::Network,
 
   // State for tracking our online connectivity.
   std::map<dbus::ObjectPath, DeviceState> devices_;
+  std::map<dbus::ObjectPath, PendingDevice> pending_devices_;
+  // Selected services and their states, indexed by service path.
+  ConnectivityIndex connectivity_index_;
+  // The state last reported to listeners.
   State connectivity_state_{State::kOffline};
+  base::TimeDelta debounce_;
+  base::TimeDelta offline_hysteresis_;
+  base::CancelableClosure pending_connectivity_update_;
+  // Number of updates waiting for |pending_connectivity_update_|.
+  uint64_t pending_update_count_{0};
+  Stats stats_;
+
+  // Unique bus name of shill. PropertyChanged signals from anyone else are
+  // dropped.
+  std::string shill_owner_;
+
+  // Property requests are asynchronous. Replies that arrive after shill
+  // restarted or the device they are about was replaced are dropped.
+  uint64_t shill_generation_{0};
+  uint64_t last_device_id_{0};
 
   std::unique_ptr<ApManagerClient> ap_manager_client_;
 
@@ -20,7 +20,6 @@
 #include <base/callback.h>
 #include <base/macros.h>
 #include <brillo/streams/stream.h>
-#include <weave/provider/network.h>
 #include <weave/stream.h>
 
 namespace buffet {
@@ -41,14 +40,6 @@ class SocketStream : public weave::Stream {
 
   void CancelPendingOperations() override;
 
-  static std::unique_ptr<weave::Stream> ConnectBlocking(const std::string& host,
-                                                        uint16_t port);
-
-  static void TlsConnect(
-      std::unique_ptr<weave::Stream> socket,
-      const std::string& host,
-      const weave::provider::Network::OpenSslSocketCallback& callback);
-
  private:
   brillo::StreamPtr ptr_;
   DISALLOW_COPY_AND_ASSIGN(SocketStream);
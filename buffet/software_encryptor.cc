@@ -0,0 +1,134 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/software_encryptor.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <base/files/file_util.h>
+#include <base/files/scoped_file.h>
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+#include <brillo/data_encoding.h>
+
+#include "buffet/aead.h"
+
+namespace buffet {
+
+namespace {
+
+// Ciphertexts start with this header, which is also authenticated as
+// additional data. Anything else was written by the base64-only encryptor
+// that used to be the default on platforms without keystore.
+const char kHeader[] = "WVS\x01";
+const size_t kHeaderSize = sizeof(kHeader) - 1;
+
+// Writes |key| to a new file at |path| that only the owner can access.
+bool WriteKeyFile(const base::FilePath& path, const brillo::SecureBlob& key) {
+  base::FilePath temp_path = path.AddExtension("tmp");
+  base::ScopedFD fd{HANDLE_EINTR(
+      open(temp_path.value().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+           S_IRUSR | S_IWUSR))};
+  if (!fd.is_valid()) {
+    PLOG(ERROR) << "Failed to create " << temp_path.value();
+    return false;
+  }
+  if (!base::WriteFileDescriptor(fd.get(),
+                                 reinterpret_cast<const char*>(key.data()),
+                                 key.size()) ||
+      HANDLE_EINTR(fsync(fd.get())) != 0) {
+    PLOG(ERROR) << "Failed to write " << temp_path.value();
+    base::DeleteFile(temp_path, false);
+    return false;
+  }
+  fd.reset();
+  if (!base::ReplaceFile(temp_path, path, nullptr)) {
+    LOG(ERROR) << "Failed to move key file to " << path.value();
+    base::DeleteFile(temp_path, false);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+SoftwareEncryptor::SoftwareEncryptor(const base::FilePath& key_file)
+    : key_file_{key_file} {}
+
+SoftwareEncryptor::~SoftwareEncryptor() {}
+
+bool SoftwareEncryptor::EncryptWithAuthentication(const std::string& plaintext,
+                                                  std::string* ciphertext) {
+  brillo::SecureBlob key;
+  {
+    base::AutoLock auto_lock(lock_);
+    if (!EnsureKey())
+      return false;
+    key = key_;
+  }
+  std::string header(kHeader, kHeaderSize);
+  std::string sealed;
+  if (!aead::Seal(key, plaintext, header, &sealed))
+    return false;
+  *ciphertext = header + sealed;
+  return true;
+}
+
+bool SoftwareEncryptor::DecryptWithAuthentication(const std::string& ciphertext,
+                                                  std::string* plaintext) {
+  if (ciphertext.compare(0, kHeaderSize, kHeader) != 0) {
+    // Only base64-encoded by an older version. It is encrypted the next time
+    // the settings are saved.
+    return brillo::data_encoding::Base64Decode(ciphertext, plaintext);
+  }
+
+  brillo::SecureBlob key;
+  {
+    base::AutoLock auto_lock(lock_);
+    if (!EnsureKey())
+      return false;
+    key = key_;
+  }
+  return aead::Open(key, ciphertext.substr(kHeaderSize),
+                    ciphertext.substr(0, kHeaderSize), plaintext);
+}
+
+bool SoftwareEncryptor::EnsureKey() {
+  lock_.AssertAcquired();
+  if (!key_.empty())
+    return true;
+
+  if (base::PathExists(key_file_)) {
+    std::string contents;
+    if (!base::ReadFileToString(key_file_, &contents) ||
+        contents.size() != aead::kKeySize) {
+      LOG(ERROR) << "Invalid settings key file " << key_file_.value();
+      brillo::SecureMemset(&contents[0], 0, contents.size());
+      return false;
+    }
+    key_ = brillo::SecureBlob{contents};
+    brillo::SecureMemset(&contents[0], 0, contents.size());
+    return true;
+  }
+
+  brillo::SecureBlob key;
+  if (!aead::GenerateKey(&key) || !WriteKeyFile(key_file_, key))
+    return false;
+  key_ = key;
+  return true;
+}
+
+}  // namespace buffet
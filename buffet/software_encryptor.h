@@ -0,0 +1,55 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BUFFET_SOFTWARE_ENCRYPTOR_H_
+#define BUFFET_SOFTWARE_ENCRYPTOR_H_
+
+#include "buffet/encryptor.h"
+
+#include <string>
+
+#include <base/files/file_path.h>
+#include <base/synchronization/lock.h>
+#include <brillo/secure_blob.h>
+
+namespace buffet {
+
+// An Encryptor implementation that does AES-256-GCM in software, with a key
+// kept in a local file only readable by weaved. The key file is created on
+// first use. This is the default encryptor on platforms without keystore.
+// This class is thread-safe.
+class SoftwareEncryptor : public Encryptor {
+ public:
+  explicit SoftwareEncryptor(const base::FilePath& key_file);
+  ~SoftwareEncryptor() override;
+
+  bool EncryptWithAuthentication(const std::string& plaintext,
+                                 std::string* ciphertext) override;
+  bool DecryptWithAuthentication(const std::string& ciphertext,
+                                 std::string* plaintext) override;
+
+ private:
+  // Loads or creates the key in |key_file_| on first use.
+  bool EnsureKey();
+
+  const base::FilePath key_file_;
+  base::Lock lock_;
+  brillo::SecureBlob key_;
+
+  DISALLOW_COPY_AND_ASSIGN(SoftwareEncryptor);
+};
+
+}  // namespace buffet
+
+#endif  // BUFFET_SOFTWARE_ENCRYPTOR_H_
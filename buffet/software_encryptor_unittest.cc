@@ -0,0 +1,74 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "buffet/software_encryptor.h"
+
+#include <sys/stat.h>
+
+#include <base/files/file_util.h>
+#include <base/files/scoped_temp_dir.h>
+#include <brillo/data_encoding.h>
+#include <gtest/gtest.h>
+
+namespace buffet {
+
+class SoftwareEncryptorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    key_file_ = temp_dir_.path().Append("settings.key");
+  }
+
+  base::ScopedTempDir temp_dir_;
+  base::FilePath key_file_;
+};
+
+TEST_F(SoftwareEncryptorTest, EncryptAndDecrypt) {
+  std::string ciphertext;
+  {
+    SoftwareEncryptor encryptor{key_file_};
+    ASSERT_TRUE(encryptor.EncryptWithAuthentication("{\"secret\":42}",
+                                                    &ciphertext));
+    EXPECT_EQ(std::string::npos, ciphertext.find("secret"));
+  }
+
+  struct stat key_stat;
+  ASSERT_EQ(0, stat(key_file_.value().c_str(), &key_stat));
+  EXPECT_EQ(static_cast<mode_t>(S_IRUSR | S_IWUSR), key_stat.st_mode & 0777);
+
+  // A new instance loads the same key.
+  SoftwareEncryptor encryptor{key_file_};
+  std::string plaintext;
+  ASSERT_TRUE(encryptor.DecryptWithAuthentication(ciphertext, &plaintext));
+  EXPECT_EQ("{\"secret\":42}", plaintext);
+
+  ciphertext.back() ^= 1;
+  EXPECT_FALSE(encryptor.DecryptWithAuthentication(ciphertext, &plaintext));
+}
+
+TEST_F(SoftwareEncryptorTest, DecryptsLegacyBase64) {
+  SoftwareEncryptor encryptor{key_file_};
+  std::string plaintext;
+  ASSERT_TRUE(encryptor.DecryptWithAuthentication(
+      brillo::data_encoding::Base64Encode("{\"old\":true}"), &plaintext));
+  EXPECT_EQ("{\"old\":true}", plaintext);
+}
+
+TEST_F(SoftwareEncryptorTest, RejectsCorruptKeyFile) {
+  ASSERT_EQ(3, base::WriteFile(key_file_, "bad", 3));
+  SoftwareEncryptor encryptor{key_file_};
+  std::string ciphertext;
+  EXPECT_FALSE(encryptor.EncryptWithAuthentication("data", &ciphertext));
+}
+
+}  // namespace buffet
@@ -0,0 +1,58 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "buffet/stream_meter.h"
+
+#include <base/logging.h>
+
+namespace buffet {
+
+namespace {
+
+void AddToTotals(const StreamMeter::ConnectionStats& stats,
+                 StreamMeter::Totals* totals) {
+  totals->connections++;
+  totals->bytes_read += stats.bytes_read;
+  totals->bytes_written += stats.bytes_written;
+  totals->reads += stats.reads;
+  totals->writes += stats.writes;
+  totals->socket_bytes_read += stats.socket_bytes_read;
+  totals->socket_bytes_written += stats.socket_bytes_written;
+}
+
+}  // namespace
+
+void StreamMeter::AddConnection(const ConnectionStats* stats) {
+  CHECK(open_connections_.insert(stats).second);
+}
+
+void StreamMeter::RemoveConnection(const ConnectionStats* stats) {
+  CHECK_EQ(1u, open_connections_.erase(stats));
+  AddToTotals(*stats, &closed_totals_);
+}
+
+std::vector<const StreamMeter::ConnectionStats*>
+StreamMeter::GetOpenConnections() const {
+  return {open_connections_.begin(), open_connections_.end()};
+}
+
+StreamMeter::Totals StreamMeter::GetTotals() const {
+  Totals totals = closed_totals_;
+  for (const ConnectionStats* stats : open_connections_)
+    AddToTotals(*stats, &totals);
+  return totals;
+}
+
+}  // namespace buffet
@@ -0,0 +1,83 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef BUFFET_STREAM_METER_H_
+#define BUFFET_STREAM_METER_H_
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/time/time.h>
+
+namespace buffet {
+
+// Adds up the traffic and latency of weaved's cloud connections, e.g. to
+// track bandwidth on metered links and to spot slow ones.
+class StreamMeter final {
+ public:
+  // Figures of one connection, kept up to date by its stream.
+  struct ConnectionStats {
+    std::string host;
+    // Plaintext returned to the reader, in |reads| reads.
+    uint64_t bytes_read{0};
+    // Plaintext accepted by the TLS layer, in |writes| calls. Data that was
+    // queued but never sent is not counted.
+    uint64_t bytes_written{0};
+    uint64_t reads{0};
+    uint64_t writes{0};
+    // Ciphertext moved on the socket, including the handshake and the TLS
+    // framing.
+    uint64_t socket_bytes_read{0};
+    uint64_t socket_bytes_written{0};
+    base::TimeDelta handshake_duration;
+    // From the start of the connection attempt to the first byte read. Zero
+    // until a byte was read.
+    base::TimeDelta time_to_first_byte;
+  };
+
+  struct Totals {
+    uint64_t connections{0};
+    uint64_t bytes_read{0};
+    uint64_t bytes_written{0};
+    uint64_t reads{0};
+    uint64_t writes{0};
+    uint64_t socket_bytes_read{0};
+    uint64_t socket_bytes_written{0};
+  };
+
+  StreamMeter() = default;
+
+  // Starts reporting |stats| of an open connection. |stats| must stay valid
+  // until RemoveConnection().
+  void AddConnection(const ConnectionStats* stats);
+  // Moves the figures of a closed connection into the totals.
+  void RemoveConnection(const ConnectionStats* stats);
+
+  std::vector<const ConnectionStats*> GetOpenConnections() const;
+  // Totals over open and closed connections.
+  Totals GetTotals() const;
+
+ private:
+  std::set<const ConnectionStats*> open_connections_;
+  Totals closed_totals_;
+
+  DISALLOW_COPY_AND_ASSIGN(StreamMeter);
+};
+
+}  // namespace buffet
+
+#endif  // BUFFET_STREAM_METER_H_
@@ -0,0 +1,56 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "buffet/stream_meter.h"
+
+#include <gtest/gtest.h>
+
+namespace buffet {
+
+TEST(StreamMeterTest, Totals) {
+  StreamMeter meter;
+  StreamMeter::ConnectionStats first;
+  first.host = "www.example.com";
+  first.bytes_read = 100;
+  first.reads = 2;
+  StreamMeter::ConnectionStats second;
+  second.bytes_written = 50;
+  second.writes = 1;
+  second.socket_bytes_written = 80;
+
+  meter.AddConnection(&first);
+  meter.AddConnection(&second);
+  EXPECT_EQ(2u, meter.GetOpenConnections().size());
+
+  // Open connections are read when asked for.
+  first.bytes_read += 10;
+  StreamMeter::Totals totals = meter.GetTotals();
+  EXPECT_EQ(2u, totals.connections);
+  EXPECT_EQ(110u, totals.bytes_read);
+  EXPECT_EQ(50u, totals.bytes_written);
+  EXPECT_EQ(2u, totals.reads);
+  EXPECT_EQ(1u, totals.writes);
+  EXPECT_EQ(80u, totals.socket_bytes_written);
+
+  // Closed connections stay in the totals.
+  meter.RemoveConnection(&first);
+  ASSERT_EQ(1u, meter.GetOpenConnections().size());
+  EXPECT_EQ(&second, meter.GetOpenConnections()[0]);
+  totals = meter.GetTotals();
+  EXPECT_EQ(2u, totals.connections);
+  EXPECT_EQ(110u, totals.bytes_read);
+}
+
+}  // namespace buffet
@@ -0,0 +1,201 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/tcp_connector.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <base/bind.h>
+#include <base/logging.h>
+
+namespace buffet {
+
+namespace {
+
+const sockaddr* AsSockaddr(const SocketAddress& address) {
+  return reinterpret_cast<const sockaddr*>(&address.address);
+}
+
+}  // namespace
+
+std::vector<SocketAddress> InterleaveAddressFamilies(
+    const std::vector<SocketAddress>& addresses) {
+  if (addresses.empty())
+    return addresses;
+
+  sa_family_t first_family = addresses.front().address.ss_family;
+  std::vector<SocketAddress> preferred;
+  std::vector<SocketAddress> others;
+  for (const auto& address : addresses) {
+    if (address.address.ss_family == first_family)
+      preferred.push_back(address);
+    else
+      others.push_back(address);
+  }
+
+  std::vector<SocketAddress> result;
+  result.reserve(addresses.size());
+  for (size_t i = 0; i < preferred.size() || i < others.size(); i++) {
+    if (i < preferred.size())
+      result.push_back(preferred[i]);
+    if (i < others.size())
+      result.push_back(others[i]);
+  }
+  return result;
+}
+
+void TcpConnector::Connect(DnsCache* dns_cache,
+                           const std::string& host,
+                           uint16_t port,
+                           const Options& options,
+                           const Callback& callback) {
+  dns_cache->Resolve(host, port,
+                     base::Bind(&TcpConnector::OnResolved, options, callback));
+}
+
+void TcpConnector::ConnectToAddresses(
+    const std::vector<SocketAddress>& addresses,
+    const Options& options,
+    const Callback& callback) {
+  TcpConnector* connector = new TcpConnector{
+      InterleaveAddressFamilies(addresses), options, callback};
+  connector->StartNextAttempt();
+}
+
+void TcpConnector::OnResolved(const Options& options,
+                              const Callback& callback,
+                              const ResolveResult& result) {
+  if (result.addresses.empty()) {
+    callback.Run(-1, result.error);
+    return;
+  }
+  ConnectToAddresses(result.addresses, options, callback);
+}
+
+TcpConnector::TcpConnector(const std::vector<SocketAddress>& addresses,
+                           const Options& options,
+                           const Callback& callback)
+    : addresses_{addresses}, options_(options), callback_{callback} {}
+
+TcpConnector::~TcpConnector() {
+  while (!attempts_.empty()) {
+    int socket_fd = attempts_.begin()->first;
+    CancelAttempt(socket_fd);
+    close(socket_fd);
+  }
+  brillo::MessageLoop::current()->CancelTask(next_attempt_task_);
+}
+
+void TcpConnector::StartNextAttempt() {
+  brillo::MessageLoop* loop = brillo::MessageLoop::current();
+  loop->CancelTask(next_attempt_task_);
+  next_attempt_task_ = brillo::MessageLoop::kTaskIdNull;
+
+  while (next_address_ < addresses_.size()) {
+    const SocketAddress& address = addresses_[next_address_++];
+    const sockaddr* sa = AsSockaddr(address);
+    int socket_fd = socket(sa->sa_family,
+                           SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (socket_fd < 0) {
+      last_error_ = errno;
+      continue;
+    }
+
+    std::string addr = GetIPAddress(address);
+    VLOG(1) << "Connecting to address: " << addr;
+    if (connect(socket_fd, sa, address.length) == 0) {
+      Finish(socket_fd, 0);
+      return;
+    }
+    if (errno != EINPROGRESS) {
+      PLOG(WARNING) << "Failed to connect to address: " << addr;
+      last_error_ = errno;
+      close(socket_fd);
+      continue;
+    }
+
+    Attempt& attempt = attempts_[socket_fd];
+    attempt.watch_task = loop->WatchFileDescriptor(
+        FROM_HERE, socket_fd, brillo::MessageLoop::kWatchWrite, false,
+        base::Bind(&TcpConnector::OnAttemptWritable,
+                   weak_ptr_factory_.GetWeakPtr(), socket_fd));
+    attempt.timeout_task = loop->PostDelayedTask(
+        FROM_HERE,
+        base::Bind(&TcpConnector::OnAttemptTimeout,
+                   weak_ptr_factory_.GetWeakPtr(), socket_fd),
+        options_.attempt_timeout);
+    if (next_address_ < addresses_.size()) {
+      next_attempt_task_ = loop->PostDelayedTask(
+          FROM_HERE,
+          base::Bind(&TcpConnector::StartNextAttempt,
+                     weak_ptr_factory_.GetWeakPtr()),
+          options_.attempt_delay);
+    }
+    return;
+  }
+
+  // Nothing left to try; fail once the attempts in flight have failed too.
+  if (attempts_.empty())
+    Finish(-1, last_error_ ? last_error_ : ECONNREFUSED);
+}
+
+void TcpConnector::OnAttemptWritable(int socket_fd) {
+  // The watch is not persistent, so it is gone now.
+  attempts_[socket_fd].watch_task = brillo::MessageLoop::kTaskIdNull;
+  int error = 0;
+  socklen_t length = sizeof(error);
+  if (getsockopt(socket_fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0)
+    error = errno;
+  if (error != 0) {
+    OnAttemptFailed(socket_fd, error);
+    return;
+  }
+  CancelAttempt(socket_fd);
+  Finish(socket_fd, 0);
+}
+
+void TcpConnector::OnAttemptTimeout(int socket_fd) {
+  attempts_[socket_fd].timeout_task = brillo::MessageLoop::kTaskIdNull;
+  OnAttemptFailed(socket_fd, ETIMEDOUT);
+}
+
+void TcpConnector::OnAttemptFailed(int socket_fd, int error) {
+  LOG(WARNING) << "Connection attempt failed: " << strerror(error);
+  last_error_ = error;
+  CancelAttempt(socket_fd);
+  close(socket_fd);
+  // Do not wait for the attempt delay when an attempt fails.
+  StartNextAttempt();
+}
+
+void TcpConnector::CancelAttempt(int socket_fd) {
+  auto it = attempts_.find(socket_fd);
+  if (it == attempts_.end())
+    return;
+  brillo::MessageLoop* loop = brillo::MessageLoop::current();
+  loop->CancelTask(it->second.watch_task);
+  loop->CancelTask(it->second.timeout_task);
+  attempts_.erase(it);
+}
+
+void TcpConnector::Finish(int socket_fd, int error) {
+  Callback callback = callback_;
+  // Closes the sockets of the attempts that lost the race.
+  delete this;
+  callback.Run(socket_fd, error);
+}
+
+}  // namespace buffet
@@ -0,0 +1,107 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BUFFET_TCP_CONNECTOR_H_
+#define BUFFET_TCP_CONNECTOR_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <base/callback.h>
+#include <base/macros.h>
+#include <base/memory/weak_ptr.h>
+#include <base/time/time.h>
+#include <brillo/message_loops/message_loop.h>
+
+#include "buffet/dns_cache.h"
+
+namespace buffet {
+
+// Orders |addresses| for connection attempts as described in RFC 8305,
+// section 4: address families alternate, starting with the family of the
+// first address. The relative order within a family is kept.
+std::vector<SocketAddress> InterleaveAddressFamilies(
+    const std::vector<SocketAddress>& addresses);
+
+// Establishes a TCP connection using the "Happy Eyeballs" algorithm (RFC
+// 8305): non-blocking connection attempts are started one after another,
+// |attempt_delay| apart or as soon as the previous attempt fails, and the
+// first attempt to complete wins. All work except name resolution happens on
+// the current brillo::MessageLoop.
+class TcpConnector final {
+ public:
+  // Called with a connected non-blocking socket, or with -1 and an errno
+  // value.
+  using Callback = base::Callback<void(int socket_fd, int error)>;
+
+  struct Options {
+    // RFC 8305 "Connection Attempt Delay".
+    base::TimeDelta attempt_delay{base::TimeDelta::FromMilliseconds(250)};
+    // Abandons a single attempt that has not completed after this long.
+    base::TimeDelta attempt_timeout{base::TimeDelta::FromSeconds(10)};
+  };
+
+  // Resolves |host| through |dns_cache| and connects to |port|.
+  static void Connect(DnsCache* dns_cache,
+                      const std::string& host,
+                      uint16_t port,
+                      const Options& options,
+                      const Callback& callback);
+
+  // Connects to already resolved |addresses|.
+  static void ConnectToAddresses(const std::vector<SocketAddress>& addresses,
+                                 const Options& options,
+                                 const Callback& callback);
+
+ private:
+  struct Attempt {
+    brillo::MessageLoop::TaskId watch_task{brillo::MessageLoop::kTaskIdNull};
+    brillo::MessageLoop::TaskId timeout_task{brillo::MessageLoop::kTaskIdNull};
+  };
+
+  // Instances delete themselves once |callback_| has run.
+  TcpConnector(const std::vector<SocketAddress>& addresses,
+               const Options& options,
+               const Callback& callback);
+  ~TcpConnector();
+
+  static void OnResolved(const Options& options,
+                         const Callback& callback,
+                         const ResolveResult& result);
+
+  void StartNextAttempt();
+  void OnAttemptWritable(int socket_fd);
+  void OnAttemptTimeout(int socket_fd);
+  void OnAttemptFailed(int socket_fd, int error);
+  void CancelAttempt(int socket_fd);
+  void Finish(int socket_fd, int error);
+
+  std::vector<SocketAddress> addresses_;
+  size_t next_address_{0};
+  Options options_;
+  Callback callback_;
+  // In-flight attempts, keyed by socket.
+  std::map<int, Attempt> attempts_;
+  brillo::MessageLoop::TaskId next_attempt_task_{
+      brillo::MessageLoop::kTaskIdNull};
+  int last_error_{0};
+
+  base::WeakPtrFactory<TcpConnector> weak_ptr_factory_{this};
+  DISALLOW_COPY_AND_ASSIGN(TcpConnector);
+};
+
+}  // namespace buffet
+
+#endif  // BUFFET_TCP_CONNECTOR_H_
@@ -0,0 +1,181 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/tcp_connector.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <base/bind.h>
+#include <base/files/scoped_file.h>
+#include <base/message_loop/message_loop.h>
+#include <base/posix/eintr_wrapper.h>
+#include <brillo/bind_lambda.h>
+#include <brillo/message_loops/base_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
+#include <gtest/gtest.h>
+
+#include "buffet/io_worker_pool.h"
+
+namespace buffet {
+
+namespace {
+
+SocketAddress MakeAddress(int family, const char* ip, uint16_t port) {
+  SocketAddress address;
+  memset(&address.address, 0, sizeof(address.address));
+  if (family == AF_INET) {
+    sockaddr_in* sin = reinterpret_cast<sockaddr_in*>(&address.address);
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(port);
+    inet_pton(AF_INET, ip, &sin->sin_addr);
+    address.length = sizeof(sockaddr_in);
+  } else {
+    sockaddr_in6* sin6 = reinterpret_cast<sockaddr_in6*>(&address.address);
+    sin6->sin6_family = AF_INET6;
+    sin6->sin6_port = htons(port);
+    inet_pton(AF_INET6, ip, &sin6->sin6_addr);
+    address.length = sizeof(sockaddr_in6);
+  }
+  return address;
+}
+
+// Opens a listening socket on an ephemeral port of 127.0.0.1.
+base::ScopedFD Listen(uint16_t* port) {
+  base::ScopedFD fd{socket(AF_INET, SOCK_STREAM, 0)};
+  SocketAddress address = MakeAddress(AF_INET, "127.0.0.1", 0);
+  sockaddr* sa = reinterpret_cast<sockaddr*>(&address.address);
+  if (!fd.is_valid() || bind(fd.get(), sa, address.length) != 0 ||
+      listen(fd.get(), 4) != 0 ||
+      getsockname(fd.get(), sa, &address.length) != 0) {
+    return base::ScopedFD{};
+  }
+  *port = ntohs(reinterpret_cast<sockaddr_in*>(sa)->sin_port);
+  return fd;
+}
+
+}  // namespace
+
+class TcpConnectorTest : public ::testing::Test {
+ public:
+  void SetUp() override { brillo_loop_.SetAsCurrent(); }
+
+  TcpConnector::Callback StoreResult() {
+    return base::Bind(
+        [](TcpConnectorTest* test, int socket_fd, int error) {
+          test->done_ = true;
+          test->socket_fd_.reset(socket_fd);
+          test->error_ = error;
+        },
+        base::Unretained(this));
+  }
+
+  void RunUntilDone() {
+    brillo::MessageLoopRunUntil(&brillo_loop_, base::TimeDelta::FromSeconds(5),
+                                base::Bind([this]() { return done_; }));
+  }
+
+ protected:
+  base::MessageLoopForIO base_loop_;
+  brillo::BaseMessageLoop brillo_loop_{&base_loop_};
+  TcpConnector::Options options_;
+  bool done_{false};
+  base::ScopedFD socket_fd_;
+  int error_{0};
+};
+
+TEST_F(TcpConnectorTest, InterleaveAddressFamilies) {
+  std::vector<SocketAddress> addresses{
+      MakeAddress(AF_INET6, "2001:db8::1", 80),
+      MakeAddress(AF_INET6, "2001:db8::2", 80),
+      MakeAddress(AF_INET6, "2001:db8::3", 80),
+      MakeAddress(AF_INET, "192.0.2.1", 80),
+  };
+  auto result = InterleaveAddressFamilies(addresses);
+  ASSERT_EQ(4u, result.size());
+  EXPECT_EQ(0, memcmp(&addresses[0], &result[0], sizeof(SocketAddress)));
+  EXPECT_EQ(0, memcmp(&addresses[3], &result[1], sizeof(SocketAddress)));
+  EXPECT_EQ(0, memcmp(&addresses[1], &result[2], sizeof(SocketAddress)));
+  EXPECT_EQ(0, memcmp(&addresses[2], &result[3], sizeof(SocketAddress)));
+}
+
+TEST_F(TcpConnectorTest, FallsBackToWorkingAddress) {
+  uint16_t port = 0;
+  base::ScopedFD listener = Listen(&port);
+  ASSERT_TRUE(listener.is_valid());
+
+  // Nothing listens on ::1, so the first attempt fails (or cannot even start
+  // without IPv6) and the IPv4 attempt wins.
+  TcpConnector::ConnectToAddresses({MakeAddress(AF_INET6, "::1", port),
+                                    MakeAddress(AF_INET, "127.0.0.1", port)},
+                                   options_, StoreResult());
+  RunUntilDone();
+  ASSERT_TRUE(done_);
+  EXPECT_EQ(0, error_);
+  ASSERT_TRUE(socket_fd_.is_valid());
+
+  base::ScopedFD accepted{accept(listener.get(), nullptr, nullptr)};
+  ASSERT_TRUE(accepted.is_valid());
+  EXPECT_EQ(1, write(accepted.get(), "x", 1));
+  // The connected socket is non-blocking; block for the test's read.
+  ASSERT_EQ(0, fcntl(socket_fd_.get(), F_SETFL, 0));
+  char c = 0;
+  EXPECT_EQ(1, HANDLE_EINTR(read(socket_fd_.get(), &c, 1)));
+  EXPECT_EQ('x', c);
+}
+
+TEST_F(TcpConnectorTest, ResolvesThroughDnsCache) {
+  uint16_t port = 0;
+  base::ScopedFD listener = Listen(&port);
+  ASSERT_TRUE(listener.is_valid());
+
+  IoWorkerPool pool{1};
+  DnsCache dns_cache{&pool, DnsCache::Options{}};
+  TcpConnector::Connect(&dns_cache, "127.0.0.1", port, options_,
+                        StoreResult());
+  RunUntilDone();
+  ASSERT_TRUE(done_);
+  EXPECT_EQ(0, error_);
+  EXPECT_TRUE(socket_fd_.is_valid());
+}
+
+TEST_F(TcpConnectorTest, ReportsLastError) {
+  uint16_t port = 0;
+  {
+    // Grab a free port and close the listener again.
+    base::ScopedFD listener = Listen(&port);
+    ASSERT_TRUE(listener.is_valid());
+  }
+
+  TcpConnector::ConnectToAddresses({MakeAddress(AF_INET, "127.0.0.1", port)},
+                                   options_, StoreResult());
+  RunUntilDone();
+  ASSERT_TRUE(done_);
+  EXPECT_FALSE(socket_fd_.is_valid());
+  EXPECT_EQ(ECONNREFUSED, error_);
+}
+
+TEST_F(TcpConnectorTest, NoAddresses) {
+  TcpConnector::ConnectToAddresses({}, options_, StoreResult());
+  RunUntilDone();
+  ASSERT_TRUE(done_);
+  EXPECT_FALSE(socket_fd_.is_valid());
+  EXPECT_NE(0, error_);
+}
+
+}  // namespace buffet
@@ -0,0 +1,95 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/tls_session_cache.h"
+
+#include <base/logging.h>
+#include <openssl/x509v3.h>
+
+namespace buffet {
+
+namespace {
+
+// The same trust store brillo::TlsStream uses.
+#ifdef __ANDROID__
+const char kCACertificatePath[] = "/system/etc/security/cacerts_google";
+#else
+const char kCACertificatePath[] = "/usr/share/brillo-ca-certificates";
+#endif
+
+}  // namespace
+
+TlsSessionCache::TlsSessionCache()
+    : ctx_{SSL_CTX_new(TLSv1_2_client_method())} {
+  CHECK(ctx_);
+  SSL_CTX_set_verify(ctx_.get(), SSL_VERIFY_PEER, nullptr);
+  if (SSL_CTX_load_verify_locations(ctx_.get(), nullptr, kCACertificatePath) !=
+      1) {
+    LOG(ERROR) << "Failed to load CA certificates from " << kCACertificatePath;
+  }
+  // Clients never look sessions up in the internal cache; sessions are
+  // handed to OnNewSession() and offered again by CreateConnection().
+  SSL_CTX_set_session_cache_mode(
+      ctx_.get(), SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL);
+  SSL_CTX_sess_set_new_cb(ctx_.get(), &TlsSessionCache::OnNewSession);
+  SSL_CTX_set_app_data(ctx_.get(), this);
+}
+
+TlsSessionCache::~TlsSessionCache() = default;
+
+SSL* TlsSessionCache::CreateConnection(const std::string& host) {
+  SSL* ssl = SSL_new(ctx_.get());
+  if (!ssl)
+    return nullptr;
+  // SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER lets a write that has to wait for
+  // the socket be retried from a different buffer address.
+  SSL_set_mode(ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+  if (SSL_set_tlsext_host_name(ssl, host.c_str()) != 1 ||
+      X509_VERIFY_PARAM_set1_host(SSL_get0_param(ssl), host.data(),
+                                  host.size()) != 1) {
+    SSL_free(ssl);
+    return nullptr;
+  }
+  auto it = sessions_.find(host);
+  if (it != sessions_.end())
+    SSL_set_session(ssl, it->second.get());
+  return ssl;
+}
+
+void TlsSessionCache::AddTrustedCertificate(X509* certificate) {
+  X509_STORE_add_cert(SSL_CTX_get_cert_store(ctx_.get()), certificate);
+}
+
+void TlsSessionCache::OnHandshakeDone(SSL* ssl) {
+  if (SSL_session_reused(ssl))
+    stats_.resumed_handshakes++;
+  else
+    stats_.full_handshakes++;
+}
+
+void TlsSessionCache::RemoveSession(const std::string& host) {
+  sessions_.erase(host);
+}
+
+int TlsSessionCache::OnNewSession(SSL* ssl, SSL_SESSION* session) {
+  TlsSessionCache* cache = static_cast<TlsSessionCache*>(
+      SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+  const char* host = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+  if (!host)
+    return 0;
+  cache->sessions_[host].reset(session);
+  return 1;
+}
+
+}  // namespace buffet
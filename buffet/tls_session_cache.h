@@ -0,0 +1,78 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BUFFET_TLS_SESSION_CACHE_H_
+#define BUFFET_TLS_SESSION_CACHE_H_
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include <base/macros.h>
+#include <openssl/ssl.h>
+
+namespace buffet {
+
+// Holds the TLS client context shared by weaved's cloud connections, and the
+// last session negotiated with each host. Offering that session (by session
+// ticket or session ID) on the next connection lets the server skip the full
+// handshake.
+class TlsSessionCache final {
+ public:
+  struct Stats {
+    uint64_t full_handshakes{0};
+    uint64_t resumed_handshakes{0};
+  };
+
+  TlsSessionCache();
+  ~TlsSessionCache();
+
+  // Creates a connection to |host| that verifies the server certificate and
+  // offers the cached session of |host|, if any.
+  SSL* CreateConnection(const std::string& host);
+
+  // Trusts |certificate| in addition to the system CA certificates, e.g. for
+  // a local test server.
+  void AddTrustedCertificate(X509* certificate);
+
+  // Records whether the handshake of |ssl| resumed a session.
+  void OnHandshakeDone(SSL* ssl);
+
+  // Forgets the session of |host|, e.g. after a failed handshake.
+  void RemoveSession(const std::string& host);
+
+  const Stats& GetStats() const { return stats_; }
+
+ private:
+  struct SslCtxDeleter {
+    void operator()(SSL_CTX* ctx) const { SSL_CTX_free(ctx); }
+  };
+  struct SslSessionDeleter {
+    void operator()(SSL_SESSION* session) const { SSL_SESSION_free(session); }
+  };
+
+  // SSL_CTX new session callback. Takes ownership of |session|.
+  static int OnNewSession(SSL* ssl, SSL_SESSION* session);
+
+  std::unique_ptr<SSL_CTX, SslCtxDeleter> ctx_;
+  std::map<std::string, std::unique_ptr<SSL_SESSION, SslSessionDeleter>>
+      sessions_;
+  Stats stats_;
+
+  DISALLOW_COPY_AND_ASSIGN(TlsSessionCache);
+};
+
+}  // namespace buffet
+
+#endif  // BUFFET_TLS_SESSION_CACHE_H_
@@ -0,0 +1,42 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/tls_session_cache.h"
+
+#include <gtest/gtest.h>
+
+namespace buffet {
+
+TEST(TlsSessionCacheTest, CreateConnection) {
+  TlsSessionCache cache;
+  SSL* ssl = cache.CreateConnection("www.example.com");
+  ASSERT_NE(nullptr, ssl);
+  EXPECT_STREQ("www.example.com",
+               SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name));
+  // Nothing to resume yet.
+  EXPECT_EQ(nullptr, SSL_get_session(ssl));
+  SSL_free(ssl);
+}
+
+TEST(TlsSessionCacheTest, CountsHandshakes) {
+  TlsSessionCache cache;
+  SSL* ssl = cache.CreateConnection("www.example.com");
+  ASSERT_NE(nullptr, ssl);
+  cache.OnHandshakeDone(ssl);
+  EXPECT_EQ(1u, cache.GetStats().full_handshakes);
+  EXPECT_EQ(0u, cache.GetStats().resumed_handshakes);
+  SSL_free(ssl);
+}
+
+}  // namespace buffet
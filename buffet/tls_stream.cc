@@ -0,0 +1,502 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/tls_stream.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <limits>
+
+#include <base/bind.h>
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+#include <brillo/errors/error_codes.h>
+#include <openssl/bio.h>
+#include <openssl/err.h>
+
+#include "buffet/dns_cache.h"
+#include "buffet/tcp_connector.h"
+#include "buffet/tls_session_cache.h"
+#include "buffet/weave_error_conversion.h"
+
+namespace buffet {
+
+using weave::provider::Network;
+
+const char kDnsErrorCode[] = "dns_error";
+const char kTcpErrorCode[] = "tcp_error";
+const char kTlsErrorCode[] = "tls_error";
+
+namespace {
+
+// Largest TLS record payload, so a read-ahead buffer holds a whole record.
+const size_t kReadAheadSize = 16 * 1024;
+
+// Writes are acknowledged while less than this much data is queued.
+const size_t kMaxQueuedWriteSize = 64 * 1024;
+
+// SSL_read() and SSL_write() take int sizes.
+int ClampSize(size_t size) {
+  return static_cast<int>(
+      std::min<size_t>(size, std::numeric_limits<int>::max()));
+}
+
+// Socket BIO that adds the ciphertext it moves, TLS framing and handshake
+// included, to the StreamMeter::ConnectionStats in |bio->ptr|. The socket in
+// |bio->num| is owned by the stream. Uses read() and write(), like the socket
+// BIO, which weaved runs with SIGPIPE ignored.
+int CountingSocketWrite(BIO* bio, const char* data, int size) {
+  BIO_clear_retry_flags(bio);
+  ssize_t ret = HANDLE_EINTR(write(bio->num, data, size));
+  if (ret < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      BIO_set_retry_write(bio);
+    return -1;
+  }
+  static_cast<StreamMeter::ConnectionStats*>(bio->ptr)->socket_bytes_written +=
+      ret;
+  return static_cast<int>(ret);
+}
+
+int CountingSocketRead(BIO* bio, char* data, int size) {
+  BIO_clear_retry_flags(bio);
+  ssize_t ret = HANDLE_EINTR(read(bio->num, data, size));
+  if (ret < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      BIO_set_retry_read(bio);
+    return -1;
+  }
+  static_cast<StreamMeter::ConnectionStats*>(bio->ptr)->socket_bytes_read +=
+      ret;
+  return static_cast<int>(ret);
+}
+
+long CountingSocketCtrl(BIO* bio, int command, long number, void* pointer) {
+  // Writes go straight to the socket.
+  return command == BIO_CTRL_FLUSH ? 1 : 0;
+}
+
+const BIO_METHOD kCountingSocketMethod = {
+    BIO_TYPE_SOCKET,
+    "counting socket",
+    CountingSocketWrite,
+    CountingSocketRead,
+    nullptr,  // puts
+    nullptr,  // gets
+    CountingSocketCtrl,
+    nullptr,  // create
+    nullptr,  // destroy; the socket is closed by the stream.
+    nullptr,  // callback_ctrl
+};
+
+weave::ErrorPtr CreateSystemError(int error) {
+  brillo::ErrorPtr brillo_error;
+  brillo::errors::system::AddSystemError(&brillo_error, FROM_HERE, error);
+  weave::ErrorPtr weave_error;
+  ConvertError(*brillo_error, &weave_error);
+  return weave_error;
+}
+
+}  // namespace
+
+TlsStream::TlsStream(const std::string& host,
+                     TlsSessionCache* session_cache,
+                     const ConnectOptions& options,
+                     const Network::OpenSslSocketCallback& callback)
+    : host_{host},
+      session_cache_{session_cache},
+      connect_options_(options),
+      connect_callback_{callback},
+      connect_start_time_{base::TimeTicks::Now()} {
+  traffic_stats_.host = host;
+}
+
+TlsStream::~TlsStream() {
+  CancelPendingOperations();
+  brillo::MessageLoop* loop = brillo::MessageLoop::current();
+  loop->CancelTask(handshake_task_);
+  loop->CancelTask(deadline_task_);
+  loop->CancelTask(flush_task_);
+  // Best effort flush and close_notify; the socket is non-blocking. Neither
+  // is tried once a flush failed.
+  if (ssl_ && SSL_is_init_finished(ssl_.get()) && write_error_.empty()) {
+    if (QueuedWriteSize() > 0) {
+      int ret = SSL_write(ssl_.get(), write_queue_.data() + write_queue_offset_,
+                          ClampSize(QueuedWriteSize()));
+      if (ret > 0) {
+        traffic_stats_.bytes_written += ret;
+        traffic_stats_.writes++;
+      }
+    }
+    SSL_shutdown(ssl_.get());
+  }
+  // After the last bytes were counted.
+  if (metered_)
+    connect_options_.meter->RemoveConnection(&traffic_stats_);
+}
+
+base::Closure TlsStream::Connect(
+    DnsCache* dns_cache,
+    TlsSessionCache* session_cache,
+    const std::string& host,
+    uint16_t port,
+    const ConnectOptions& options,
+    const Network::OpenSslSocketCallback& callback) {
+  TlsStream* stream = new TlsStream{host, session_cache, options, callback};
+  base::WeakPtr<TlsStream> weak_stream = stream->weak_ptr_factory_.GetWeakPtr();
+  stream->deadline_task_ = brillo::MessageLoop::current()->PostDelayedTask(
+      FROM_HERE, base::Bind(&TlsStream::OnConnectTimeout, weak_stream),
+      options.connect_timeout);
+  dns_cache->Resolve(host, port,
+                     base::Bind(&TlsStream::OnResolved, weak_stream, port));
+  return base::Bind(&TlsStream::AbortConnect, weak_stream);
+}
+
+void TlsStream::OnResolved(uint16_t port, const ResolveResult& result) {
+  if (result.addresses.empty()) {
+    FailConnect(CreateSystemError(result.error));
+    return;
+  }
+  connect_step_ = ConnectStep::kConnect;
+  TcpConnector::ConnectToAddresses(
+      result.addresses, TcpConnector::Options{},
+      base::Bind(&TlsStream::OnSocketConnected,
+                 weak_ptr_factory_.GetWeakPtr()));
+}
+
+void TlsStream::OnSocketConnected(base::WeakPtr<TlsStream> stream,
+                                  int socket_fd,
+                                  int error) {
+  if (!stream) {
+    if (socket_fd >= 0)
+      close(socket_fd);
+    return;
+  }
+  if (socket_fd < 0) {
+    stream->FailConnect(CreateSystemError(error));
+    return;
+  }
+  stream->StartHandshake(socket_fd);
+}
+
+void TlsStream::StartHandshake(int socket_fd) {
+  socket_fd_.reset(socket_fd);
+  connect_step_ = ConnectStep::kHandshake;
+  handshake_start_time_ = base::TimeTicks::Now();
+  brillo::MessageLoop* loop = brillo::MessageLoop::current();
+  loop->CancelTask(deadline_task_);
+  deadline_task_ = loop->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&TlsStream::OnConnectTimeout, weak_ptr_factory_.GetWeakPtr()),
+      connect_options_.handshake_timeout);
+
+  ssl_.reset(session_cache_->CreateConnection(host_));
+  BIO* bio = ssl_ ? BIO_new(&kCountingSocketMethod) : nullptr;
+  if (!bio) {
+    weave::ErrorPtr error;
+    weave::Error::AddTo(&error, FROM_HERE, kTlsErrorCode,
+                        "Failed to create TLS connection");
+    FailConnect(std::move(error));
+    return;
+  }
+  bio->num = socket_fd;
+  bio->ptr = &traffic_stats_;
+  bio->init = 1;
+  // |ssl_| owns the BIO.
+  SSL_set_bio(ssl_.get(), bio, bio);
+  ContinueHandshake();
+}
+
+void TlsStream::ContinueHandshake() {
+  handshake_task_ = brillo::MessageLoop::kTaskIdNull;
+  int ret = SSL_connect(ssl_.get());
+  if (ret == 1) {
+    session_cache_->OnHandshakeDone(ssl_.get());
+    traffic_stats_.handshake_duration =
+        base::TimeTicks::Now() - handshake_start_time_;
+    if (connect_options_.meter) {
+      connect_options_.meter->AddConnection(&traffic_stats_);
+      metered_ = true;
+    }
+    FinishConnect(nullptr);
+    return;
+  }
+
+  weave::ErrorPtr error;
+  IoResult result = GetIoResult(ret, &error);
+  if (result == IoResult::kWantRead || result == IoResult::kWantWrite) {
+    handshake_task_ = WaitForSocket(
+        result, base::Bind(&TlsStream::ContinueHandshake,
+                           weak_ptr_factory_.GetWeakPtr()));
+    return;
+  }
+  // Do not offer a session the server just rejected.
+  session_cache_->RemoveSession(host_);
+  FailConnect(std::move(error));
+}
+
+void TlsStream::OnConnectTimeout() {
+  deadline_task_ = brillo::MessageLoop::kTaskIdNull;
+  FailConnect(CreateSystemError(ETIMEDOUT));
+}
+
+void TlsStream::AbortConnect() {
+  // The closure outlives a successful attempt; the stream is not ours then.
+  if (connect_step_ == ConnectStep::kDone)
+    return;
+  VLOG(1) << "Aborting connection to " << host_;
+  delete this;
+}
+
+void TlsStream::FailConnect(weave::ErrorPtr inner_error) {
+  weave::ErrorPtr error = std::move(inner_error);
+  switch (connect_step_) {
+    case ConnectStep::kResolve:
+      weave::Error::AddTo(&error, FROM_HERE, kDnsErrorCode,
+                          "Failed to resolve " + host_);
+      break;
+    case ConnectStep::kConnect:
+      weave::Error::AddTo(&error, FROM_HERE, kTcpErrorCode,
+                          "Failed to connect to " + host_);
+      break;
+    case ConnectStep::kHandshake:
+    case ConnectStep::kDone:
+      weave::Error::AddTo(&error, FROM_HERE, kTlsErrorCode,
+                          "TLS handshake with " + host_ + " failed");
+      break;
+  }
+  FinishConnect(std::move(error));
+}
+
+void TlsStream::FinishConnect(weave::ErrorPtr error) {
+  connect_step_ = ConnectStep::kDone;
+  brillo::MessageLoop::current()->CancelTask(deadline_task_);
+  deadline_task_ = brillo::MessageLoop::kTaskIdNull;
+  Network::OpenSslSocketCallback callback = connect_callback_;
+  connect_callback_.Reset();
+  std::unique_ptr<TlsStream> stream{this};
+  if (error) {
+    stream.reset();
+    callback.Run(nullptr, std::move(error));
+    return;
+  }
+  callback.Run(std::move(stream), nullptr);
+}
+
+void TlsStream::Read(void* buffer,
+                     size_t size_to_read,
+                     const ReadCallback& callback) {
+  CHECK(read_callback_.is_null()) << "Only one read may be pending";
+  read_buffer_ = buffer;
+  read_size_ = size_to_read;
+  read_callback_ = callback;
+  // Callbacks never run before Read() returns.
+  read_task_ = brillo::MessageLoop::current()->PostTask(
+      FROM_HERE,
+      base::Bind(&TlsStream::ContinueRead, weak_ptr_factory_.GetWeakPtr()));
+}
+
+void TlsStream::ContinueRead() {
+  read_task_ = brillo::MessageLoop::kTaskIdNull;
+  if (read_ahead_begin_ == read_ahead_end_) {
+    read_ahead_.resize(kReadAheadSize);
+    int ret = SSL_read(ssl_.get(), read_ahead_.data(), read_ahead_.size());
+    if (ret <= 0) {
+      weave::ErrorPtr error;
+      IoResult result = GetIoResult(ret, &error);
+      if (result == IoResult::kWantRead || result == IoResult::kWantWrite) {
+        read_task_ = WaitForSocket(
+            result, base::Bind(&TlsStream::ContinueRead,
+                               weak_ptr_factory_.GetWeakPtr()));
+        return;
+      }
+      // Reading 0 bytes signals the end of the stream.
+      if (result == IoResult::kClosed)
+        error.reset();
+      FinishRead(0, std::move(error));
+      return;
+    }
+    read_ahead_begin_ = 0;
+    read_ahead_end_ = ret;
+  }
+
+  size_t size_read = std::min(read_size_, read_ahead_end_ - read_ahead_begin_);
+  memcpy(read_buffer_, read_ahead_.data() + read_ahead_begin_, size_read);
+  read_ahead_begin_ += size_read;
+  FinishRead(size_read, nullptr);
+}
+
+void TlsStream::FinishRead(size_t size_read, weave::ErrorPtr error) {
+  if (size_read > 0) {
+    if (traffic_stats_.bytes_read == 0) {
+      traffic_stats_.time_to_first_byte =
+          base::TimeTicks::Now() - connect_start_time_;
+    }
+    traffic_stats_.bytes_read += size_read;
+    traffic_stats_.reads++;
+  }
+  ReadCallback callback = read_callback_;
+  read_callback_.Reset();
+  callback.Run(size_read, std::move(error));
+}
+
+void TlsStream::Write(const void* buffer,
+                      size_t size_to_write,
+                      const WriteCallback& callback) {
+  CHECK(write_callback_.is_null()) << "Only one write may be pending";
+  write_callback_ = callback;
+  if (!write_error_.empty()) {
+    weave::ErrorPtr error;
+    weave::Error::AddTo(&error, FROM_HERE, kTlsErrorCode, write_error_);
+    write_task_ = brillo::MessageLoop::current()->PostTask(
+        FROM_HERE, base::Bind(&TlsStream::FinishWrite,
+                              weak_ptr_factory_.GetWeakPtr(),
+                              base::Passed(&error)));
+    return;
+  }
+
+  const uint8_t* data = static_cast<const uint8_t*>(buffer);
+  write_queue_.insert(write_queue_.end(), data, data + size_to_write);
+  ScheduleFlush();
+  // Otherwise ContinueFlush() acknowledges the write once the queue drains.
+  if (QueuedWriteSize() <= kMaxQueuedWriteSize) {
+    write_task_ = brillo::MessageLoop::current()->PostTask(
+        FROM_HERE, base::Bind(&TlsStream::FinishWrite,
+                              weak_ptr_factory_.GetWeakPtr(), nullptr));
+  }
+}
+
+void TlsStream::ScheduleFlush() {
+  if (flush_task_ != brillo::MessageLoop::kTaskIdNull)
+    return;
+  flush_task_ = brillo::MessageLoop::current()->PostTask(
+      FROM_HERE,
+      base::Bind(&TlsStream::ContinueFlush, weak_ptr_factory_.GetWeakPtr()));
+}
+
+void TlsStream::ContinueFlush() {
+  flush_task_ = brillo::MessageLoop::kTaskIdNull;
+  if (write_task_ != brillo::MessageLoop::kTaskIdNull) {
+    // The writer may queue more data once its write is acknowledged. Let that
+    // go out with the same SSL_write().
+    ScheduleFlush();
+    return;
+  }
+  while (QueuedWriteSize() > 0) {
+    int ret = SSL_write(ssl_.get(), write_queue_.data() + write_queue_offset_,
+                        ClampSize(QueuedWriteSize()));
+    if (ret > 0) {
+      write_queue_offset_ += ret;
+      traffic_stats_.bytes_written += ret;
+      traffic_stats_.writes++;
+      continue;
+    }
+
+    weave::ErrorPtr error;
+    IoResult result = GetIoResult(ret, &error);
+    if (result == IoResult::kWantRead || result == IoResult::kWantWrite) {
+      flush_task_ = WaitForSocket(
+          result, base::Bind(&TlsStream::ContinueFlush,
+                             weak_ptr_factory_.GetWeakPtr()));
+      break;
+    }
+    write_error_ = error->GetMessage();
+    write_queue_.clear();
+    write_queue_offset_ = 0;
+    if (!write_callback_.is_null() &&
+        write_task_ == brillo::MessageLoop::kTaskIdNull) {
+      FinishWrite(std::move(error));
+    }
+    return;
+  }
+
+  if (QueuedWriteSize() == 0) {
+    write_queue_.clear();
+    write_queue_offset_ = 0;
+  } else if (write_queue_offset_ > write_queue_.size() / 2) {
+    // SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER allows moving the pending data.
+    write_queue_.erase(write_queue_.begin(),
+                       write_queue_.begin() + write_queue_offset_);
+    write_queue_offset_ = 0;
+  }
+  if (!write_callback_.is_null() &&
+      write_task_ == brillo::MessageLoop::kTaskIdNull &&
+      QueuedWriteSize() <= kMaxQueuedWriteSize) {
+    FinishWrite(nullptr);
+  }
+}
+
+void TlsStream::FinishWrite(weave::ErrorPtr error) {
+  write_task_ = brillo::MessageLoop::kTaskIdNull;
+  WriteCallback callback = write_callback_;
+  write_callback_.Reset();
+  callback.Run(std::move(error));
+}
+
+void TlsStream::CancelPendingOperations() {
+  brillo::MessageLoop* loop = brillo::MessageLoop::current();
+  loop->CancelTask(read_task_);
+  loop->CancelTask(write_task_);
+  read_task_ = brillo::MessageLoop::kTaskIdNull;
+  write_task_ = brillo::MessageLoop::kTaskIdNull;
+  read_callback_.Reset();
+  write_callback_.Reset();
+  // Data that was already acknowledged is still flushed.
+}
+
+TlsStream::IoResult TlsStream::GetIoResult(int ret, weave::ErrorPtr* error) {
+  int ssl_error = SSL_get_error(ssl_.get(), ret);
+  switch (ssl_error) {
+    case SSL_ERROR_WANT_READ:
+      return IoResult::kWantRead;
+    case SSL_ERROR_WANT_WRITE:
+      return IoResult::kWantWrite;
+    case SSL_ERROR_ZERO_RETURN:
+      weave::Error::AddTo(error, FROM_HERE, kTlsErrorCode,
+                          "Connection closed by peer");
+      return IoResult::kClosed;
+    case SSL_ERROR_SYSCALL:
+      if (ret == 0 && ERR_peek_error() == 0) {
+        weave::Error::AddTo(error, FROM_HERE, kTlsErrorCode,
+                            "Unexpected end of stream");
+        return IoResult::kClosed;
+      }
+      if (ERR_peek_error() == 0) {
+        *error = CreateSystemError(errno);
+        return IoResult::kError;
+      }
+      break;
+  }
+
+  char message[256] = {};
+  ERR_error_string_n(ERR_get_error(), message, sizeof(message));
+  ERR_clear_error();
+  weave::Error::AddTo(error, FROM_HERE, kTlsErrorCode, message);
+  return IoResult::kError;
+}
+
+brillo::MessageLoop::TaskId TlsStream::WaitForSocket(
+    IoResult result,
+    const base::Closure& task) {
+  return brillo::MessageLoop::current()->WatchFileDescriptor(
+      FROM_HERE, socket_fd_.get(),
+      result == IoResult::kWantRead ? brillo::MessageLoop::kWatchRead
+                                    : brillo::MessageLoop::kWatchWrite,
+      false, task);
+}
+
+}  // namespace buffet
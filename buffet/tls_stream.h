@@ -0,0 +1,184 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BUFFET_TLS_STREAM_H_
+#define BUFFET_TLS_STREAM_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/callback.h>
+#include <base/files/scoped_file.h>
+#include <base/macros.h>
+#include <base/memory/weak_ptr.h>
+#include <base/time/time.h>
+#include <brillo/message_loops/message_loop.h>
+#include <openssl/ssl.h>
+#include <weave/provider/network.h>
+#include <weave/stream.h>
+
+#include "buffet/stream_meter.h"
+
+namespace buffet {
+
+class DnsCache;
+class TlsSessionCache;
+struct ResolveResult;
+
+// Codes of the errors of a failed TlsStream::Connect(), by the step that
+// failed. The inner error holds the cause, e.g. ETIMEDOUT.
+extern const char kDnsErrorCode[];
+extern const char kTcpErrorCode[];
+extern const char kTlsErrorCode[];
+
+// TLS client stream over a non-blocking socket, used for weaved's cloud
+// connections. Unlike brillo::TlsStream it exposes the TLS session, so that
+// reconnects can resume it through a TlsSessionCache.
+//
+// XMPP traffic is a stream of small stanzas. Reads are served from a
+// read-ahead buffer that holds a whole TLS record. Writes are queued and
+// acknowledged right away. The queue is flushed with a single SSL_write() once
+// no acknowledgement is pending, so a burst of writes, each made from the
+// callback of the one before, goes out together.
+class TlsStream final : public weave::Stream {
+ public:
+  ~TlsStream() override;
+
+  void Read(void* buffer,
+            size_t size_to_read,
+            const ReadCallback& callback) override;
+
+  void Write(const void* buffer,
+             size_t size_to_write,
+             const WriteCallback& callback) override;
+
+  void CancelPendingOperations() override;
+
+  struct ConnectOptions {
+    // Limit for resolving the host and connecting the socket.
+    base::TimeDelta connect_timeout{base::TimeDelta::FromSeconds(30)};
+    // Limit for the TLS handshake.
+    base::TimeDelta handshake_timeout{base::TimeDelta::FromSeconds(30)};
+    // Receives the traffic figures of the connection once it is established.
+    StreamMeter* meter{nullptr};
+  };
+
+  // Resolves |host| through |dns_cache|, connects to |port| and performs a
+  // TLS handshake, resuming the session in |session_cache| when possible.
+  // Running the returned closure before |callback| has run aborts the attempt
+  // and |callback| never runs; afterwards the closure does nothing.
+  static base::Closure Connect(
+      DnsCache* dns_cache,
+      TlsSessionCache* session_cache,
+      const std::string& host,
+      uint16_t port,
+      const ConnectOptions& options,
+      const weave::provider::Network::OpenSslSocketCallback& callback);
+
+ private:
+  enum class ConnectStep { kResolve, kConnect, kHandshake, kDone };
+
+  // Outcome of a single SSL_*() call on the non-blocking socket.
+  enum class IoResult { kWantRead, kWantWrite, kClosed, kError };
+
+  struct SslDeleter {
+    void operator()(SSL* ssl) const { SSL_free(ssl); }
+  };
+
+  // Instances are owned by the connection attempt until it succeeds.
+  TlsStream(const std::string& host,
+            TlsSessionCache* session_cache,
+            const ConnectOptions& options,
+            const weave::provider::Network::OpenSslSocketCallback& callback);
+
+  void OnResolved(uint16_t port, const ResolveResult& result);
+  // Closes |socket_fd| if the attempt was aborted in the meantime.
+  static void OnSocketConnected(base::WeakPtr<TlsStream> stream,
+                                int socket_fd,
+                                int error);
+  void StartHandshake(int socket_fd);
+  void ContinueHandshake();
+  void OnConnectTimeout();
+  void AbortConnect();
+  // Fails the current step of the connection attempt with |inner_error| as
+  // the cause.
+  void FailConnect(weave::ErrorPtr inner_error);
+  // Hands this stream to |connect_callback_|, or deletes it on |error|.
+  void FinishConnect(weave::ErrorPtr error);
+  void ContinueRead();
+  // Runs and clears |read_callback_|.
+  void FinishRead(size_t size_read, weave::ErrorPtr error);
+  // Posts a flush of |write_queue_| unless one is pending already.
+  void ScheduleFlush();
+  void ContinueFlush();
+  // Runs and clears |write_callback_|.
+  void FinishWrite(weave::ErrorPtr error);
+  size_t QueuedWriteSize() const {
+    return write_queue_.size() - write_queue_offset_;
+  }
+
+  // Classifies the failed SSL call that returned |ret|. Fills |error| unless
+  // the call only has to wait for the socket.
+  IoResult GetIoResult(int ret, weave::ErrorPtr* error);
+  // Runs |task| once the socket is ready for what |result| waits for.
+  brillo::MessageLoop::TaskId WaitForSocket(IoResult result,
+                                            const base::Closure& task);
+
+  base::ScopedFD socket_fd_;
+  std::unique_ptr<SSL, SslDeleter> ssl_;
+  std::string host_;
+  TlsSessionCache* session_cache_{nullptr};
+
+  ConnectStep connect_step_{ConnectStep::kResolve};
+  ConnectOptions connect_options_;
+  weave::provider::Network::OpenSslSocketCallback connect_callback_;
+  brillo::MessageLoop::TaskId handshake_task_{brillo::MessageLoop::kTaskIdNull};
+  // Fires when the current step of the connection attempt takes too long.
+  brillo::MessageLoop::TaskId deadline_task_{brillo::MessageLoop::kTaskIdNull};
+  base::TimeTicks connect_start_time_;
+  base::TimeTicks handshake_start_time_;
+
+  // Registered with |connect_options_.meter| while the connection is open.
+  StreamMeter::ConnectionStats traffic_stats_;
+  bool metered_{false};
+
+  void* read_buffer_{nullptr};
+  size_t read_size_{0};
+  ReadCallback read_callback_;
+  brillo::MessageLoop::TaskId read_task_{brillo::MessageLoop::kTaskIdNull};
+  // Plaintext that was read from the connection but not returned yet lives
+  // in read_ahead_[read_ahead_begin_, read_ahead_end_).
+  std::vector<uint8_t> read_ahead_;
+  size_t read_ahead_begin_{0};
+  size_t read_ahead_end_{0};
+
+  // Plaintext accepted by Write() but not passed to SSL_write() yet starts at
+  // |write_queue_offset_|.
+  std::vector<uint8_t> write_queue_;
+  size_t write_queue_offset_{0};
+  // A write is acknowledged once the queue is below a limit.
+  WriteCallback write_callback_;
+  brillo::MessageLoop::TaskId write_task_{brillo::MessageLoop::kTaskIdNull};
+  brillo::MessageLoop::TaskId flush_task_{brillo::MessageLoop::kTaskIdNull};
+  // Why flushing failed. Reported to every later write.
+  std::string write_error_;
+
+  base::WeakPtrFactory<TlsStream> weak_ptr_factory_{this};
+  DISALLOW_COPY_AND_ASSIGN(TlsStream);
+};
+
+}  // namespace buffet
+
+#endif  // BUFFET_TLS_STREAM_H_
@@ -0,0 +1,176 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/logging.h>
+#include <base/message_loop/message_loop.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_split.h>
+#include <base/strings/string_util.h>
+#include <base/strings/stringprintf.h>
+#include <benchmark/benchmark.h>
+#include <brillo/bind_lambda.h>
+#include <brillo/message_loops/base_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
+#include <openssl/ssl.h>
+
+#include "buffet/dns_cache.h"
+#include "buffet/io_worker_pool.h"
+#include "buffet/tls_session_cache.h"
+#include "buffet/tls_stream.h"
+#include "buffet/tls_test_server.h"
+
+namespace buffet {
+
+namespace {
+
+// XMPP sends bursts of stanzas.
+const int kMessagesPerIteration = 16;
+
+// Read and write system calls of the whole process, from /proc/self/io.
+uint64_t CountSyscalls() {
+  std::string io;
+  if (!base::ReadFileToString(base::FilePath{"/proc/self/io"}, &io))
+    return 0;
+  uint64_t total = 0;
+  for (const std::string& line : base::SplitString(
+           io, "\n", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY)) {
+    if (!base::StartsWith(line, "syscr:", base::CompareCase::SENSITIVE) &&
+        !base::StartsWith(line, "syscw:", base::CompareCase::SENSITIVE)) {
+      continue;
+    }
+    uint64_t value = 0;
+    std::string number;
+    base::TrimWhitespaceASCII(line.substr(6), base::TRIM_ALL, &number);
+    if (base::StringToUint64(number, &value))
+      total += value;
+  }
+  return total;
+}
+
+// Echoes everything back.
+void Echo(SSL* ssl, int fd) {
+  char buffer[16 * 1024];
+  int size = 0;
+  while ((size = SSL_read(ssl, buffer, sizeof(buffer))) > 0) {
+    if (SSL_write(ssl, buffer, size) != size)
+      break;
+  }
+}
+
+// Writes a burst of messages, one Write() after another as libweave does, and
+// reads the echo back with message-sized reads.
+class EchoClient final {
+ public:
+  EchoClient(weave::Stream* stream, size_t message_size)
+      : stream_{stream}, message_(message_size, 'x'), buffer_(message_size) {}
+
+  void Run(brillo::MessageLoop* loop) {
+    messages_written_ = 0;
+    bytes_read_ = 0;
+    WriteNext();
+    ReadNext();
+    brillo::MessageLoopRunUntil(
+        loop, base::TimeDelta::FromSeconds(10),
+        base::Bind([this]() { return bytes_read_ == total_size(); }));
+    CHECK_EQ(total_size(), bytes_read_);
+  }
+
+ private:
+  size_t total_size() const { return message_.size() * kMessagesPerIteration; }
+
+  void WriteNext() {
+    if (messages_written_ == kMessagesPerIteration)
+      return;
+    stream_->Write(message_.data(), message_.size(),
+                   base::Bind(&EchoClient::OnWritten, base::Unretained(this)));
+  }
+
+  void OnWritten(weave::ErrorPtr error) {
+    CHECK(!error);
+    messages_written_++;
+    WriteNext();
+  }
+
+  void ReadNext() {
+    stream_->Read(buffer_.data(), buffer_.size(),
+                  base::Bind(&EchoClient::OnRead, base::Unretained(this)));
+  }
+
+  void OnRead(size_t size, weave::ErrorPtr error) {
+    CHECK(!error);
+    CHECK_GT(size, 0u);
+    bytes_read_ += size;
+    if (bytes_read_ < total_size())
+      ReadNext();
+  }
+
+  weave::Stream* stream_;
+  std::string message_;
+  std::vector<char> buffer_;
+  int messages_written_{0};
+  size_t bytes_read_{0};
+};
+
+}  // namespace
+
+// Round trips of stanza-sized messages through TlsStream and a local TLS echo
+// server. The label reports read and write system calls per iteration, for
+// both ends of the connection.
+void BM_TlsStreamEcho(benchmark::State& state) {
+  base::MessageLoopForIO base_loop;
+  brillo::BaseMessageLoop brillo_loop{&base_loop};
+  brillo_loop.SetAsCurrent();
+
+  TlsTestServer server{base::Bind(&Echo)};
+  IoWorkerPool pool{1};
+  DnsCache dns_cache{&pool, DnsCache::Options{}};
+  TlsSessionCache session_cache;
+  session_cache.AddTrustedCertificate(server.certificate());
+
+  std::unique_ptr<weave::Stream> stream;
+  TlsStream::Connect(&dns_cache, &session_cache, "localhost", server.port(),
+                     TlsStream::ConnectOptions{},
+                     base::Bind([&stream](std::unique_ptr<weave::Stream> value,
+                                          weave::ErrorPtr error) {
+                       CHECK(!error) << error->GetMessage();
+                       stream = std::move(value);
+                     }));
+  brillo::MessageLoopRunUntil(&brillo_loop, base::TimeDelta::FromSeconds(10),
+                              base::Bind([&stream]() { return !!stream; }));
+  CHECK(stream);
+
+  EchoClient client{stream.get(), static_cast<size_t>(state.range_x())};
+  uint64_t syscalls = CountSyscalls();
+  while (state.KeepRunning())
+    client.Run(&brillo_loop);
+  syscalls = CountSyscalls() - syscalls;
+
+  state.SetBytesProcessed(state.iterations() * state.range_x() *
+                          kMessagesPerIteration * 2);
+  state.SetLabel(base::StringPrintf(
+      "%.1f syscalls/iteration",
+      static_cast<double>(syscalls) / std::max<size_t>(state.iterations(), 1)));
+  stream.reset();
+}
+BENCHMARK(BM_TlsStreamEcho)->Arg(64)->Arg(512)->Arg(4096);
+
+}  // namespace buffet
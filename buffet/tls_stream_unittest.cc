@@ -0,0 +1,430 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/tls_stream.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/files/scoped_file.h>
+#include <base/message_loop/message_loop.h>
+#include <base/synchronization/waitable_event.h>
+#include <brillo/bind_lambda.h>
+#include <brillo/message_loops/base_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
+#include <gtest/gtest.h>
+
+#include "buffet/dns_cache.h"
+#include "buffet/io_worker_pool.h"
+#include "buffet/stream_meter.h"
+#include "buffet/tls_session_cache.h"
+#include "buffet/tls_test_server.h"
+
+namespace buffet {
+
+namespace {
+
+// Opens a listening socket on an ephemeral port of 127.0.0.1. The kernel
+// accepts connections into the backlog, but nobody ever talks on them.
+base::ScopedFD Listen(uint16_t* port) {
+  base::ScopedFD fd{socket(AF_INET, SOCK_STREAM, 0)};
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  sockaddr* sa = reinterpret_cast<sockaddr*>(&address);
+  if (!fd.is_valid() || bind(fd.get(), sa, length) != 0 ||
+      listen(fd.get(), 4) != 0 || getsockname(fd.get(), sa, &length) != 0) {
+    return base::ScopedFD{};
+  }
+  *port = ntohs(address.sin_port);
+  return fd;
+}
+
+ResolveResult FakeResolve(const std::string& host, uint16_t port) {
+  if (host == "unknown.example.com") {
+    ResolveResult result;
+    result.error = EHOSTUNREACH;
+    return result;
+  }
+  return ResolveHost("127.0.0.1", port);
+}
+
+// Ends a TlsTestServer connection cleanly, so that its session stays
+// resumable.
+void CloseConnection(SSL* ssl, int fd) {
+  SSL_shutdown(ssl);
+}
+
+}  // namespace
+
+class TlsStreamTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    brillo_loop_.SetAsCurrent();
+    dns_cache_.SetResolver(base::Bind(&FakeResolve));
+    options_.connect_timeout = base::TimeDelta::FromSeconds(5);
+    options_.handshake_timeout = base::TimeDelta::FromMilliseconds(100);
+    options_.meter = &meter_;
+  }
+
+  // Starts connecting to |host|:|port|. The result is stored in |done_|,
+  // |stream_| and |error_|.
+  base::Closure Connect(const std::string& host, uint16_t port) {
+    return TlsStream::Connect(
+        &dns_cache_, &session_cache_, host, port, options_,
+        base::Bind(
+            [](TlsStreamTest* test, std::unique_ptr<weave::Stream> stream,
+               weave::ErrorPtr error) {
+              test->done_ = true;
+              test->stream_ = std::move(stream);
+              test->error_ = std::move(error);
+            },
+            base::Unretained(this)));
+  }
+
+  void RunFor(base::TimeDelta duration) {
+    brillo::MessageLoopRunUntil(&brillo_loop_, duration,
+                                base::Bind([]() { return false; }));
+  }
+
+  void RunUntilDone() {
+    brillo::MessageLoopRunUntil(
+        &brillo_loop_, base::TimeDelta::FromSeconds(5),
+        base::Bind([](TlsStreamTest* test) { return test->done_; },
+                   base::Unretained(this)));
+    EXPECT_TRUE(done_);
+  }
+
+  // Connects |stream_| to |server|.
+  void ConnectTo(TlsTestServer* server) {
+    session_cache_.AddTrustedCertificate(server->certificate());
+    Connect("localhost", server->port());
+    RunUntilDone();
+    ASSERT_NE(nullptr, stream_);
+  }
+
+  // Reads up to |size| bytes from |stream_| and waits for the result.
+  std::string Read(size_t size, weave::ErrorPtr* error) {
+    std::vector<char> buffer(size);
+    bool read = false;
+    size_t size_read = 0;
+    stream_->Read(buffer.data(), buffer.size(),
+                  base::Bind(
+                      [&read, &size_read, error](size_t size,
+                                                 weave::ErrorPtr value) {
+                        read = true;
+                        size_read = size;
+                        *error = std::move(value);
+                      }));
+    brillo::MessageLoopRunUntil(&brillo_loop_, base::TimeDelta::FromSeconds(5),
+                                base::Bind([&read]() { return read; }));
+    EXPECT_TRUE(read);
+    return std::string{buffer.data(), size_read};
+  }
+
+  // Writes |data| to |stream_| and waits for the acknowledgement.
+  weave::ErrorPtr Write(const std::string& data) {
+    bool written = false;
+    weave::ErrorPtr error;
+    stream_->Write(data.data(), data.size(),
+                   base::Bind(
+                       [&written, &error](weave::ErrorPtr value) {
+                         written = true;
+                         error = std::move(value);
+                       }));
+    brillo::MessageLoopRunUntil(&brillo_loop_, base::TimeDelta::FromSeconds(5),
+                                base::Bind([&written]() { return written; }));
+    EXPECT_TRUE(written);
+    return error;
+  }
+
+  // Writes |messages| one after another, each from the acknowledgement of the
+  // one before, as libweave does.
+  void WriteBurst(const std::vector<std::string>& messages, size_t index) {
+    if (index == messages.size())
+      return;
+    stream_->Write(
+        messages[index].data(), messages[index].size(),
+        base::Bind(
+            [](TlsStreamTest* test, const std::vector<std::string>& messages,
+               size_t index, weave::ErrorPtr error) {
+              EXPECT_EQ(nullptr, error);
+              test->messages_acknowledged_++;
+              test->WriteBurst(messages, index + 1);
+            },
+            base::Unretained(this), messages, index));
+  }
+
+ protected:
+  base::MessageLoopForIO base_loop_;
+  brillo::BaseMessageLoop brillo_loop_{&base_loop_};
+  IoWorkerPool pool_{1};
+  DnsCache dns_cache_{&pool_, DnsCache::Options{}};
+  TlsSessionCache session_cache_;
+  StreamMeter meter_;
+  TlsStream::ConnectOptions options_;
+
+  bool done_{false};
+  std::unique_ptr<weave::Stream> stream_;
+  weave::ErrorPtr error_;
+  size_t messages_acknowledged_{0};
+};
+
+TEST_F(TlsStreamTest, ResolveFailure) {
+  Connect("unknown.example.com", 443);
+  RunUntilDone();
+  EXPECT_EQ(nullptr, stream_);
+  ASSERT_NE(nullptr, error_);
+  EXPECT_EQ(kDnsErrorCode, error_->GetCode());
+  EXPECT_NE(nullptr, error_->GetInnerError());
+}
+
+TEST_F(TlsStreamTest, ConnectFailure) {
+  uint16_t port = 0;
+  // Nothing listens on the port once the socket is closed.
+  ASSERT_TRUE(Listen(&port).is_valid());
+  Connect("localhost", port);
+  RunUntilDone();
+  EXPECT_EQ(nullptr, stream_);
+  ASSERT_NE(nullptr, error_);
+  EXPECT_EQ(kTcpErrorCode, error_->GetCode());
+}
+
+TEST_F(TlsStreamTest, HandshakeTimeout) {
+  uint16_t port = 0;
+  base::ScopedFD listen_fd = Listen(&port);
+  ASSERT_TRUE(listen_fd.is_valid());
+  Connect("localhost", port);
+  RunUntilDone();
+  EXPECT_EQ(nullptr, stream_);
+  ASSERT_NE(nullptr, error_);
+  EXPECT_EQ(kTlsErrorCode, error_->GetCode());
+  EXPECT_NE(nullptr, error_->GetInnerError());
+}
+
+TEST_F(TlsStreamTest, Abort) {
+  uint16_t port = 0;
+  base::ScopedFD listen_fd = Listen(&port);
+  ASSERT_TRUE(listen_fd.is_valid());
+  options_.handshake_timeout = base::TimeDelta::FromSeconds(5);
+  base::Closure abort = Connect("localhost", port);
+  RunFor(base::TimeDelta::FromMilliseconds(100));
+  EXPECT_FALSE(done_);
+  abort.Run();
+  RunFor(base::TimeDelta::FromMilliseconds(100));
+  EXPECT_FALSE(done_);
+  // The attempt is gone, so a second abort does nothing.
+  abort.Run();
+}
+
+TEST_F(TlsStreamTest, ServesSmallReadsFromReadAheadBuffer) {
+  TlsTestServer server{base::Bind([](SSL* ssl, int fd) {
+    // A single record, followed by close_notify.
+    SSL_write(ssl, "0123456789", 10);
+    SSL_shutdown(ssl);
+  })};
+  ConnectTo(&server);
+  weave::ErrorPtr error;
+  EXPECT_EQ("0123", Read(4, &error));
+  EXPECT_EQ("4567", Read(4, &error));
+  // The rest of the buffered record, without waiting for more data.
+  EXPECT_EQ("89", Read(4, &error));
+  EXPECT_EQ(nullptr, error);
+  // End of stream.
+  EXPECT_EQ("", Read(4, &error));
+  EXPECT_EQ(nullptr, error);
+}
+
+TEST_F(TlsStreamTest, CoalescesWrites) {
+  // SSL_read() returns at most one record, so each chunk is one SSL_write()
+  // of the client.
+  std::vector<int> chunks;
+  base::WaitableEvent received{false, false};
+  TlsTestServer server{base::Bind(
+      [](std::vector<int>* chunks, base::WaitableEvent* received, SSL* ssl,
+         int fd) {
+        char buffer[64];
+        int total = 0;
+        while (total < 3) {
+          int size = SSL_read(ssl, buffer, sizeof(buffer));
+          if (size <= 0)
+            break;
+          chunks->push_back(size);
+          total += size;
+        }
+        received->Signal();
+      },
+      &chunks, &received)};
+  ConnectTo(&server);
+
+  WriteBurst({"a", "b", "c"}, 0);
+  brillo::MessageLoopRunUntil(
+      &brillo_loop_, base::TimeDelta::FromSeconds(5),
+      base::Bind([](TlsStreamTest* test) {
+        return test->messages_acknowledged_ == 3;
+      }, base::Unretained(this)));
+  // Lets the flush run.
+  RunFor(base::TimeDelta::FromMilliseconds(100));
+  ASSERT_TRUE(received.TimedWait(base::TimeDelta::FromSeconds(5)));
+  EXPECT_EQ(std::vector<int>{3}, chunks);
+}
+
+TEST_F(TlsStreamTest, AppliesBackPressure) {
+  // Far more than the socket buffers hold while the server does not read.
+  const size_t kSize = 16 * 1024 * 1024;
+  base::WaitableEvent start_reading{false, false};
+  size_t bytes_received = 0;
+  TlsTestServer server{base::Bind(
+      [](base::WaitableEvent* start_reading, size_t* bytes_received,
+         size_t size, SSL* ssl, int fd) {
+        start_reading->TimedWait(base::TimeDelta::FromSeconds(5));
+        std::vector<char> buffer(16 * 1024);
+        while (*bytes_received < size) {
+          int ret = SSL_read(ssl, buffer.data(), buffer.size());
+          if (ret <= 0)
+            break;
+          *bytes_received += ret;
+        }
+      },
+      &start_reading, &bytes_received, kSize)};
+  ConnectTo(&server);
+
+  const std::string data(kSize, 'x');
+  bool written = false;
+  stream_->Write(data.data(), data.size(),
+                 base::Bind(
+                     [&written](weave::ErrorPtr error) {
+                       EXPECT_EQ(nullptr, error);
+                       written = true;
+                     }));
+  // More than 64 KiB is queued, so the write is not acknowledged yet.
+  RunFor(base::TimeDelta::FromMilliseconds(200));
+  EXPECT_FALSE(written);
+
+  start_reading.Signal();
+  brillo::MessageLoopRunUntil(&brillo_loop_, base::TimeDelta::FromSeconds(5),
+                              base::Bind([&written]() { return written; }));
+  EXPECT_TRUE(written);
+}
+
+TEST_F(TlsStreamTest, ReportsFlushErrorToNextWrite) {
+  // As in weaved, writing to the reset connection fails instead of raising
+  // SIGPIPE.
+  signal(SIGPIPE, SIG_IGN);
+  base::WaitableEvent reset{false, false};
+  TlsTestServer server{base::Bind(
+      [](base::WaitableEvent* reset, SSL* ssl, int fd) {
+        char buffer[1];
+        SSL_read(ssl, buffer, sizeof(buffer));
+        // Closing with a zero linger time resets the connection.
+        linger reset_linger = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset_linger,
+                   sizeof(reset_linger));
+        reset->Signal();
+      },
+      &reset)};
+  ConnectTo(&server);
+  EXPECT_EQ(nullptr, Write("x"));
+  ASSERT_TRUE(reset.TimedWait(base::TimeDelta::FromSeconds(5)));
+  // Lets the reset arrive.
+  RunFor(base::TimeDelta::FromMilliseconds(100));
+
+  // Acknowledged before the flush fails.
+  EXPECT_EQ(nullptr, Write("a"));
+  RunFor(base::TimeDelta::FromMilliseconds(100));
+  weave::ErrorPtr error = Write("b");
+  ASSERT_NE(nullptr, error);
+  EXPECT_EQ(kTlsErrorCode, error->GetCode());
+  // "a" was acknowledged but never sent.
+  EXPECT_EQ(1u, meter_.GetTotals().bytes_written);
+}
+
+TEST_F(TlsStreamTest, CountsPlaintextAndCiphertext) {
+  TlsTestServer server{base::Bind([](SSL* ssl, int fd) {
+    char buffer[5];
+    int size = SSL_read(ssl, buffer, sizeof(buffer));
+    if (size > 0)
+      SSL_write(ssl, buffer, size);
+    // Drains the connection until the client closes it.
+    while (SSL_read(ssl, buffer, sizeof(buffer)) > 0) {
+    }
+  })};
+  ConnectTo(&server);
+  EXPECT_EQ(nullptr, Write("hello"));
+  weave::ErrorPtr error;
+  EXPECT_EQ("hello", Read(5, &error));
+
+  StreamMeter::Totals totals = meter_.GetTotals();
+  EXPECT_EQ(5u, totals.bytes_written);
+  EXPECT_EQ(1u, totals.writes);
+  EXPECT_EQ(5u, totals.bytes_read);
+  EXPECT_EQ(1u, totals.reads);
+  // The handshake and record framing come on top of the plaintext.
+  EXPECT_GT(totals.socket_bytes_written, totals.bytes_written);
+  EXPECT_GT(totals.socket_bytes_read, totals.bytes_read);
+
+  // Data flushed on destruction, and the close_notify, are counted too.
+  uint64_t socket_bytes_written = totals.socket_bytes_written;
+  stream_->Write("bye", 3, base::Bind([](weave::ErrorPtr error) {}));
+  stream_.reset();
+  totals = meter_.GetTotals();
+  EXPECT_EQ(8u, totals.bytes_written);
+  EXPECT_EQ(2u, totals.writes);
+  EXPECT_GT(totals.socket_bytes_written, socket_bytes_written + 3);
+}
+
+TEST_F(TlsStreamTest, ResumesSession) {
+  TlsTestServer server{base::Bind(&CloseConnection)};
+  ConnectTo(&server);
+  stream_.reset();
+
+  done_ = false;
+  Connect("localhost", server.port());
+  RunUntilDone();
+  ASSERT_NE(nullptr, stream_);
+  EXPECT_EQ(1u, session_cache_.GetStats().full_handshakes);
+  EXPECT_EQ(1u, session_cache_.GetStats().resumed_handshakes);
+}
+
+TEST_F(TlsStreamTest, ForgetsSessionAfterFailedHandshake) {
+  TlsTestServer server{base::Bind(&CloseConnection)};
+  ConnectTo(&server);
+  stream_.reset();
+
+  // Same host, but a certificate that is not trusted.
+  TlsTestServer untrusted_server{base::Bind(&CloseConnection)};
+  done_ = false;
+  Connect("localhost", untrusted_server.port());
+  RunUntilDone();
+  EXPECT_EQ(nullptr, stream_);
+  ASSERT_NE(nullptr, error_);
+  EXPECT_EQ(kTlsErrorCode, error_->GetCode());
+
+  done_ = false;
+  Connect("localhost", server.port());
+  RunUntilDone();
+  ASSERT_NE(nullptr, stream_);
+  EXPECT_EQ(2u, session_cache_.GetStats().full_handshakes);
+  EXPECT_EQ(0u, session_cache_.GetStats().resumed_handshakes);
+}
+
+}  // namespace buffet
@@ -0,0 +1,97 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/tls_test_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <base/logging.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+#include <openssl/x509v3.h>
+
+namespace buffet {
+
+TlsTestServer::TlsTestServer(const Handler& handler) : handler_{handler} {
+  EC_KEY* ec_key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+  CHECK(EC_KEY_generate_key(ec_key));
+  key_ = EVP_PKEY_new();
+  EVP_PKEY_assign_EC_KEY(key_, ec_key);
+
+  certificate_ = X509_new();
+  X509_set_version(certificate_, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(certificate_), 1);
+  X509_gmtime_adj(X509_get_notBefore(certificate_), -60);
+  X509_gmtime_adj(X509_get_notAfter(certificate_), 24 * 3600);
+  X509_NAME* name = X509_get_subject_name(certificate_);
+  X509_NAME_add_entry_by_txt(
+      name, "CN", MBSTRING_ASC,
+      reinterpret_cast<const uint8_t*>("localhost"), -1, -1, 0);
+  X509_set_issuer_name(certificate_, name);
+  X509_set_pubkey(certificate_, key_);
+  X509_EXTENSION* san = X509V3_EXT_conf_nid(
+      nullptr, nullptr, NID_subject_alt_name,
+      const_cast<char*>("DNS:localhost"));
+  X509_add_ext(certificate_, san, -1);
+  X509_EXTENSION_free(san);
+  CHECK(X509_sign(certificate_, key_, EVP_sha256()));
+
+  ctx_ = SSL_CTX_new(TLSv1_2_server_method());
+  CHECK(SSL_CTX_use_certificate(ctx_, certificate_));
+  CHECK(SSL_CTX_use_PrivateKey(ctx_, key_));
+
+  listen_fd_.reset(socket(AF_INET, SOCK_STREAM, 0));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  sockaddr* sa = reinterpret_cast<sockaddr*>(&address);
+  CHECK_EQ(0, bind(listen_fd_.get(), sa, length));
+  CHECK_EQ(0, listen(listen_fd_.get(), 4));
+  CHECK_EQ(0, getsockname(listen_fd_.get(), sa, &length));
+  port_ = ntohs(address.sin_port);
+  thread_.Start();
+}
+
+TlsTestServer::~TlsTestServer() {
+  // Makes accept() fail, which ends Run().
+  shutdown(listen_fd_.get(), SHUT_RDWR);
+  thread_.Join();
+  SSL_CTX_free(ctx_);
+  X509_free(certificate_);
+  EVP_PKEY_free(key_);
+}
+
+void TlsTestServer::Run() {
+  for (;;) {
+    base::ScopedFD fd{accept(listen_fd_.get(), nullptr, nullptr)};
+    if (!fd.is_valid())
+      return;
+    // Keeps a handler that waits for a client gone wrong from hanging the
+    // test.
+    timeval timeout = {5, 0};
+    setsockopt(fd.get(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    SSL* ssl = SSL_new(ctx_);
+    SSL_set_fd(ssl, fd.get());
+    if (SSL_accept(ssl) == 1)
+      handler_.Run(ssl, fd.get());
+    SSL_free(ssl);
+  }
+}
+
+}  // namespace buffet
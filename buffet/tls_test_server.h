@@ -0,0 +1,59 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BUFFET_TLS_TEST_SERVER_H_
+#define BUFFET_TLS_TEST_SERVER_H_
+
+#include <base/callback.h>
+#include <base/files/scoped_file.h>
+#include <base/macros.h>
+#include <base/threading/simple_thread.h>
+#include <openssl/ssl.h>
+
+namespace buffet {
+
+// TLS server on 127.0.0.1 for tests and benchmarks of TlsStream. It presents a
+// self-signed certificate for "localhost" and serves one connection at a time
+// on its own thread.
+class TlsTestServer final : public base::DelegateSimpleThread::Delegate {
+ public:
+  // Runs on the server thread once the handshake of an accepted connection is
+  // done. |ssl| uses the blocking socket |fd|, which has a 5 second receive
+  // timeout. The connection is closed when the handler returns.
+  using Handler = base::Callback<void(SSL* ssl, int fd)>;
+
+  explicit TlsTestServer(const Handler& handler);
+  ~TlsTestServer() override;
+
+  uint16_t port() const { return port_; }
+  // To be trusted by the client.
+  X509* certificate() const { return certificate_; }
+
+ private:
+  void Run() override;
+
+  Handler handler_;
+  EVP_PKEY* key_{nullptr};
+  X509* certificate_{nullptr};
+  SSL_CTX* ctx_{nullptr};
+  base::ScopedFD listen_fd_;
+  uint16_t port_{0};
+  base::DelegateSimpleThread thread_{this, "tls_test_server"};
+
+  DISALLOW_COPY_AND_ASSIGN(TlsTestServer);
+};
+
+}  // namespace buffet
+
+#endif  // BUFFET_TLS_TEST_SERVER_H_
@@ -23,6 +23,7 @@
 #include <libwebserv/server.h>
 
 #include "buffet/dbus_constants.h"
+#include "buffet/prioritized_task_runner.h"
 #include "buffet/socket_stream.h"
 
 namespace buffet {
@@ -145,6 +146,9 @@ void WebServClient::OnRequest(const RequestHandlerCallback& callback,
                               std::unique_ptr<libwebserv::Response> response) {
   std::unique_ptr<Request> weave_request{
       new RequestImpl{std::move(request), std::move(response)}};
+  // A local client is waiting for the reply, so make sure whatever libweave
+  // posts while handling the request does not queue up behind cloud work.
+  ScopedTaskPriority scoped_priority{TaskPriority::kInteractive};
   callback.Run(std::move(weave_request));
 }
 